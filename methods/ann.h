@@ -9,6 +9,8 @@
 #include "util.h"
 #include "qalsh.h"
 #include "qalsh_plus.h"
+#include "qalsh_lsm.h"
+#include "version.h"
 
 namespace nns {
 
@@ -102,18 +104,156 @@ int linear_scan(                    // brute-force linear scan (data on disk)
     return 0;
 }
 
+// -----------------------------------------------------------------------------
+inline int pack_index(              // pack an index folder into one file
+    const char *path,                   // index path
+    FILE  *fp)                          // output file
+{
+    gettimeofday(&g_start_time, NULL);
+    if (Pack::write(path)) return 1;
+
+    gettimeofday(&g_end_time, NULL);
+    float pack_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+        (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+    char fname[200]; Pack::get_pack_name(path, fname);
+
+    printf("Pack Index (%s) = %f Seconds\n\n", fname, pack_time);
+    fprintf(fp, "Pack Index = %f Seconds\n\n", pack_time);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+inline int publish_index(           // publish a staged build of an index
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   version,                      // version of staged build
+    FILE  *fp)                          // output file
+{
+    int old = read_version(ofolder, name);
+    if (publish_version(ofolder, name, version)) return 1;
+
+    // the searches may still run on the old version, so only the versions
+    // before it are removed
+    remove_versions(ofolder, name, old);
+
+    printf("Publish %s Version %d (Old Version %d)\n\n", name, version, old);
+    fprintf(fp, "Publish %s Version %d (Old Version %d)\n\n", name, version, 
+        old);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+//  an update (insertion, deletion, or extension) works on a new version, a 
+//  copy of the current one, which is published once the update is done. so
+//  a published version is never changed under the searches on it.
+// -----------------------------------------------------------------------------
+inline int stage_update(            // copy the current version for an update
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    char  *path)                        // folder of new version (return)
+{
+    int version = new_version(ofolder, name);
+    if (copy_version(ofolder, name, read_version(ofolder, name), version)) {
+        return -1;
+    }
+    get_version_path(ofolder, name, version, path);
+    return version;
+}
+
+// -----------------------------------------------------------------------------
+inline int publish_update(          // publish the new version of an update
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   version,                      // version of update
+    FILE  *fp)                          // output file
+{
+    // the pack of the current version is out of date, so it is packed again
+    char path[200], fname[200];
+    get_version_path(ofolder, name, read_version(ofolder, name), path);
+    Pack::get_pack_name(path, fname);
+    if (access(fname, F_OK) == 0) {
+        get_version_path(ofolder, name, version, path);
+        if (pack_index(path, fp)) return 1;
+    }
+    return publish_index(ofolder, name, version, fp);
+}
+
+// -----------------------------------------------------------------------------
+//  the budget of candidates is tuned as budget + top_k - 1 for the tuned 
+//  top-k, but it is stored without the offset top_k - 1, so that a search 
+//  of any top-k adds its own offset (see tuned_budget).
+// -----------------------------------------------------------------------------
+inline int write_tuned_params(      // write tuned parameters of search
+    const char *fname,                  // file name of tuned parameters
+    int   top_k,                        // top-k value
+    int   nb,                           // number of blocks (-1: none)
+    const QueryParams &params)          // tuned parameters of queries
+{
+    FILE *fp = fopen(fname, "w");
+    if (!fp) { printf("Could not create %s\n", fname); return 1; }
+
+    fprintf(fp, "top_k  %d\n", top_k);
+    fprintf(fp, "nb     %d\n", nb);
+    fprintf(fp, "c      %f\n", params.c_);
+    fprintf(fp, "budget %d\n", params.budget_ - (top_k - 1));
+    fprintf(fp, "l      %d\n", params.l_);
+    fclose(fp);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+inline int read_tuned_params(       // read tuned parameters of search
+    const char *fname,                  // file name of tuned parameters
+    int   &nb,                          // number of blocks (return)
+    QueryParams &params)                // tuned parameters of queries (return)
+{
+    FILE *fp = fopen(fname, "r");
+    if (!fp) { printf("Could not open %s\n", fname); return 1; }
+
+    char  key[20];
+    float val = -1.0f;
+    while (fscanf(fp, "%19s %f", key, &val) == 2) {
+        if (strcmp(key, "nb") == 0) nb = (int) val;
+        else if (strcmp(key, "c") == 0) params.c_ = val;
+        else if (strcmp(key, "budget") == 0) params.budget_ = (int) val;
+        else if (strcmp(key, "l") == 0) params.l_ = (int) val;
+    }
+    fclose(fp);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+inline const QueryParams* tuned_budget(// set the tuned budget for a top-k
+    int   top_k,                        // top-k value
+    int   budget,                       // tuned budget (-1: not tuned)
+    const QueryParams *params,          // parameters of queries
+    QueryParams &kparams)               // parameters for top_k (return)
+{
+    if (budget <= 0) return params;
+
+    if (params != NULL) kparams = *params;
+    kparams.budget_ = budget + top_k - 1;
+    return &kparams;
+}
+
 // -----------------------------------------------------------------------------
 template<class DType>
 int indexing_of_qalsh_plus(         // indexing of qalsh+
     int   n,                            // number of data points
     int   d,                            // dimensionality
     int   B,                            // page size
+    int   LB,                           // leaf node size of b+ trees
+    int   interval,                     // number of ids per key in leaves
     int   leaf,                         // leaf size of kd-tree
     int   L,                            // number of projection (drusilla)
     int   M,                            // number of candidates (drusilla)
     float p,                            // l_p distance, p \in (0,2]
     float zeta,                         // symmetric factor of p-stable distr.
     float c,                            // approximation ratio
+    int   share,                        // share hash functions among blocks
+    int   part,                         // 0: kd-tree, 1: k-means, 2: rp-tree
+    int   use_pack,                     // pack index into one file
+    int   stage,                        // build a new version and publish it
     const DType *data,                  // data points
     const char *ofolder)                // output folder
 {
@@ -121,11 +261,15 @@ int indexing_of_qalsh_plus(         // indexing of qalsh+
     FILE *fp = fopen(fname, "a+");
     if (!fp) { printf("Could not create %s\n", fname); return 1; }
 
+    // a staged build runs beside the searches, so it yields the cpu to them
+    int  version = stage ? new_version(ofolder, "qalsh_plus") : -1;
+    char path[200]; get_version_path(ofolder, "qalsh_plus", version, path);
+    if (stage) nice(STAGE_NICE);
+
     //  indexing of QALSH+
     gettimeofday(&g_start_time, NULL);
-    char path[200]; sprintf(path, "%sqalsh_plus/", ofolder);
     QALSH_PLUS<DType> *lsh = new QALSH_PLUS<DType>(n, d, B, leaf, L, M, p, 
-        zeta, c, data, path);
+        zeta, c, data, path, share, part, LB, interval);
     lsh->display();
 
     gettimeofday(&g_end_time, NULL);
@@ -138,16 +282,124 @@ int indexing_of_qalsh_plus(         // indexing of qalsh+
     fprintf(fp, "Indexing Time = %f Seconds\n", g_indexing_time);
     fprintf(fp, "Estimated Mem = %f MB\n\n", g_estimated_mem);
 
-    fclose(fp);
+    // the b+ trees are flushed to disk after the index is released
     delete lsh;
+    if (use_pack && pack_index(path, fp)) return 1;
+    if (stage && publish_index(ofolder, "qalsh_plus", version, fp)) return 1;
+    fclose(fp);
     return 0;
 }
 
+// -----------------------------------------------------------------------------
+template<class DType>
+void knn_of_qalsh_plus_incr(        // incremental k-NN search of qalsh+
+    int   qn,                           // number of query points
+    int   d,                            // dimensionality
+    const DType *query,                 // query points
+    const Result *truth,                // ground truth
+    const char *dfolder,                // data folder
+    int   budget,                       // tuned budget (-1: not tuned)
+    const QueryParams *params,          // parameters of queries
+    QALSH_PLUS<DType> *lsh,             // qalsh+ index
+    FILE  *fp)                          // output file
+{
+    // -------------------------------------------------------------------------
+    //  the search with <nb> blocks is the search with <nb-1> blocks plus one 
+    //  more block. thus, for each query and each top-k, we route only once and 
+    //  search the blocks one by one with the same top-k list. the ratio, 
+    //  recall, I/O, and time are recorded cumulatively for each nb.
+    // -------------------------------------------------------------------------
+    int n_blocks = lsh->get_num_blocks();
+    int n_topks  = (int) TOPKs.size();
+    int size     = n_blocks * n_topks;
+
+    float    *ratio   = new float[size];
+    float    *recall  = new float[size];
+    float    *runtime = new float[size];
+    uint64_t *page_io = new uint64_t[size];
+    memset(ratio,   0, sizeof(float)*size);
+    memset(recall,  0, sizeof(float)*size);
+    memset(runtime, 0, sizeof(float)*size);
+    memset(page_io, 0, sizeof(uint64_t)*size);
+
+    std::vector<int> block_order;
+    for (int j = 0; j < n_topks; ++j) {
+        int top_k = TOPKs[j];
+        MinK_List *list = new MinK_List(top_k);
+        QueryParams kparams;
+        const QueryParams *kp = tuned_budget(top_k, budget, params, kparams);
+
+        for (int i = 0; i < qn; ++i) {
+            const DType  *q = &query[(uint64_t)i*d];
+            const Result *t = &truth[(uint64_t)i*MAXK];
+
+            // route the query to all blocks
+            gettimeofday(&g_start_time, NULL);
+            block_order.clear();
+            uint64_t io = lsh->get_block_order(n_blocks, q, dfolder, 
+                block_order);
+            list->reset();
+            gettimeofday(&g_end_time, NULL);
+            float time = g_end_time.tv_sec - g_start_time.tv_sec + 
+                (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+
+            // search one more block at each step
+            for (int nb = 0; nb < n_blocks; ++nb) {
+                gettimeofday(&g_start_time, NULL);
+                io += lsh->knn_block(top_k, block_order[nb], q, dfolder, list,
+                    kp);
+                gettimeofday(&g_end_time, NULL);
+                time += g_end_time.tv_sec - g_start_time.tv_sec + 
+                    (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+
+                int id = nb*n_topks + j;
+                page_io[id] += io;
+                runtime[id] += time;
+                ratio[id]   += calc_ratio(top_k, t, list);
+                recall[id]  += calc_recall(top_k, t, list);
+            }
+        }
+        delete list;
+    }
+
+    // print the results in the same format as knn_of_qalsh_plus
+    for (int nb = 0; nb < n_blocks; ++nb) {
+        printf("nb = %d\n", nb+1);
+        fprintf(fp, "nb = %d\n", nb+1);
+
+        printf("Top-k\t\tRatio\t\tI/O\t\tTime (ms)\tRecall\n");
+        for (int j = 0; j < n_topks; ++j) {
+            int id = nb*n_topks + j;
+            g_ratio   = ratio[id] / qn;
+            g_recall  = recall[id] / qn;
+            g_runtime = (runtime[id]*1000.0f) / qn;
+            g_page_io = (uint64_t) ceil((double) page_io[id]/qn);
+
+            printf("%d\t\t%.4f\t\t%llu\t\t%.2f\t\t%.2f\n", TOPKs[j], g_ratio, 
+                g_page_io, g_runtime, g_recall);
+            fprintf(fp, "%d\t%f\t%llu\t%f\t%f\n", TOPKs[j], g_ratio, 
+                g_page_io, g_runtime, g_recall);
+        }
+        printf("\n");
+        fprintf(fp, "\n");
+    }
+    delete[] ratio;
+    delete[] recall;
+    delete[] runtime;
+    delete[] page_io;
+}
+
 // -----------------------------------------------------------------------------
 template<class DType>
 int knn_of_qalsh_plus(              // k-NN search of qalsh+
     int   qn,                           // number of query points
     int   d,                            // dimensionality
+    int   incr,                         // incremental evaluation of nb
+    int   use_mmap,                     // map b+ trees into memory
+    int   use_pack,                     // read index from its pack
+    int   use_loc,                      // find leaves by learned locators
+    int   use_tune,                     // use tuned parameters of search
+    const QueryParams *params,          // parameters of queries
     const DType *query,                 // query points
     const Result *truth,                // ground truth
     const char *dfolder,                // data folder
@@ -157,11 +409,38 @@ int knn_of_qalsh_plus(              // k-NN search of qalsh+
     FILE *fp = fopen(fname, "a+");
     if (!fp) { printf("Could not create %s\n", fname); return 1; }
 
-    // load QALSH+
+    // the tuned parameters replace the given ones (except the deadlines), and
+    // nb is fixed. the tuned budget is offset by top_k - 1 for each top_k.
+    int nb_tuned = -1, budget = -1;
+    QueryParams tuned, kparams;
+    if (use_tune) {
+        char tname[200]; sprintf(tname, "%sqalsh_plus.tune", ofolder);
+        if (read_tuned_params(tname, nb_tuned, tuned)) { fclose(fp); return 1; }
+        if (params != NULL) {
+            tuned.time_ = params->time_;
+            tuned.io_   = params->io_;
+            tuned.cand_ = params->cand_;
+        }
+        params = &tuned; budget = tuned.budget_;
+    }
+
+    // load QALSH+, and switch to a new version once it is published
     gettimeofday(&g_start_time, NULL);
-    char path[200]; sprintf(path, "%sqalsh_plus/", ofolder);
-    QALSH_PLUS<DType> *lsh = new QALSH_PLUS<DType>(path);
-    lsh->display();
+    typedef QALSH_PLUS<DType> Index;
+    Index_Handle<Index> handle(ofolder, "qalsh_plus", 
+        [&](const char *path) -> std::shared_ptr<Index> {
+            Pack *pack = NULL;
+            if (use_pack) {
+                pack = new Pack();
+                if (pack->load(path, use_mmap)) { delete pack; return NULL; }
+            }
+            Index *lsh = new Index(path, -1, use_mmap, pack);
+            lsh->set_locator(use_loc);
+            return std::shared_ptr<Index>(lsh, [pack](Index *lsh) { 
+                delete lsh; delete pack; });
+        });
+    handle.acquire()->display();
+    handle.watch(WATCH_INTERVAL);
 
     gettimeofday(&g_end_time, NULL);
     g_indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
@@ -170,20 +449,41 @@ int knn_of_qalsh_plus(              // k-NN search of qalsh+
 
     // c-k-ANNS by QALSH+
     printf("k-NN Search by QALSH+: \n");
-    for (int nb = 1; nb <= lsh->get_num_blocks(); ++nb) {
+    if (incr) {
+        // each query is routed only once, so all of them run on one version
+        std::shared_ptr<Index> lsh = handle.acquire();
+        knn_of_qalsh_plus_incr<DType>(qn, d, query, truth, dfolder, budget,
+            params, lsh.get(), fp);
+        fclose(fp);
+        return 0;
+    }
+    // with deadlines, also report the percentage of queries which reach the 
+    // stop conditions of c-k-ANNS before their deadlines
+    bool deadline = has_deadlines(params);
+    int n_blocks = handle.acquire()->get_num_blocks();
+    int nb_first = 1;
+    if (nb_tuned > 0) nb_first = n_blocks = std::min(nb_tuned, n_blocks);
+    for (int nb = nb_first; nb <= n_blocks; ++nb) {
         printf("nb = %d\n", nb);
         fprintf(fp, "nb = %d\n", nb);
 
-        printf("Top-k\t\tRatio\t\tI/O\t\tTime (ms)\tRecall\n");
+        printf("Top-k\t\tRatio\t\tI/O\t\tTime (ms)\tRecall%s\n", 
+            deadline ? "\t\tGuarantee" : "");
         for (int top_k : TOPKs) {
             gettimeofday(&g_start_time, NULL);
             MinK_List *list = new MinK_List(top_k);
             g_ratio   = 0.0f;
             g_recall  = 0.0f;
             g_page_io = 0;
+            int n_guar = 0;
 
             for (int i = 0; i < qn; ++i) {
-                g_page_io += lsh->knn(top_k, nb, &query[(uint64_t)i*d], dfolder, list);
+                // a query holds the version it started on until it is done
+                std::shared_ptr<Index> lsh = handle.acquire();
+                int m = std::min(nb, lsh->get_num_blocks());
+                g_page_io += lsh->knn(top_k, m, &query[(uint64_t)i*d], dfolder, 
+                    list, tuned_budget(top_k, budget, params, kparams));
+                if (lsh->get_guarantee()) ++n_guar;
                 g_ratio   += calc_ratio(top_k, &truth[(uint64_t)i*MAXK], list);
                 g_recall  += calc_recall(top_k, &truth[(uint64_t)i*MAXK], list);
             }
@@ -197,8 +497,10 @@ int knn_of_qalsh_plus(              // k-NN search of qalsh+
             g_runtime = (g_runtime*1000.0f) / qn;
             g_page_io = (uint64_t) ceil((double) g_page_io/qn);
 
-            printf("%d\t\t%.4f\t\t%llu\t\t%.2f\t\t%.2f\n", top_k, g_ratio, 
+            printf("%d\t\t%.4f\t\t%llu\t\t%.2f\t\t%.2f", top_k, g_ratio, 
                 g_page_io, g_runtime, g_recall);
+            if (deadline) printf("\t\t%.2f", 100.0f * n_guar / qn);
+            printf("\n");
             fprintf(fp, "%d\t%f\t%llu\t%f\t%f\n", top_k, g_ratio, g_page_io, 
                 g_runtime, g_recall);
         }
@@ -206,7 +508,58 @@ int knn_of_qalsh_plus(              // k-NN search of qalsh+
         fprintf(fp, "\n");
     }
     fclose(fp);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int insert_of_qalsh_plus(           // insertion of qalsh+
+    int   n,                            // number of data points
+    int   d,                            // dimensionality
+    int   leaf,                         // max number of points in a block
+    int   L,                            // number of projection (drusilla)
+    int   M,                            // number of candidates (drusilla)
+    const DType *data,                  // data points
+    const char *dfolder,                // data folder
+    const char *ofolder)                // output folder
+{
+    char fname[200]; sprintf(fname, "%sqalsh_plus.out", ofolder);
+    FILE *fp = fopen(fname, "a+");
+    if (!fp) { printf("Could not create %s\n", fname); return 1; }
+
+    // insert the data points which are not in the index yet
+    gettimeofday(&g_start_time, NULL);
+    char path[200]; 
+    int  version = stage_update(ofolder, "qalsh_plus", path);
+    if (version < 0) { fclose(fp); return 1; }
+    QALSH_PLUS<DType> *lsh = new QALSH_PLUS<DType>(path);
+    int n0 = lsh->get_num_points();
+    int nb = lsh->get_num_blocks();
+    if (n0 >= n) { 
+        printf("No new data points (%d >= %d)\n", n0, n); 
+        delete lsh; remove_version(ofolder, "qalsh_plus", version); 
+        fclose(fp); return 1;
+    }
+    // a failed update is not published, and its version is removed
+    if (lsh->insert(n - n0, leaf, L, M, &data[(uint64_t) n0*d], dfolder)) {
+        delete lsh; remove_version(ofolder, "qalsh_plus", version); exit(1);
+    }
+    lsh->display();
+
+    gettimeofday(&g_end_time, NULL);
+    g_indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+        (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+
+    printf("Insert %d Points = %f Seconds\n", n - n0, g_indexing_time);
+    printf("Split Blocks: %d -> %d\n\n", nb, lsh->get_num_blocks());
+    fprintf(fp, "Insert %d Points = %f Seconds\n", n - n0, g_indexing_time);
+    fprintf(fp, "Split Blocks: %d -> %d\n\n", nb, lsh->get_num_blocks());
+
     delete lsh;
+    if (publish_update(ofolder, "qalsh_plus", version, fp)) {
+        remove_version(ofolder, "qalsh_plus", version); exit(1);
+    }
+    fclose(fp);
     return 0;
 }
 
@@ -216,9 +569,13 @@ int indexing_of_qalsh(              // indexing of qalsh
     int   n,                            // number of data points
     int   d,                            // dimensionality
     int   B,                            // page size
+    int   LB,                           // leaf node size of b+ trees
+    int   interval,                     // number of ids per key in leaves
     float p,                            // l_p distance, p \in (0,2]
     float zeta,                         // symmetric factor of p-stable distr.
     float c,                            // approximation ratio
+    int   use_pack,                     // pack index into one file
+    int   stage,                        // build a new version and publish it
     const DType *data,                  // data points
     const char *ofolder)                // output folder
 {
@@ -226,10 +583,15 @@ int indexing_of_qalsh(              // indexing of qalsh
     FILE *fp = fopen(fname, "a+");
     if (!fp) { printf("Could not create %s\n", fname); return 1; }
 
+    // a staged build runs beside the searches, so it yields the cpu to them
+    int  version = stage ? new_version(ofolder, "qalsh") : -1;
+    char path[200]; get_version_path(ofolder, "qalsh", version, path);
+    if (stage) nice(STAGE_NICE);
+
     // indexing of QALSH
     gettimeofday(&g_start_time, NULL);
-    char path[200]; sprintf(path, "%sqalsh/", ofolder);
-    QALSH<DType> *lsh = new QALSH<DType>(n, d, B, p, zeta, c, data, path);
+    QALSH<DType> *lsh = new QALSH<DType>(n, d, B, p, zeta, c, data, path, 
+        NULL, NULL, LB, interval);
     lsh->display();
 
     gettimeofday(&g_end_time, NULL);
@@ -242,8 +604,172 @@ int indexing_of_qalsh(              // indexing of qalsh
     fprintf(fp, "Indexing Time = %f Seconds\n", g_indexing_time);
     fprintf(fp, "Estimated Mem = %f MB\n\n", g_estimated_mem);
 
+    // the b+ trees are flushed to disk after the index is released
+    delete lsh;
+    if (use_pack && pack_index(path, fp)) return 1;
+    if (stage && publish_index(ofolder, "qalsh", version, fp)) return 1;
     fclose(fp);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int insert_of_qalsh(                // insertion of qalsh
+    int   n,                            // number of data points
+    int   d,                            // dimensionality
+    const DType *data,                  // data points
+    const char *dfolder,                // data folder
+    const char *ofolder)                // output folder
+{
+    char fname[200]; sprintf(fname, "%sqalsh.out", ofolder);
+    FILE *fp = fopen(fname, "a+");
+    if (!fp) { printf("Could not create %s\n", fname); return 1; }
+
+    // insert the data points which are not in the index yet
+    gettimeofday(&g_start_time, NULL);
+    char path[200]; 
+    int  version = stage_update(ofolder, "qalsh", path);
+    if (version < 0) { fclose(fp); return 1; }
+    QALSH<DType> *lsh = new QALSH<DType>(path, NULL, NULL, true);
+    int n0 = lsh->n_pts_;
+    if (n0 >= n) { 
+        printf("No new data points (%d >= %d)\n", n0, n); 
+        delete lsh; remove_version(ofolder, "qalsh", version); 
+        fclose(fp); return 1;
+    }
+    // a failed update is not published, and its version is removed
+    if (lsh->insert(n - n0, &data[(uint64_t) n0*d], dfolder)) {
+        delete lsh; remove_version(ofolder, "qalsh", version); exit(1);
+    }
+    lsh->display();
+
+    gettimeofday(&g_end_time, NULL);
+    g_indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+        (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+
+    printf("Insert %d Points = %f Seconds\n\n", n - n0, g_indexing_time);
+    fprintf(fp, "Insert %d Points = %f Seconds\n\n", n - n0, 
+        g_indexing_time);
+
     delete lsh;
+    if (publish_update(ofolder, "qalsh", version, fp)) {
+        remove_version(ofolder, "qalsh", version); exit(1);
+    }
+    fclose(fp);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int delete_of_qalsh(                // deletion of qalsh
+    int   n,                            // number of data points
+    const DType *data,                  // data points
+    const char *rfile,                  // file of ids of deleted points
+    const char *ofolder)                // output folder
+{
+    char fname[200]; sprintf(fname, "%sqalsh.out", ofolder);
+    FILE *fp = fopen(fname, "a+");
+    if (!fp) { printf("Could not create %s\n", fname); return 1; }
+
+    // read the ids of deleted points (separated by whitespaces)
+    FILE *fr = fopen(rfile, "r");
+    if (!fr) { printf("Could not open %s\n", rfile); fclose(fp); return 1; }
+    std::vector<int> ids;
+    int id = -1;
+    while (fscanf(fr, "%d", &id) == 1) ids.push_back(id);
+    fclose(fr);
+
+    // mark the ids in the tombstones. the b+ trees which have too many 
+    // deleted entries are compacted in the background, so the deletion 
+    // returns before the compaction ends.
+    gettimeofday(&g_start_time, NULL);
+    char path[200]; 
+    int  version = stage_update(ofolder, "qalsh", path);
+    if (version < 0) { fclose(fp); return 1; }
+    QALSH<DType> *lsh = new QALSH<DType>(path, NULL, NULL, true);
+    if (lsh->n_pts_ > n) {
+        printf("Not enough data points (%d < %d)\n", n, lsh->n_pts_);
+        delete lsh; remove_version(ofolder, "qalsh", version); 
+        fclose(fp); return 1;
+    }
+    if (lsh->erase((int) ids.size(), ids.data(), data)) {
+        delete lsh; remove_version(ofolder, "qalsh", version); exit(1);
+    }
+
+    gettimeofday(&g_end_time, NULL);
+    g_indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+        (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+    printf("Delete %d Points = %f Seconds\n", (int) ids.size(), 
+        g_indexing_time);
+    fprintf(fp, "Delete %d Points = %f Seconds\n", (int) ids.size(), 
+        g_indexing_time);
+
+    int num = lsh->wait_compact();
+    if (num < 0) {
+        delete lsh; remove_version(ofolder, "qalsh", version); exit(1);
+    }
+
+    gettimeofday(&g_end_time, NULL);
+    g_indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+        (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+    printf("Compaction Ends = %f Seconds\n", g_indexing_time);
+    printf("Deleted Points: %d, Compacted Trees: %d\n\n", lsh->n_dead_, num);
+    fprintf(fp, "Compaction Ends = %f Seconds\n", g_indexing_time);
+    fprintf(fp, "Deleted Points: %d, Compacted Trees: %d\n\n", lsh->n_dead_, 
+        num);
+
+    delete lsh;
+    if (publish_update(ofolder, "qalsh", version, fp)) {
+        remove_version(ofolder, "qalsh", version); exit(1);
+    }
+    fclose(fp);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int extend_of_qalsh(                // extension of qalsh by hash tables
+    int   n,                            // number of data points
+    int   n_tables,                     // number of hash tables (-1: by c)
+    float c,                            // approximation ratio (-1: as built)
+    const DType *data,                  // data points
+    const char *ofolder)                // output folder
+{
+    char fname[200]; sprintf(fname, "%sqalsh.out", ofolder);
+    FILE *fp = fopen(fname, "a+");
+    if (!fp) { printf("Could not create %s\n", fname); return 1; }
+
+    // build the b+ trees of the new hash tables only
+    gettimeofday(&g_start_time, NULL);
+    char path[200]; 
+    int  version = stage_update(ofolder, "qalsh", path);
+    if (version < 0) { fclose(fp); return 1; }
+    QALSH<DType> *lsh = new QALSH<DType>(path, NULL, NULL, true);
+    if (lsh->n_pts_ > n) {
+        printf("Not enough data points (%d < %d)\n", n, lsh->n_pts_);
+        delete lsh; remove_version(ofolder, "qalsh", version); 
+        fclose(fp); return 1;
+    }
+    int m0 = lsh->m_;
+    if (lsh->extend(n_tables, c, data)) {
+        delete lsh; remove_version(ofolder, "qalsh", version); exit(1);
+    }
+    lsh->display();
+
+    gettimeofday(&g_end_time, NULL);
+    g_indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+        (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+
+    printf("Extend Hash Tables %d -> %d = %f Seconds\n\n", m0, lsh->m_, 
+        g_indexing_time);
+    fprintf(fp, "Extend Hash Tables %d -> %d = %f Seconds\n\n", m0, lsh->m_, 
+        g_indexing_time);
+
+    delete lsh;
+    if (publish_update(ofolder, "qalsh", version, fp)) {
+        remove_version(ofolder, "qalsh", version); exit(1);
+    }
+    fclose(fp);
     return 0;
 }
 
@@ -252,6 +778,12 @@ template<class DType>
 int knn_of_qalsh(                   // k-NN search of qalsh
     int   qn,                           // number of query points
     int   d,                            // dimensionality
+    int   n_tables,                     // number of hash tables (-1: all)
+    int   use_mmap,                     // map b+ trees into memory
+    int   use_pack,                     // read index from its pack
+    int   use_loc,                      // find leaves by learned locators
+    int   use_tune,                     // use tuned parameters of search
+    const QueryParams *params,          // parameters of queries
     const DType *query,                 // query points
     const Result *truth,                // ground truth
     const char *dfolder,                // data folder
@@ -261,11 +793,39 @@ int knn_of_qalsh(                   // k-NN search of qalsh
     FILE *fp = fopen(fname, "a+");
     if (!fp) { printf("Could not create %s\n", fname); return 1; }
 
-    // load QALSH
+    // the tuned parameters replace the given ones (except the deadlines), and
+    // the tuned budget is offset by top_k - 1 for each top_k
+    int nb_tuned = -1, budget = -1;
+    QueryParams tuned, kparams;
+    if (use_tune) {
+        char tname[200]; sprintf(tname, "%sqalsh.tune", ofolder);
+        if (read_tuned_params(tname, nb_tuned, tuned)) { fclose(fp); return 1; }
+        if (params != NULL) {
+            tuned.time_ = params->time_;
+            tuned.io_   = params->io_;
+            tuned.cand_ = params->cand_;
+        }
+        params = &tuned; budget = tuned.budget_;
+    }
+
+    // load QALSH, and switch to a new version once it is published
     gettimeofday(&g_start_time, NULL);
-    char path[200]; sprintf(path, "%sqalsh/", ofolder);
-    QALSH<DType> *lsh = new QALSH<DType>(path);
-    lsh->display();
+    typedef QALSH<DType> Index;
+    Index_Handle<Index> handle(ofolder, "qalsh", 
+        [&](const char *path) -> std::shared_ptr<Index> {
+            Pack *pack = NULL;
+            if (use_pack) {
+                pack = new Pack();
+                if (pack->load(path, use_mmap)) { delete pack; return NULL; }
+            }
+            Index *lsh = new Index(path, NULL, NULL, false, use_mmap, pack);
+            lsh->set_locator(use_loc);
+            lsh->set_tables(n_tables);
+            return std::shared_ptr<Index>(lsh, [pack](Index *lsh) { 
+                delete lsh; delete pack; });
+        });
+    handle.acquire()->display();
+    handle.watch(WATCH_INTERVAL);
 
     gettimeofday(&g_end_time, NULL);
     g_indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
@@ -274,16 +834,340 @@ int knn_of_qalsh(                   // k-NN search of qalsh
 
     // c-k-ANNS by QALSH
     printf("k-NN Search by QALSH: \n");
+    bool deadline = has_deadlines(params);
+    printf("Top-k\t\tRatio\t\tI/O\t\tTime (ms)\tRecall%s\n", 
+        deadline ? "\t\tGuarantee" : "");
+    for (int top_k : TOPKs) {
+        gettimeofday(&g_start_time, NULL);
+        MinK_List *list = new MinK_List(top_k);
+        g_ratio   = 0.0f;
+        g_recall  = 0.0f;
+        g_page_io = 0;
+        int n_guar = 0;
+
+        for (int i = 0; i < qn; ++i) {
+            // a query holds the version it started on until it is done
+            std::shared_ptr<Index> lsh = handle.acquire();
+            g_page_io += lsh->knn(top_k, &query[(uint64_t)i*d], dfolder, list,
+                tuned_budget(top_k, budget, params, kparams));
+            if (lsh->guarantee_) ++n_guar;
+            g_ratio   += calc_ratio(top_k,  &truth[(uint64_t)i*MAXK], list);
+            g_recall  += calc_recall(top_k, &truth[(uint64_t)i*MAXK], list);
+        }
+        delete list;
+        gettimeofday(&g_end_time, NULL);
+        g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
+            (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+
+        g_ratio   = g_ratio / qn;
+        g_recall  = g_recall / qn;
+        g_runtime = (g_runtime*1000.0f) / qn;
+        g_page_io = (uint64_t) ceil((double) g_page_io/qn);
+
+        printf("%d\t\t%.4f\t\t%llu\t\t%.2f\t\t%.2f", top_k, g_ratio, 
+            g_page_io, g_runtime, g_recall);
+        if (deadline) printf("\t\t%.2f", 100.0f * n_guar / qn);
+        printf("\n");
+        fprintf(fp, "%d\t%f\t%llu\t%f\t%f\n", top_k, g_ratio, g_page_io, 
+            g_runtime, g_recall);
+    }
+    printf("\n");
+    fprintf(fp, "\n");
+    
+    fclose(fp);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int knn_of_qalsh_iter(              // incremental k-NN search of qalsh
+    int   qn,                           // number of query points
+    int   d,                            // dimensionality
+    int   n_tables,                     // number of hash tables (-1: all)
+    const QueryParams *params,          // parameters of queries
+    const DType *query,                 // query points
+    const Result *truth,                // ground truth
+    const char *dfolder,                // data folder
+    const char *ofolder)                // output folder
+{
+    char fname[200]; sprintf(fname, "%sqalsh.out", ofolder);
+    FILE *fp = fopen(fname, "a+");
+    if (!fp) { printf("Could not create %s\n", fname); return 1; }
+
+    // the version is locked, so it is not removed during the search
+    char path[200]; int lock = -1;
+    get_version_path(ofolder, "qalsh", read_locked_version(ofolder, "qalsh", 
+        lock), path);
+    QALSH<DType> *lsh = new QALSH<DType>(path);
+    lsh->set_tables(n_tables);
+    lsh->display();
+
+    // -------------------------------------------------------------------------
+    //  each query is searched by one iterator, which returns the top-1, and 
+    //  then the next ones up to the top-2, top-5, ... thus, the ratio, recall,
+    //  I/O, and time of a top-k are the cumulative ones of its first k.
+    // -------------------------------------------------------------------------
+    int n_topks = (int) TOPKs.size();
+    float    *ratio   = new float[n_topks];
+    float    *recall  = new float[n_topks];
+    float    *runtime = new float[n_topks];
+    uint64_t *page_io = new uint64_t[n_topks];
+    memset(ratio,   0, sizeof(float)*n_topks);
+    memset(recall,  0, sizeof(float)*n_topks);
+    memset(runtime, 0, sizeof(float)*n_topks);
+    memset(page_io, 0, sizeof(uint64_t)*n_topks);
+
+    Result    *res  = new Result[MAXK];
+    MinK_List *list = new MinK_List(MAXK);
+    for (int i = 0; i < qn; ++i) {
+        const Result *t = &truth[(uint64_t)i*MAXK];
+
+        gettimeofday(&g_start_time, NULL);
+        QALSH_Iter<DType> iter(lsh, &query[(uint64_t)i*d], dfolder, params);
+        int num = 0;
+        for (int j = 0; j < n_topks; ++j) {
+            int top_k = TOPKs[j];
+            num += iter.next(top_k - num, &res[num]);
+
+            gettimeofday(&g_end_time, NULL);
+            runtime[j] += g_end_time.tv_sec - g_start_time.tv_sec + 
+                (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+            page_io[j] += iter.get_io();
+
+            list->reset();
+            for (int r = 0; r < num; ++r) list->insert(res[r].key_, res[r].id_);
+            ratio[j]  += calc_ratio(top_k, t, list);
+            recall[j] += calc_recall(top_k, t, list);
+        }
+    }
+    delete list;
+    delete[] res;
+
+    // print the results in the same format as knn_of_qalsh
+    printf("Incremental k-NN Search by QALSH: \n");
     printf("Top-k\t\tRatio\t\tI/O\t\tTime (ms)\tRecall\n");
+    for (int j = 0; j < n_topks; ++j) {
+        g_ratio   = ratio[j] / qn;
+        g_recall  = recall[j] / qn;
+        g_runtime = (runtime[j]*1000.0f) / qn;
+        g_page_io = (uint64_t) ceil((double) page_io[j]/qn);
+
+        printf("%d\t\t%.4f\t\t%llu\t\t%.2f\t\t%.2f\n", TOPKs[j], g_ratio, 
+            g_page_io, g_runtime, g_recall);
+        fprintf(fp, "%d\t%f\t%llu\t%f\t%f\n", TOPKs[j], g_ratio, g_page_io, 
+            g_runtime, g_recall);
+    }
+    printf("\n");
+    fprintf(fp, "\n");
+
+    delete[] ratio;
+    delete[] recall;
+    delete[] runtime;
+    delete[] page_io;
+    delete lsh;
+    unlock_version(lock);
+    fclose(fp);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int range_of_qalsh(                 // range search of qalsh
+    int   qn,                           // number of query points
+    int   d,                            // dimensionality
+    int   n_tables,                     // number of hash tables (-1: all)
+    const QueryParams *params,          // parameters of queries
+    const DType *query,                 // query points
+    const Result *truth,                // ground truth
+    const char *dfolder,                // data folder
+    const char *ofolder)                // output folder
+{
+    char fname[200]; sprintf(fname, "%sqalsh.out", ofolder);
+    FILE *fp = fopen(fname, "a+");
+    if (!fp) { printf("Could not create %s\n", fname); return 1; }
+
+    // the version is locked, so it is not removed during the search
+    char path[200]; int lock = -1;
+    get_version_path(ofolder, "qalsh", read_locked_version(ofolder, "qalsh", 
+        lock), path);
+    QALSH<DType> *lsh = new QALSH<DType>(path);
+    lsh->set_tables(n_tables);
+    lsh->display();
+
+    // -------------------------------------------------------------------------
+    //  the radius of a query for top-k is the distance of its exact k-th NN, 
+    //  so the range holds (at least) its top-k. the recall is the percentage 
+    //  of the points of the ground truth within the radius which are found.
+    // -------------------------------------------------------------------------
+    printf("Range Search by QALSH: \n");
+    printf("Top-k\t\tFound\t\tI/O\t\tTime (ms)\tRecall\n");
+    std::vector<Result> res;
+    for (int top_k : TOPKs) {
+        float found = 0.0f;
+        g_recall  = 0.0f;
+        g_page_io = 0;
+        g_runtime = 0.0f;
+
+        for (int i = 0; i < qn; ++i) {
+            const Result *t = &truth[(uint64_t)i*MAXK];
+            float R = std::max(t[top_k-1].key_, FLOATZERO); // R must be > 0
+
+            gettimeofday(&g_start_time, NULL);
+            res.clear();
+            g_page_io += lsh->range_search(R, &query[(uint64_t)i*d], dfolder, 
+                res, params);
+            gettimeofday(&g_end_time, NULL);
+            g_runtime += g_end_time.tv_sec - g_start_time.tv_sec + 
+                (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+
+            int n_true = top_k;
+            while (n_true < MAXK && t[n_true].key_ <= R) ++n_true;
+            found    += (float) res.size();
+            g_recall += std::min((int) res.size(), n_true) * 100.0f / n_true;
+        }
+        found     = found / qn;
+        g_recall  = g_recall / qn;
+        g_runtime = (g_runtime*1000.0f) / qn;
+        g_page_io = (uint64_t) ceil((double) g_page_io/qn);
+
+        printf("%d\t\t%.2f\t\t%llu\t\t%.2f\t\t%.2f\n", top_k, found, 
+            g_page_io, g_runtime, g_recall);
+        fprintf(fp, "%d\t%f\t%llu\t%f\t%f\n", top_k, found, g_page_io, 
+            g_runtime, g_recall);
+    }
+    printf("\n");
+    fprintf(fp, "\n");
+
+    delete lsh;
+    unlock_version(lock);
+    fclose(fp);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int insert_of_qalsh_lsm(            // insertion of segmented qalsh
+    int   n,                            // number of data points
+    int   d,                            // dimensionality
+    int   B,                            // page size
+    int   LB,                           // leaf node size of b+ trees
+    int   interval,                     // number of ids per key in leaves
+    int   seg_size,                     // number of points of a new segment
+    float p,                            // l_p distance, p \in (0,2]
+    float zeta,                         // symmetric factor of p-stable distr.
+    float c,                            // approximation ratio
+    const DType *data,                  // data points
+    const char *dfolder,                // data folder
+    const char *ofolder)                // output folder
+{
+    char fname[200]; sprintf(fname, "%sqalsh_lsm.out", ofolder);
+    FILE *fp = fopen(fname, "a+");
+    if (!fp) { printf("Could not create %s\n", fname); return 1; }
+
+    // load the index if it exists, or init an empty one tuned for n points
+    char path[200]; sprintf(path, "%sqalsh_lsm/", ofolder);
+    char para[200]; sprintf(para, "%spara", path);
+    FILE *fpara = fopen(para, "rb");
+    QALSH_LSM<DType> *lsh = NULL;
+    if (fpara) {
+        fclose(fpara);
+        lsh = new QALSH_LSM<DType>(path);
+    } else {
+        lsh = new QALSH_LSM<DType>(n, d, B, p, zeta, c, path, LB, interval);
+    }
+    int n0 = lsh->n_pts_;
+    if (n0 >= n) { 
+        printf("No new data points (%d >= %d)\n", n0, n); 
+        delete lsh; fclose(fp); return 1;
+    }
+
+    // insert the new data points as segments of seg_size points. the merge 
+    // of segments after an insertion runs in the background while the next
+    // segment is inserted.
+    float insert_time = 0.0f, merge_time = 0.0f;
+    int   num_merges  = 0;
+    for (int start = n0; start < n; start += seg_size) {
+        int cnt = MIN(seg_size, n - start);
+
+        gettimeofday(&g_start_time, NULL);
+        if (lsh->insert(cnt, &data[(uint64_t) start*d], dfolder)) exit(1);
+        gettimeofday(&g_end_time, NULL);
+        insert_time += g_end_time.tv_sec - g_start_time.tv_sec + 
+            (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+
+        int num = lsh->wait_merge();
+        if (num < 0 || lsh->start_merge(data)) exit(1);
+        num_merges += num;
+        gettimeofday(&g_start_time, NULL);
+        merge_time += g_start_time.tv_sec - g_end_time.tv_sec + 
+            (g_start_time.tv_usec - g_end_time.tv_usec) / 1000000.0f;
+    }
+    gettimeofday(&g_end_time, NULL);
+    int num = lsh->wait_merge();
+    if (num < 0) exit(1);
+    num_merges += num;
+    gettimeofday(&g_start_time, NULL);
+    merge_time += g_start_time.tv_sec - g_end_time.tv_sec + 
+        (g_start_time.tv_usec - g_end_time.tv_usec) / 1000000.0f;
+    lsh->display();
+    g_estimated_mem = lsh->get_memory_usage() / 1048576.0f;
+
+    printf("Insert %d Points = %f Seconds\n", n - n0, insert_time);
+    printf("Merge  %d Times  = %f Seconds\n", num_merges, merge_time);
+    printf("Estimated Mem = %f MB\n\n", g_estimated_mem);
+    fprintf(fp, "Insert %d Points = %f Seconds\n", n - n0, insert_time);
+    fprintf(fp, "Merge  %d Times  = %f Seconds\n", num_merges, merge_time);
+    fprintf(fp, "Estimated Mem = %f MB\n\n", g_estimated_mem);
+
+    delete lsh;
+    fclose(fp);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int knn_of_qalsh_lsm(               // k-NN search of segmented qalsh
+    int   qn,                           // number of query points
+    int   d,                            // dimensionality
+    int   use_mmap,                     // map b+ trees into memory
+    const QueryParams *params,          // parameters of queries
+    const DType *query,                 // query points
+    const Result *truth,                // ground truth
+    const char *dfolder,                // data folder
+    const char *ofolder)                // output folder
+{
+    char fname[200]; sprintf(fname, "%sqalsh_lsm.out", ofolder);
+    FILE *fp = fopen(fname, "a+");
+    if (!fp) { printf("Could not create %s\n", fname); return 1; }
+
+    // load QALSH_LSM
+    gettimeofday(&g_start_time, NULL);
+    char path[200]; sprintf(path, "%sqalsh_lsm/", ofolder);
+    QALSH_LSM<DType> *lsh = new QALSH_LSM<DType>(path, use_mmap);
+    lsh->display();
+
+    gettimeofday(&g_end_time, NULL);
+    g_indexing_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+        (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+    printf("Load QALSH_LSM Index = %f Seconds\n\n", g_indexing_time);
+
+    // c-k-ANNS by QALSH_LSM
+    printf("k-NN Search by QALSH_LSM: \n");
+    bool deadline = has_deadlines(params);
+    printf("Top-k\t\tRatio\t\tI/O\t\tTime (ms)\tRecall%s\n", 
+        deadline ? "\t\tGuarantee" : "");
     for (int top_k : TOPKs) {
         gettimeofday(&g_start_time, NULL);
         MinK_List *list = new MinK_List(top_k);
         g_ratio   = 0.0f;
         g_recall  = 0.0f;
         g_page_io = 0;
+        int n_guar = 0;
 
         for (int i = 0; i < qn; ++i) {
-            g_page_io += lsh->knn(top_k, &query[(uint64_t)i*d], dfolder, list);
+            g_page_io += lsh->knn(top_k, &query[(uint64_t)i*d], dfolder, list,
+                params);
+            if (lsh->guarantee_) ++n_guar;
             g_ratio   += calc_ratio(top_k,  &truth[(uint64_t)i*MAXK], list);
             g_recall  += calc_recall(top_k, &truth[(uint64_t)i*MAXK], list);
         }
@@ -297,8 +1181,10 @@ int knn_of_qalsh(                   // k-NN search of qalsh
         g_runtime = (g_runtime*1000.0f) / qn;
         g_page_io = (uint64_t) ceil((double) g_page_io/qn);
 
-        printf("%d\t\t%.4f\t\t%llu\t\t%.2f\t\t%.2f\n", top_k, g_ratio, 
+        printf("%d\t\t%.4f\t\t%llu\t\t%.2f\t\t%.2f", top_k, g_ratio, 
             g_page_io, g_runtime, g_recall);
+        if (deadline) printf("\t\t%.2f", 100.0f * n_guar / qn);
+        printf("\n");
         fprintf(fp, "%d\t%f\t%llu\t%f\t%f\n", top_k, g_ratio, g_page_io, 
             g_runtime, g_recall);
     }
@@ -310,4 +1196,183 @@ int knn_of_qalsh(                   // k-NN search of qalsh
     return 0;
 }
 
+// -----------------------------------------------------------------------------
+//  search the configurations of c, nb, and the budget of candidates for the
+//  cheapest one (by I/O) which meets the targets on the sample queries. for
+//  each c and nb, the budgets are tried in ascending order, since a larger 
+//  budget costs more I/O and time: the first one meeting the targets is the 
+//  cheapest one, and the search stops once the time is over the target.
+//  search(i, nb, params, list) runs the i-th query and returns its I/O.
+// -----------------------------------------------------------------------------
+template<class Search>
+int tune_search(                    // tune parameters of search
+    int   qn,                           // number of sample queries
+    int   top_k,                        // top-k value
+    int   max_nb,                       // max number of blocks (-1: none)
+    float t_recall,                     // target recall (-1: none)
+    float t_ratio,                      // target ratio  (-1: none)
+    float t_time,                       // target time (ms) (-1: none)
+    const Result *truth,                // ground truth
+    Search search,                      // search of one query
+    const char *fname,                  // file name of tuned parameters
+    FILE  *fp)                          // output file
+{
+    std::vector<int> nbs;
+    if (max_nb < 0) nbs.push_back(-1);
+    else {
+        for (int nb = 1; nb < max_nb; nb *= 2) nbs.push_back(nb);
+        nbs.push_back(max_nb);
+    }
+
+    bool found = false;
+    int  best_nb = -1;
+    QueryParams best, params;
+    uint64_t best_io = 0;
+    float    best_time = 0.0f;
+
+    printf("c\tnb\tBudget\tRatio\t\tI/O\t\tTime (ms)\tRecall\n");
+    fprintf(fp, "c\tnb\tBudget\tRatio\tI/O\tTime (ms)\tRecall\n");
+    MinK_List *list = new MinK_List(top_k);
+    for (float c : TUNE_Cs) {
+        for (int nb : nbs) {
+            for (int budget : TUNE_BUDGETs) {
+                params.c_      = c;
+                params.budget_ = budget + top_k - 1;
+
+                gettimeofday(&g_start_time, NULL);
+                g_ratio   = 0.0f;
+                g_recall  = 0.0f;
+                g_page_io = 0;
+                for (int i = 0; i < qn; ++i) {
+                    g_page_io += search(i, nb, &params, list);
+                    g_ratio   += calc_ratio(top_k, &truth[(uint64_t)i*MAXK], 
+                        list);
+                    g_recall  += calc_recall(top_k, &truth[(uint64_t)i*MAXK], 
+                        list);
+                }
+                gettimeofday(&g_end_time, NULL);
+                g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
+                    (g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+
+                g_ratio   = g_ratio / qn;
+                g_recall  = g_recall / qn;
+                g_runtime = (g_runtime*1000.0f) / qn;
+                g_page_io = (uint64_t) ceil((double) g_page_io/qn);
+
+                printf("%.1f\t%d\t%d\t%.4f\t\t%llu\t\t%.2f\t\t%.2f\n", c, nb, 
+                    params.budget_, g_ratio, g_page_io, g_runtime, g_recall);
+                fprintf(fp, "%f\t%d\t%d\t%f\t%llu\t%f\t%f\n", c, nb, 
+                    params.budget_, g_ratio, g_page_io, g_runtime, g_recall);
+
+                if (t_time > 0 && g_runtime > t_time) break;
+                if (t_recall > 0 && g_recall < t_recall) continue;
+                if (t_ratio  > 0 && g_ratio  > t_ratio)  continue;
+
+                if (!found || g_page_io < best_io || (g_page_io == best_io && 
+                    g_runtime < best_time)) {
+                    found = true; best = params; best_nb = nb;
+                    best_io = g_page_io; best_time = g_runtime;
+                }
+                break;
+            }
+        }
+    }
+    delete list;
+    printf("\n");
+    fprintf(fp, "\n");
+
+    if (!found) {
+        printf("No configuration meets the targets\n\n");
+        fprintf(fp, "No configuration meets the targets\n\n");
+        return 1;
+    }
+    printf("Tuned: c = %.1f, nb = %d, budget = %d, I/O = %llu, Time = %.2f "
+        "ms (%s)\n\n", best.c_, best_nb, best.budget_, best_io, best_time, 
+        fname);
+    fprintf(fp, "Tuned: c = %f, nb = %d, budget = %d, I/O = %llu, Time = %f "
+        "ms\n\n", best.c_, best_nb, best.budget_, best_io, best_time);
+    return write_tuned_params(fname, top_k, best_nb, best);
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int tune_of_qalsh(                  // tune parameters of search of qalsh
+    int   qn,                           // number of sample queries
+    int   d,                            // dimensionality
+    int   top_k,                        // top-k value
+    float t_recall,                     // target recall (-1: none)
+    float t_ratio,                      // target ratio  (-1: none)
+    float t_time,                       // target time (ms) (-1: none)
+    const DType *query,                 // query points
+    const Result *truth,                // ground truth
+    const char *dfolder,                // data folder
+    const char *ofolder)                // output folder
+{
+    char fname[200]; sprintf(fname, "%sqalsh.out", ofolder);
+    FILE *fp = fopen(fname, "a+");
+    if (!fp) { printf("Could not create %s\n", fname); return 1; }
+
+    // the version is locked, so it is not removed during the tuning
+    char path[200]; int lock = -1;
+    get_version_path(ofolder, "qalsh", read_locked_version(ofolder, "qalsh", 
+        lock), path);
+    QALSH<DType> *lsh = new QALSH<DType>(path);
+    lsh->display();
+
+    printf("Tune k-NN Search of QALSH (k = %d): \n", top_k);
+    fprintf(fp, "Tune k-NN Search of QALSH (k = %d): \n", top_k);
+    char tname[200]; sprintf(tname, "%sqalsh.tune", ofolder);
+    int ret = tune_search(qn, top_k, -1, t_recall, t_ratio, t_time, truth, 
+        [&](int i, int /*nb*/, const QueryParams *params, MinK_List *list) {
+            return lsh->knn(top_k, &query[(uint64_t)i*d], dfolder, list, 
+                params);
+        }, tname, fp);
+
+    delete lsh;
+    unlock_version(lock);
+    fclose(fp);
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int tune_of_qalsh_plus(             // tune parameters of search of qalsh+
+    int   qn,                           // number of sample queries
+    int   d,                            // dimensionality
+    int   top_k,                        // top-k value
+    float t_recall,                     // target recall (-1: none)
+    float t_ratio,                      // target ratio  (-1: none)
+    float t_time,                       // target time (ms) (-1: none)
+    const DType *query,                 // query points
+    const Result *truth,                // ground truth
+    const char *dfolder,                // data folder
+    const char *ofolder)                // output folder
+{
+    char fname[200]; sprintf(fname, "%sqalsh_plus.out", ofolder);
+    FILE *fp = fopen(fname, "a+");
+    if (!fp) { printf("Could not create %s\n", fname); return 1; }
+
+    // the version is locked, so it is not removed during the tuning
+    char path[200]; int lock = -1;
+    get_version_path(ofolder, "qalsh_plus", read_locked_version(ofolder, 
+        "qalsh_plus", lock), path);
+    QALSH_PLUS<DType> *lsh = new QALSH_PLUS<DType>(path);
+    lsh->display();
+
+    printf("Tune k-NN Search of QALSH+ (k = %d): \n", top_k);
+    fprintf(fp, "Tune k-NN Search of QALSH+ (k = %d): \n", top_k);
+    char tname[200]; sprintf(tname, "%sqalsh_plus.tune", ofolder);
+    int ret = tune_search(qn, top_k, lsh->get_num_blocks(), t_recall, t_ratio,
+        t_time, truth, 
+        [&](int i, int nb, const QueryParams *params, MinK_List *list) {
+            return lsh->knn(top_k, nb, &query[(uint64_t)i*d], dfolder, list, 
+                params);
+        }, tname, fp);
+
+    delete lsh;
+    unlock_version(lock);
+    fclose(fp);
+    return ret;
+}
+
 } // end namespace nns
@@ -208,11 +208,7 @@ void BIndexNode::write_to_buffer(   // write info of node into buffer
 int BIndexNode::find_position_by_key(// find position by key
     float key)                          // input key
 {
-    int pos = -1;
-    for (int i = num_entries_-1; i >= 0; --i) {
-        if (key_[i] <= key) { pos = i; break; }
-    }
-    return pos;
+    return find_last_leq(num_entries_, (const float*) key_, key);
 }
 
 // -----------------------------------------------------------------------------
@@ -254,6 +250,59 @@ void BIndexNode::add_new_child(     // add a new entry from its child node
     dirty_ = true;                  // node modified, so dirty_ is true
 }
 
+// -----------------------------------------------------------------------------
+BIndexNode* BIndexNode::insert_child(// insert new child after a position
+    int   pos,                          // position of its left neighbor
+    float key,                          // input key
+    int   son)                          // input son
+{
+    assert(pos >= -1 && pos < num_entries_);
+    if (!isFull()) {
+        for (int i = num_entries_; i > pos + 1; --i) {
+            key_[i] = key_[i-1]; son_[i] = son_[i-1];
+        }
+        key_[pos+1] = key; son_[pos+1] = son;
+        ++num_entries_;
+        dirty_ = true;
+        return NULL;
+    }
+
+    // -------------------------------------------------------------------------
+    //  split: the left half stays in this node, and the right half is moved 
+    //  to a new right sibling
+    // -------------------------------------------------------------------------
+    int   n     = num_entries_ + 1;
+    float *keys = new float[n];
+    int   *sons = new int[n];
+    for (int i = 0, j = 0; i < n; ++i) {
+        if (i == pos + 1) { keys[i] = key; sons[i] = son; }
+        else { keys[i] = key_[j]; sons[i] = son_[j]; ++j; }
+    }
+    BIndexNode *right = new BIndexNode();
+    right->init(level_, btree_);
+
+    int half = n / 2;
+    for (int i = half; i < n; ++i) right->add_new_child(keys[i], sons[i]);
+    num_entries_ = 0;
+    for (int i = 0; i < half; ++i) add_new_child(keys[i], sons[i]);
+    delete[] keys;
+    delete[] sons;
+
+    // -------------------------------------------------------------------------
+    //  link the new right sibling
+    // -------------------------------------------------------------------------
+    if (right_sibling_ != -1) {
+        BIndexNode *next = get_right_sibling();
+        next->set_left_sibling(right->get_block());
+        delete next;
+    }
+    right->set_left_sibling(block_);
+    right->set_right_sibling(right_sibling_);
+    set_right_sibling(right->get_block());
+
+    return right;
+}
+
 
 // -----------------------------------------------------------------------------
 //  BLeafNode: structure of leaf node in b-tree
@@ -270,24 +319,29 @@ BLeafNode::BLeafNode()              // constructor
     btree_         = NULL;
     num_keys_      = -1;
     capacity_keys_ = -1;
+    id_bits_       = 32;
+    interval_      = BTREE_INTERVAL;
+    grouped_       = false;
     key_           = NULL;
     id_            = NULL;
+    start_         = NULL;
 }
 
 // -----------------------------------------------------------------------------
 BLeafNode::~BLeafNode()             // destructor
 {
     if (dirty_) {                   // if dirty, rewrite to disk
-        int block_length = btree_->file_->get_blocklength();
+        int leaf_length = btree_->get_leaf_length();
         
-        char *buf = new char[block_length];
+        char *buf = new char[leaf_length];
         write_to_buffer(buf);
-        btree_->file_->write_block(buf, block_);
+        btree_->file_->write_block(buf, block_, btree_->leaf_blocks_);
         delete[] buf;
     }
     
-    if (key_ != NULL) { delete[] key_; key_ = NULL; }
-    if (id_  != NULL) { delete[] id_;  id_  = NULL; }
+    if (key_   != NULL) { delete[] key_;   key_   = NULL; }
+    if (id_    != NULL) { delete[] id_;    id_    = NULL; }
+    if (start_ != NULL) { delete[] start_; start_ = NULL; }
 }
 
 // -----------------------------------------------------------------------------
@@ -302,28 +356,15 @@ void BLeafNode::init(               // init a new node, which not exist
     left_sibling_  = -1;
     right_sibling_ = -1;
     dirty_         = true;
+    id_bits_       = btree_->version_ > 0 ? btree_->id_bits_ : 32;
+    interval_      = btree_->interval_;
+    grouped_       = false;
 
-    // -------------------------------------------------------------------------
-    //  init capacity_keys_ and calc key size
-    // -------------------------------------------------------------------------
-    int b_length = btree_->file_->get_blocklength();
-    int key_size = get_key_size(b_length);
+    int leaf_length = btree_->get_leaf_length();
+    init_capacity(leaf_length);
 
-    key_ = new float[capacity_keys_];
-    memset(key_, MINREAL, capacity_keys_*sizeof(float));
-    
-    int header_size = get_header_size();
-    int entry_size = get_entry_size();
-
-    capacity_ = (b_length - header_size - key_size) / entry_size;
-    if (capacity_ < 100) { // at least 100 entries
-        printf("capacity (%d < 100) is too small.\n", capacity_);
-        exit(1);
-    }
-    id_ = new int[capacity_]; memset(id_, -1, capacity_*sizeof(int));
-
-    char *blk = new char[b_length];
-    block_ = btree_->file_->append_block(blk);
+    char *blk = new char[leaf_length];
+    block_ = btree_->file_->append_block(blk, btree_->leaf_blocks_);
     delete[] blk;
 }
 
@@ -337,32 +378,52 @@ void BLeafNode::init_restore(       // load an exist node from disk to init
     dirty_ = false;
 
     // -------------------------------------------------------------------------
-    //  init capacity_keys_ and calc key size
+    //  read the buffer `blk` first, as the capacity depends on id_bits_
     // -------------------------------------------------------------------------
-    int b_length = btree_->file_->get_blocklength();
-    int key_size = get_key_size(b_length);
+    int leaf_length = btree_->get_leaf_length();
+    char *blk = new char[leaf_length];
+    btree_->file_->read_block(blk, block, btree_->leaf_blocks_);
+
+    id_bits_  = 32;
+    interval_ = btree_->interval_;
+    grouped_  = false;
+    if (btree_->version_ > 0) {
+        int flag = (unsigned char) blk[get_header_size()];
+        id_bits_ = flag & BTREE_BITS_MASK;
+        grouped_ = btree_->version_ >= 4 && (flag & BTREE_GROUPED);
+    }
+    init_capacity(leaf_length);
+
+    // -------------------------------------------------------------------------
+    //  init level_, num_entries_, left_sibling_, right_sibling_, num_keys_, 
+    //  key_, and id_ from the buffer `blk`
+    // -------------------------------------------------------------------------
+    read_from_buffer(blk);
+    delete[] blk;
+}
+
+// -----------------------------------------------------------------------------
+int BLeafNode::get_leaf_header_size()// get header size of leaf node
+{
+    return get_leaf_header_size(btree_->version_);
+}
+
+// -----------------------------------------------------------------------------
+void BLeafNode::init_capacity(      // init capacity_keys_, capacity_, key_, id_
+    int b_length)                       // leaf node size in bytes
+{
+    capacity_ = calc_capacity(b_length, id_bits_, interval_, btree_->version_,
+        capacity_keys_, grouped_);
 
     key_ = new float[capacity_keys_];
     memset(key_, MINREAL, capacity_keys_*sizeof(float));
+    if (grouped_) start_ = new int[capacity_keys_];
     
-    int header_size = get_header_size();
-    int entry_size = get_entry_size();
-
-    capacity_ = (b_length - header_size - key_size) / entry_size;
     if (capacity_ < 100) { // at least 100 entries
         printf("capacity (%d < 100) is too small.\n", capacity_);
         exit(1);
     }
     id_ = new int[capacity_]; memset(id_, -1, capacity_*sizeof(int));
-
-    // -------------------------------------------------------------------------
-    //  read the buffer `blk` to init level_, num_entries_, left_sibling_,
-    //  right_sibling_, num_keys_, key_, and id_
-    // -------------------------------------------------------------------------
-    char *blk = new char[b_length];
-    btree_->file_->read_block(blk, block);
-    read_from_buffer(blk);
-    delete[] blk;
 }
 
 // -----------------------------------------------------------------------------
@@ -377,16 +438,36 @@ void BLeafNode::read_from_buffer(   // read a b-node from buffer
     memcpy(&num_entries_,   &buf[i], sizeof(int));  i += sizeof(int);
     memcpy(&left_sibling_,  &buf[i], sizeof(int));  i += sizeof(int);
     memcpy(&right_sibling_, &buf[i], sizeof(int));  i += sizeof(int);
+    if (btree_->version_ > 0) i += sizeof(char); // id_bits_
 
     // -------------------------------------------------------------------------
     //  read keys: num_keys_ and key_ and entries: id_
     // -------------------------------------------------------------------------
     memcpy(&num_keys_, &buf[i], sizeof(int)); i += sizeof(int);
-    for (int j = 0; j < capacity_keys_; ++j) {
-        memcpy(&key_[j], &buf[i], sizeof(float)); i += sizeof(float);
+    memcpy(key_, &buf[i], capacity_keys_*sizeof(float));
+    i += capacity_keys_*sizeof(float);
+    if (grouped_) {
+        memcpy(start_, &buf[i], capacity_keys_*sizeof(int));
+        i += capacity_keys_*sizeof(int);
     }
-    for (int j = 0; j < num_entries_; ++j) {
-        memcpy(&id_[j], &buf[i], sizeof(int)); i += sizeof(int);
+
+    if (btree_->version_ > 0) {
+        // ---------------------------------------------------------------------
+        //  the j-th id is stored at bits [j*id_bits_, (j+1)*id_bits_). each id
+        //  is decoded by one unaligned 8-byte load, a shift, and a mask, 
+        //  without any branch.
+        // ---------------------------------------------------------------------
+        const char *ids  = &buf[i];
+        const uint64_t mask = (1ULL << id_bits_) - 1;
+        for (int j = 0; j < num_entries_; ++j) {
+            uint64_t bit = (uint64_t) j * id_bits_;
+            uint64_t word;
+            memcpy(&word, &ids[bit >> 3], sizeof(uint64_t));
+            id_[j] = (int) ((word >> (bit & 7)) & mask);
+        }
+    }
+    else {
+        memcpy(id_, &buf[i], num_entries_*sizeof(int));
     }
 }
 
@@ -402,16 +483,36 @@ void BLeafNode::write_to_buffer(    // write a b-node into buffer
     memcpy(&buf[i], &num_entries_,   sizeof(int));  i += sizeof(int);
     memcpy(&buf[i], &left_sibling_,  sizeof(int));  i += sizeof(int);
     memcpy(&buf[i], &right_sibling_, sizeof(int));  i += sizeof(int);
+    if (btree_->version_ > 0) {
+        buf[i] = (char) (id_bits_ | (grouped_ ? BTREE_GROUPED : 0)); 
+        i += sizeof(char);
+    }
 
     // -------------------------------------------------------------------------
     //  write keys: num_keys_ and key_ and entries: id_
     // -------------------------------------------------------------------------
     memcpy(&buf[i], &num_keys_, sizeof(int)); i += sizeof(int);
-    for (int j = 0; j < capacity_keys_; ++j) {
-        memcpy(&buf[i], &key_[j], sizeof(float)); i += sizeof(float);
+    memcpy(&buf[i], key_, capacity_keys_*sizeof(float));
+    i += capacity_keys_*sizeof(float);
+    if (grouped_) {
+        memcpy(&buf[i], start_, capacity_keys_*sizeof(int));
+        i += capacity_keys_*sizeof(int);
     }
-    for (int j = 0; j < num_entries_; ++j) {
-        memcpy(&buf[i], &id_[j], sizeof(int)); i += sizeof(int);
+
+    if (btree_->version_ > 0) {
+        char *ids = &buf[i];
+        int bytes = (int) (((int64_t) num_entries_*id_bits_ + 7) / 8);
+        memset(ids, 0, bytes + sizeof(uint64_t));
+        for (int j = 0; j < num_entries_; ++j) {
+            uint64_t bit = (uint64_t) j * id_bits_;
+            uint64_t word;
+            memcpy(&word, &ids[bit >> 3], sizeof(uint64_t));
+            word |= ((uint64_t) (uint32_t) id_[j]) << (bit & 7);
+            memcpy(&ids[bit >> 3], &word, sizeof(uint64_t));
+        }
+    }
+    else {
+        memcpy(&buf[i], id_, num_entries_*sizeof(int));
     }
 }
 
@@ -419,12 +520,8 @@ void BLeafNode::write_to_buffer(    // write a b-node into buffer
 int BLeafNode::find_position_by_key(// find pos just less than input key
     float key)                      // input key
 {
-    int pos = -1;                            
-    for (int i = num_keys_ - 1; i >= 0; --i) {
-        // position of corresponding id
-        if (key_[i] <= key) { pos = i; break; }
-    }
-    return pos;
+    // position of corresponding id
+    return find_last_leq(num_keys_, (const float*) key_, key);
 }
 
 // -----------------------------------------------------------------------------
@@ -455,11 +552,12 @@ void BLeafNode::add_new_child(      // add new child by input id and key
     float key)                          // input key
 {
     assert(num_entries_ >= 0 && num_entries_ < capacity_);
+    assert(id >= 0 && (id_bits_ >= 31 || id < (1 << id_bits_)));
     // add new id into its pos
     id_[num_entries_] = id;
 
     // add new key into its pos and update num_keys_ if satisfied
-    if ((num_entries_ * sizeof(int)) % BTREE_LEAF_SIZE == 0) {
+    if (num_entries_ % get_increment() == 0) {
         assert(num_keys_ < capacity_keys_);
         key_[num_keys_] = key;
         ++num_keys_; 
@@ -468,4 +566,107 @@ void BLeafNode::add_new_child(      // add new child by input id and key
     dirty_ = true;                  // node modified, so dirty_ is true
 }
 
+// -----------------------------------------------------------------------------
+//  the keys of a leaf are only sampled, so the exact position of the new id 
+//  in its group is unknown. it is appended to the group of the last key <= 
+//  input key, and the leaf becomes grouped: the start position of each group
+//  is stored, so that every key is still the key of the first id of its group
+//  (a lower bound of all its ids), and the keys need not be resampled.
+// -----------------------------------------------------------------------------
+BLeafNode* BLeafNode::insert(       // insert new entry by input id and key
+    int   id,                           // input object id
+    float key)                          // input key
+{
+    assert(btree_->version_ >= 4 && num_keys_ > 0);
+    std::vector<int>   ids(id_, id_ + num_entries_);
+    std::vector<float> keys(key_, key_ + num_keys_);
+    std::vector<int>   starts(num_keys_ + 1);
+    for (int i = 0; i <= num_keys_; ++i) starts[i] = get_start(i);
+
+    int pos = find_position_by_key(key);
+    if (pos < 0) { pos = 0; keys[0] = key; } // new smallest key of leaf
+    ids.insert(ids.begin() + starts[pos+1], id);
+    for (int i = pos + 1; i <= num_keys_; ++i) ++starts[i];
+
+    // the ids of new points may need more bits than the packed ones
+    int id_bits = id_bits_;
+    while (id_bits < 32 && ((int64_t) 1 << id_bits) <= id) ++id_bits;
+
+    int leaf_length = btree_->get_leaf_length();
+    int cap_keys = 0;
+    int cap = calc_capacity(leaf_length, id_bits, interval_, btree_->version_,
+        cap_keys, true);
+    int n = (int) ids.size();
+    if (n <= cap && num_keys_ <= cap_keys) {
+        assign(id_bits, n, ids.data(), num_keys_, keys.data(), starts.data());
+        return NULL;
+    }
+
+    // -------------------------------------------------------------------------
+    //  split: a group larger than half of a node is divided into two groups 
+    //  with the same key, which is still a lower bound of both of them. then
+    //  the group boundary closest to the middle is chosen.
+    // -------------------------------------------------------------------------
+    for (int i = 0; i < (int) keys.size(); ++i) {
+        if (starts[i+1] - starts[i] > cap / 2) {
+            keys.insert(keys.begin() + i + 1, keys[i]);
+            starts.insert(starts.begin() + i + 1, (starts[i]+starts[i+1])/2);
+        }
+    }
+    int k = (int) keys.size();
+    int s = 1;
+    for (int i = 2; i < k; ++i) {
+        if (abs(2*starts[i] - n) < abs(2*starts[s] - n)) s = i;
+    }
+    assert(n - starts[s] <= cap && starts[s] <= cap);
+    assert(k - s <= cap_keys && s <= cap_keys);
+
+    BLeafNode *right = new BLeafNode();
+    right->init(0, btree_);
+    right->assign(id_bits, n - starts[s], &ids[starts[s]], k - s, &keys[s], 
+        &starts[s]);
+    assign(id_bits, starts[s], ids.data(), s, keys.data(), starts.data());
+
+    // -------------------------------------------------------------------------
+    //  link the new right sibling
+    // -------------------------------------------------------------------------
+    if (right_sibling_ != -1) {
+        BLeafNode *next = get_right_sibling();
+        next->set_left_sibling(right->get_block());
+        delete next;
+    }
+    right->set_left_sibling(block_);
+    right->set_right_sibling(right_sibling_);
+    set_right_sibling(right->get_block());
+
+    return right;
+}
+
+// -----------------------------------------------------------------------------
+void BLeafNode::assign(             // reset this node as a grouped leaf
+    int   id_bits,                      // number of bits of an id
+    int   n,                            // number of ids
+    const int *ids,                     // ids
+    int   k,                            // number of keys
+    const float *keys,                  // keys
+    const int *starts)                  // start positions of groups
+{
+    if (key_   != NULL) { delete[] key_;   key_   = NULL; }
+    if (id_    != NULL) { delete[] id_;    id_    = NULL; }
+    if (start_ != NULL) { delete[] start_; start_ = NULL; }
+
+    id_bits_ = id_bits;
+    grouped_ = true;
+    init_capacity(btree_->get_leaf_length());
+    assert(n <= capacity_ && k <= capacity_keys_);
+
+    memcpy(id_,  ids,  n*sizeof(int));
+    memcpy(key_, keys, k*sizeof(float));
+    for (int i = 0; i < k; ++i) start_[i] = starts[i] - starts[0];
+
+    num_entries_ = n;
+    num_keys_    = k;
+    dirty_       = true;
+}
+
 } // end namespace nns
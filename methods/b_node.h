@@ -14,6 +14,39 @@ namespace nns {
 
 class BTree;
 
+// -----------------------------------------------------------------------------
+//  find the last position i with key_at(i) <= q in non-decreasing keys (return
+//  -1 if no such key). a branchless binary search (conditional moves) narrows
+//  the range to a small window, and the keys in the window are counted by 
+//  compare-and-add, which can be vectorized by the compiler.
+// -----------------------------------------------------------------------------
+template<class KeyAt>
+inline int find_last_leq(           // find last pos with key <= q
+    int   n,                            // number of keys
+    KeyAt key_at,                       // key_at(i): the i-th key
+    float q)                            // query key
+{
+    int base = 0, len = n;
+    while (len > 16) {
+        int half = len / 2;
+        base = (key_at(base + half) <= q) ? base + half : base;
+        len -= half;
+    }
+    int cnt = 0;
+    for (int i = 0; i < len; ++i) cnt += (key_at(base + i) <= q);
+
+    return base + cnt - 1;
+}
+
+// -----------------------------------------------------------------------------
+inline int find_last_leq(           // find last pos with key <= q
+    int   n,                            // number of keys
+    const float *key,                   // sorted keys
+    float q)                            // query key
+{
+    return find_last_leq(n, [key](int i) { return key[i]; }, q);
+}
+
 // -----------------------------------------------------------------------------
 //  BNode: basic structure of node in b-tree
 // -----------------------------------------------------------------------------
@@ -79,12 +112,12 @@ public:
 
     // -------------------------------------------------------------------------
     inline void set_left_sibling(int left_sibling) { 
-        left_sibling_ = left_sibling;
+        left_sibling_ = left_sibling; dirty_ = true;
     }
 
     // -------------------------------------------------------------------------
     inline void set_right_sibling(int right_sibling) { 
-        right_sibling_ = right_sibling;
+        right_sibling_ = right_sibling; dirty_ = true;
     }
 
 protected:
@@ -139,6 +172,12 @@ public:
         return key_[index]; 
     }
 
+    // -------------------------------------------------------------------------
+    inline void set_key(int index, float key) { // set key by index
+        assert(index >= 0 && index < num_entries_);
+        key_[index] = key; dirty_ = true;
+    }
+
     // -------------------------------------------------------------------------
     virtual BIndexNode* get_left_sibling();  // get left sibling node
 
@@ -155,6 +194,15 @@ public:
         float key,                      // input key
         int son);                       // input son
 
+    // -------------------------------------------------------------------------
+    //  insert a new child after position pos. if this node is full, it is 
+    //  split, and the new right sibling is returned (NULL: no split).
+    // -------------------------------------------------------------------------
+    BIndexNode* insert_child(       // insert new child after a position
+        int   pos,                      // position of its left neighbor
+        float key,                      // input key
+        int   son);                     // input son
+
 protected:
     int *son_;                      // address of son node
 };
@@ -184,6 +232,9 @@ public:
     virtual void write_to_buffer(   // write a b-node into buffer
         char *buf);                     // store info of a b-node (return)
 
+    // -------------------------------------------------------------------------
+    //  entry: id_: sizeof(int) in legacy format (version 0), or id_bits_ bits 
+    //  in packed format (version >= 1)
     // -------------------------------------------------------------------------
     virtual inline int get_entry_size() { return sizeof(int); }
 
@@ -203,15 +254,70 @@ public:
     virtual BLeafNode* get_right_sibling(); // get right sibling node
 
     // -------------------------------------------------------------------------
-    //  array of key_ with number capacity_keys_ + number_keys_
+    //  packed format (version >= 1) stores id_bits_ after the header
+    // -------------------------------------------------------------------------
+    static inline int get_leaf_header_size(int version) {
+        return sizeof(char) + sizeof(int)*3 + (version > 0 ? sizeof(char) : 0);
+    }
+
+    // -------------------------------------------------------------------------
+    //  capacity of a leaf node of b_length bytes: return the max number of 
+    //  ids, and the max number of keys (num_keys + array of keys) in keys. 
+    //  before version 3, the keys are reserved as if the whole node were ids
+    //  and interval is BTREE_INTERVAL. since version 3, the keys and (packed)
+    //  ids share the node exactly, so a small interval does not waste space.
+    // -------------------------------------------------------------------------
+    //  a grouped leaf (version >= 4) also stores the start position of the 
+    //  group of ids of each key, so groups may grow by insertion.
+    // -------------------------------------------------------------------------
+    static inline int calc_capacity(
+        int   b_length,                 // leaf node size in bytes
+        int   id_bits,                  // number of bits of an id
+        int   interval,                 // one key for every interval ids
+        int   version,                  // format version of b-tree
+        int   &keys,                    // max number of keys (return)
+        bool  grouped = false) {        // store start positions of groups
+        int header_size = get_leaf_header_size(version);
+        if (version < 3) {
+            keys = (int) ceil((float) b_length * 8 / (id_bits * interval));
+            int key_size = keys * sizeof(float) + sizeof(int);
+            if (version == 0) {
+                return (b_length - header_size - key_size) / sizeof(int);
+            }
+            int bytes = b_length - header_size - key_size - sizeof(uint64_t);
+            return (int) ((int64_t) bytes * 8 / id_bits);
+        }
+        // packed ids are decoded by 8-byte loads, so keep 8 bytes of slack
+        int64_t bits = (int64_t) (b_length - header_size - sizeof(int) - 
+            sizeof(uint64_t)) * 8;
+        int key_bits = grouped ? 64 : 32; // key (and start) of a group
+        int64_t cap = bits*interval / ((int64_t) id_bits*interval + key_bits);
+        while (cap > 0 && cap * id_bits + 
+            (cap + interval - 1) / interval * key_bits > bits) --cap;
+        keys = (int) ((cap + interval - 1) / interval);
+        return (int) cap;
+    }
+
+    // -------------------------------------------------------------------------
+    //  one key for every <increment> ids, which does not depend on id_bits_
+    // -------------------------------------------------------------------------
+    inline int get_increment() { return interval_; }
+
+    // -------------------------------------------------------------------------
+    //  start position of the group of ids of the pos-th key (pos in [0, 
+    //  num_keys_]). the groups of a leaf built by bulkloading have interval_
+    //  ids, except the last one.
     // -------------------------------------------------------------------------
-    inline int get_key_size(int block_length) { // block length
-        capacity_keys_ = (int) ceil((float) block_length / BTREE_LEAF_SIZE);
-        return capacity_keys_ * sizeof(float) + sizeof(int);
+    inline int get_start(int pos) {
+        if (pos == num_keys_) return num_entries_;
+        return grouped_ ? start_[pos] : pos * interval_;
     }
 
     // -------------------------------------------------------------------------
-    inline int get_increment() { return BTREE_LEAF_SIZE / get_entry_size(); }
+    int get_leaf_header_size();
+
+    // -------------------------------------------------------------------------
+    inline int get_id_bits() { return id_bits_; }
 
     // -------------------------------------------------------------------------
     inline int get_num_keys() { return num_keys_; }
@@ -227,11 +333,192 @@ public:
         int id,                         // input object id
         float key);                     // input key
 
+    // -------------------------------------------------------------------------
+    //  insert a new id into the group of the last key <= input key. if this 
+    //  node is full, it is split at a group boundary, and the new right 
+    //  sibling is returned (NULL: no split).
+    // -------------------------------------------------------------------------
+    BLeafNode* insert(              // insert new entry by input id and key
+        int   id,                       // input object id
+        float key);                     // input key
+
 protected:
     int num_keys_;                  // number of keys
     int *id_;                       // object id
+    int *start_;                    // start position of groups (grouped_)
 
     int capacity_keys_;             // max num of keys can be stored
+    int id_bits_;                   // number of bits of an id on disk
+    int interval_;                  // one key for every interval_ ids
+    bool grouped_;                  // store start positions of groups
+
+    // -------------------------------------------------------------------------
+    void init_capacity(             // init capacity_keys_, capacity_, key_, id_
+        int b_length);                  // leaf node size in bytes
+
+    // -------------------------------------------------------------------------
+    void assign(                    // reset this node as a grouped leaf
+        int   id_bits,                  // number of bits of an id
+        int   n,                        // number of ids
+        const int *ids,                 // ids
+        int   k,                        // number of keys
+        const float *keys,              // keys
+        const int *starts);             // start positions of groups
+};
+
+// -----------------------------------------------------------------------------
+//  BIndexView: non-virtual, read-only view of an index node. it reads the 
+//  fields in place from a block buffer, without copy or heap allocation. the 
+//  buffer must stay valid while the view is used.
+// -----------------------------------------------------------------------------
+class BIndexView {
+public:
+    // -------------------------------------------------------------------------
+    inline void set(const char *buf) { // set the block buffer of this node
+        buf_ = buf;
+        memcpy(&level_,       buf,                sizeof(char));
+        memcpy(&num_entries_, &buf[sizeof(char)], sizeof(int));
+    }
+
+    // -------------------------------------------------------------------------
+    inline int get_level() const { return level_; }
+
+    // -------------------------------------------------------------------------
+    inline int get_num_entries() const { return num_entries_; }
+
+    // -------------------------------------------------------------------------
+    //  entry: key_: sizeof(float) and son_: sizeof(int) after the header
+    // -------------------------------------------------------------------------
+    inline float get_key(int index) const {
+        float key;
+        memcpy(&key, &buf_[HEADER_SIZE + index*ENTRY_SIZE], sizeof(float));
+        return key;
+    }
+
+    // -------------------------------------------------------------------------
+    inline int get_son(int index) const {
+        int son;
+        memcpy(&son, &buf_[HEADER_SIZE + index*ENTRY_SIZE + sizeof(float)], 
+            sizeof(int));
+        return son;
+    }
+
+    // -------------------------------------------------------------------------
+    inline int find_position_by_key(float key) const { // pos just <= key
+        return find_last_leq(num_entries_, 
+            [this](int i) { return get_key(i); }, key);
+    }
+
+protected:
+    static const int HEADER_SIZE = sizeof(char) + sizeof(int)*3;
+    static const int ENTRY_SIZE  = sizeof(float) + sizeof(int);
+
+    const char *buf_;               // block buffer of this node
+    char  level_;                   // level of b-tree
+    int   num_entries_;             // number of entries in this node
+};
+
+// -----------------------------------------------------------------------------
+//  BLeafView: non-virtual, read-only view of a leaf node. it reads keys and 
+//  (packed) ids in place from a block buffer, without copy or heap allocation.
+//  the buffer must stay valid while the view is used.
+// -----------------------------------------------------------------------------
+class BLeafView {
+public:
+    // -------------------------------------------------------------------------
+    inline void set(                // set the block buffer of this node
+        const char *buf,                // block buffer
+        int   version,                  // format version of b-tree
+        int   interval,                 // one key for every interval ids
+        const int leaf_keys[][BTREE_MAX_BITS+1]) { // max keys of leaf nodes
+        int i = 0;
+        buf_ = buf;
+        memcpy(&num_entries_,   &buf[i+sizeof(char)],  sizeof(int));
+        i += sizeof(char) + sizeof(int);
+        memcpy(&left_sibling_,  &buf[i], sizeof(int)); i += sizeof(int);
+        memcpy(&right_sibling_, &buf[i], sizeof(int)); i += sizeof(int);
+
+        packed_  = version > 0;
+        grouped_ = false;
+        id_bits_ = 32;
+        if (packed_) {
+            int flag = (unsigned char) buf[i]; i += sizeof(char);
+            id_bits_ = flag & BTREE_BITS_MASK;
+            grouped_ = version >= 4 && (flag & BTREE_GROUPED);
+        }
+        mask_    = (1ULL << id_bits_) - 1;
+
+        int capacity_keys = leaf_keys[grouped_][id_bits_];
+        interval_ = interval;
+
+        memcpy(&num_keys_, &buf[i], sizeof(int)); i += sizeof(int);
+        keys_   = &buf[i];
+        starts_ = &buf[i + capacity_keys*sizeof(float)];
+        ids_    = &buf[i + capacity_keys*sizeof(float)*(grouped_ ? 2 : 1)];
+    }
+
+    // -------------------------------------------------------------------------
+    inline int get_num_entries() const { return num_entries_; }
+
+    // -------------------------------------------------------------------------
+    inline int get_num_keys() const { return num_keys_; }
+
+    // -------------------------------------------------------------------------
+    inline int get_left_sibling() const { return left_sibling_; }
+
+    // -------------------------------------------------------------------------
+    inline int get_right_sibling() const { return right_sibling_; }
+
+    // -------------------------------------------------------------------------
+    inline int get_increment() const { return interval_; }
+
+    // -------------------------------------------------------------------------
+    inline int get_start(int pos) const { // start position of pos-th group
+        if (pos == num_keys_) return num_entries_;
+        if (!grouped_) return pos * interval_;
+        int start; memcpy(&start, &starts_[pos*sizeof(int)], sizeof(int));
+        return start;
+    }
+
+    // -------------------------------------------------------------------------
+    inline float get_key(int index) const {
+        float key;
+        memcpy(&key, &keys_[index*sizeof(float)], sizeof(float));
+        return key;
+    }
+
+    // -------------------------------------------------------------------------
+    inline int get_entry_id(int index) const {
+        if (!packed_) {
+            int id; memcpy(&id, &ids_[index*sizeof(int)], sizeof(int));
+            return id;
+        }
+        uint64_t bit = (uint64_t) index * id_bits_;
+        uint64_t word;
+        memcpy(&word, &ids_[bit >> 3], sizeof(uint64_t));
+        return (int) ((word >> (bit & 7)) & mask_);
+    }
+
+    // -------------------------------------------------------------------------
+    inline int find_position_by_key(float key) const { // pos just <= key
+        return find_last_leq(num_keys_, 
+            [this](int i) { return get_key(i); }, key);
+    }
+
+protected:
+    const char *buf_;               // block buffer of this node
+    const char *keys_;              // keys in buf_
+    const char *starts_;            // start positions of groups in buf_
+    const char *ids_;               // (packed) ids in buf_
+    int   num_entries_;             // number of entries in this node
+    int   num_keys_;                // number of keys
+    int   left_sibling_;            // address in disk for left  sibling
+    int   right_sibling_;           // address in disk for right sibling
+    bool  packed_;                  // whether ids are bit-packed
+    bool  grouped_;                 // whether groups have start positions
+    int   id_bits_;                 // number of bits of an id
+    int   interval_;                // one key for every interval_ ids
+    uint64_t mask_;                 // mask of id_bits_ bits
 };
 
 } // end namespace nns
@@ -2,6 +2,144 @@
 
 namespace nns {
 
+// -----------------------------------------------------------------------------
+//  BLocator: learned locator of leaf nodes
+// -----------------------------------------------------------------------------
+BLocator::BLocator()                // default constructor
+{
+    first_leaf_ = -1;
+    num_leaves_ = 0;
+    err_        = 0;
+}
+
+// -----------------------------------------------------------------------------
+//  build segments greedily (shrinking cone): each segment starts from a leaf 
+//  and is extended while there is a slope within eps of all its leaves. only 
+//  the last one of the leaves with the same first key is fitted, as it is 
+//  the answer of all the keys that fall into it.
+// -----------------------------------------------------------------------------
+void BLocator::build(               // build locator with error bound eps
+    int   n,                            // number of leaf nodes
+    const float *keys,                  // first keys of leaf nodes
+    int   first_leaf,                   // block of first leaf
+    int   eps)                          // error bound of segments
+{
+    first_leaf_ = first_leaf;
+    num_leaves_ = n;
+    segs_.clear();
+
+    std::vector<int> pts;           // positions of leaves to be fitted
+    for (int j = 0; j < n; ++j) {
+        if (j == n-1 || keys[j] < keys[j+1]) pts.push_back(j);
+    }
+    int num_pts = (int) pts.size();
+    int i = 0;
+    while (i < num_pts) {
+        int    j0 = pts[i];
+        double lo = 0.0, hi = -1.0; // slope range (hi < 0: unbounded)
+        int    k  = i + 1;
+        for (; k < num_pts; ++k) {
+            double dx = (double) keys[pts[k]] - keys[j0];
+            double dy = (double) (pts[k] - j0);
+            double l  = (dy - eps) / dx;
+            double h  = (dy + eps) / dx;
+            if (MAX(lo, l) > (hi < 0.0 ? h : MIN(hi, h))) break;
+
+            lo = MAX(lo, l);
+            hi = hi < 0.0 ? h : MIN(hi, h);
+        }
+        BLocSeg seg;
+        seg.key_   = keys[j0];
+        seg.slope_ = (float) (hi < 0.0 ? 0.0 : (lo + hi) / 2.0);
+        seg.first_ = j0;
+        segs_.push_back(seg);
+        i = k;
+    }
+
+    // -------------------------------------------------------------------------
+    //  calc the max error of prediction for all keys: a key in [keys[j], the
+    //  next fitted key) is predicted between the predictions of both ends
+    // -------------------------------------------------------------------------
+    err_ = 0;
+    int sid = 0;
+    for (int t = 0; t < num_pts; ++t) {
+        int j = pts[t];
+        while (sid+1 < (int) segs_.size() && segs_[sid+1].first_ <= j) ++sid;
+
+        int last = sid+1 < (int) segs_.size() ? segs_[sid+1].first_-1 : n-1;
+        int low  = position(sid, keys[j]);
+        int high = last;
+        if (t+1 < num_pts && pts[t+1] <= last) {
+            high = position(sid, keys[pts[t+1]]);
+        }
+        err_ = MAX(err_, MAX(abs(low - j), abs(high - j)));
+    }
+}
+
+// -----------------------------------------------------------------------------
+int BLocator::position(             // position of a key in a segment
+    int   sid,                          // segment id
+    float key) const                    // query key
+{
+    const BLocSeg &seg = segs_[sid];
+    int last = sid+1 < (int) segs_.size() ? segs_[sid+1].first_-1 
+        : num_leaves_-1;
+
+    double pos = seg.first_ + floor((double) seg.slope_ * (key - seg.key_));
+    if (pos < seg.first_) return seg.first_;
+    if (pos > last) return last;
+    return (int) pos;
+}
+
+// -----------------------------------------------------------------------------
+int BLocator::predict(              // predict position of leaf (-1: no leaf)
+    float key,                          // query key
+    int   &lo,                          // lowest  possible position (return)
+    int   &hi) const                    // highest possible position (return)
+{
+    if (segs_.empty() || key < segs_[0].key_) { lo = hi = -1; return -1; }
+
+    const BLocSeg *segs = segs_.data();
+    int sid  = find_last_leq((int) segs_.size(), 
+        [segs](int i) { return segs[i].key_; }, key);
+    int last = sid+1 < (int) segs_.size() ? segs_[sid+1].first_-1 
+        : num_leaves_-1;
+    int pos  = position(sid, key);
+
+    lo = MAX(segs_[sid].first_, pos - err_);
+    hi = MIN(last, pos + err_);
+    return pos;
+}
+
+// -----------------------------------------------------------------------------
+int BLocator::read(                 // read locator from buffer
+    const char *buf)                    // buffer
+{
+    int num_segs = 0;
+    memcpy(&first_leaf_, buf,                  sizeof(int));
+    memcpy(&num_leaves_, &buf[sizeof(int)],    sizeof(int));
+    memcpy(&err_,        &buf[sizeof(int)*2],  sizeof(int));
+    memcpy(&num_segs,    &buf[sizeof(int)*3],  sizeof(int));
+
+    segs_.resize(num_segs);
+    memcpy(segs_.data(), &buf[sizeof(int)*4], num_segs*sizeof(BLocSeg));
+    return get_size();
+}
+
+// -----------------------------------------------------------------------------
+int BLocator::write(                // write locator into buffer
+    char  *buf) const                   // buffer (return)
+{
+    int num_segs = (int) segs_.size();
+    memcpy(buf,                 &first_leaf_, sizeof(int));
+    memcpy(&buf[sizeof(int)],   &num_leaves_, sizeof(int));
+    memcpy(&buf[sizeof(int)*2], &err_,        sizeof(int));
+    memcpy(&buf[sizeof(int)*3], &num_segs,    sizeof(int));
+
+    memcpy(&buf[sizeof(int)*4], segs_.data(), num_segs*sizeof(BLocSeg));
+    return get_size();
+}
+
 // -----------------------------------------------------------------------------
 //  BTree: b-tree to index hash values produced by qalsh
 // -----------------------------------------------------------------------------
@@ -10,15 +148,22 @@ BTree::BTree()                      // default constructor
     root_     = -1;
     file_     = NULL;
     root_ptr_ = NULL;
+    version_  = BTREE_VERSION;
+    id_bits_  = 32;
+    interval_ = BTREE_INTERVAL;
+    leaf_blocks_ = 1;
 }
 
 // -----------------------------------------------------------------------------
 BTree::~BTree()                     // destructor
 {
-    char *header = new char[file_->get_blocklength()];
-    write_header(header);           // write root_ to header
-    file_->set_header(header);      // write back to disk
-    delete[] header;
+    if (!file_->is_read_only()) {
+        char *header = new char[file_->get_blocklength()];
+        memset(header, 0, file_->get_blocklength());
+        write_header(header);       // write root_ to header
+        file_->set_header(header);  // write back to disk
+        delete[] header;
+    }
 
     if (root_ptr_ != NULL) { delete root_ptr_; root_ptr_ = NULL; }
     if (file_     != NULL) { delete file_;     file_     = NULL; }
@@ -26,9 +171,15 @@ BTree::~BTree()                     // destructor
 
 // -----------------------------------------------------------------------------
 void BTree::init(                   // init a new tree
-    int   b_length,                     // block length
-    const char *fname)                  // file name
+    int   b_length,                     // block length (index node size)
+    const char *fname,                  // file name
+    int   leaf_blocks,                  // number of blocks of a leaf node
+    int   interval)                     // one key for every interval ids
 {
+    assert(leaf_blocks >= 1 && interval >= 1);
+    leaf_blocks_ = leaf_blocks;
+    interval_    = interval;
+
     FILE *fp = fopen(fname, "r");
     if (fp) {                       // check whether the file exist
         fclose(fp);                 // ask whether replace?
@@ -47,15 +198,32 @@ void BTree::init(                   // init a new tree
     //  (2) number of nodes (including both index node and leaf node),
     //  (3) root_ (address of root node)
     // -------------------------------------------------------------------------
+    init_leaf_keys();
+
     root_ptr_ = new BIndexNode();
     root_ptr_->init(0, this);
     root_ = root_ptr_->get_block();
     delete_root();
 }
 
+// -----------------------------------------------------------------------------
+void BTree::init_leaf_keys()        // init leaf_keys_ by the format of leaves
+{
+    int leaf_length = get_leaf_length();
+    for (int g = 0; g < 2; ++g) {
+        for (int b = 1; b <= BTREE_MAX_BITS; ++b) {
+            BLeafNode::calc_capacity(leaf_length, b, interval_, version_, 
+                leaf_keys_[g][b], g == 1);
+        }
+        leaf_keys_[g][0] = 0;
+    }
+}
+
 // -----------------------------------------------------------------------------
 void BTree::init_restore(           // load the tree from a tree file
-    const char *fname)                  // file name
+    const char *fname,                  // file name
+    bool  use_mmap,                     // map the file into memory
+    bool  read_only)                    // open the file read-only
 {
     FILE *fp = fopen(fname, "r");    // check whether the file exists
     if (!fp) { printf("tree file %s does not exist\n", fname);  exit(1); }
@@ -63,9 +231,19 @@ void BTree::init_restore(           // load the tree from a tree file
 
     // -------------------------------------------------------------------------
     //  it doesn't matter to initialize block length to 0. after reading file, 
-    //  the block length will be reinitialized by file.
+    //  the block length will be reinitialized by file. a read-only tree never
+    //  writes its header or nodes back, so it can be shared by processes.
     // -------------------------------------------------------------------------
-    file_ = new BlockFile(0, fname);
+    BlockFile *file = new BlockFile(0, fname, read_only);
+    if (use_mmap) file->map_file();
+    init_restore(file);
+}
+
+// -----------------------------------------------------------------------------
+void BTree::init_restore(           // load the tree from an opened file
+    BlockFile *file)                    // block file (owned by this tree)
+{
+    file_ = file;
     root_ptr_ = NULL;
 
     // -------------------------------------------------------------------------
@@ -75,6 +253,26 @@ void BTree::init_restore(           // load the tree from a tree file
     file_->read_header(header);     // read remain bytes from header
     read_header(header);            // init root_ from header
     delete[] header;
+    init_leaf_keys();
+
+    if (file_->map_ != NULL) {
+        // ---------------------------------------------------------------------
+        //  bulkload writes the leaf nodes in blocks [1, last leaf] from left to
+        //  right and the index nodes after them. the search walks the leaf 
+        //  siblings sequentially, and visits the index nodes randomly. the 
+        //  last leaf is found by following the rightmost path from root.
+        // ---------------------------------------------------------------------
+        BIndexView node;
+        int block = root_;
+        node.set(file_->fetch_block(block, NULL));
+        while (node.get_level() > 0) {
+            block = node.get_son(node.get_num_entries() - 1);
+            node.set(file_->fetch_block(block, NULL));
+        }
+        int num_blocks = file_->get_num_of_blocks();
+        file_->advise_blocks(0, num_blocks - 1, false);
+        file_->advise_blocks(1, block + leaf_blocks_ - 1, true);
+    }
 }
 
 // -----------------------------------------------------------------------------
@@ -82,6 +280,14 @@ int BTree::bulkload(                // bulkload a tree from memory
     int   n,                            // number of entries
     const Result *table)                // hash table
 {
+    // -------------------------------------------------------------------------
+    //  the ids of leaf nodes are packed into ceil(log2(max_id+1)) bits
+    // -------------------------------------------------------------------------
+    int max_id = 0;
+    for (int i = 0; i < n; ++i) max_id = MAX(max_id, table[i].id_);
+    id_bits_ = 1;
+    while (id_bits_ < 32 && ((int64_t) 1 << id_bits_) <= max_id) ++id_bits_;
+
     BIndexNode *index_child   = NULL;
     BIndexNode *index_prev_nd = NULL;
     BIndexNode *index_act_nd  = NULL;
@@ -99,6 +305,7 @@ int BTree::bulkload(                // bulkload a tree from memory
     bool first_node  = true;        // determine relationship of sibling
     int  start_block = 0;           // position of first node
     int  end_block   = 0;           // position of last node
+    std::vector<float> leaf_keys;   // first keys of leaf nodes
 
     for (int i = 0; i < n; ++i) {
         id  = table[i].id_;
@@ -107,6 +314,7 @@ int BTree::bulkload(                // bulkload a tree from memory
         if (!leaf_act_nd) {
             leaf_act_nd = new BLeafNode();
             leaf_act_nd->init(0, this);
+            leaf_keys.push_back(key);
 
             if (first_node) {
                 // init start_block
@@ -130,6 +338,19 @@ int BTree::bulkload(                // bulkload a tree from memory
     }
     if (leaf_prev_nd != NULL) { delete leaf_prev_nd; leaf_prev_nd = NULL; }
     if (leaf_act_nd  != NULL) { delete leaf_act_nd;  leaf_act_nd  = NULL; }
+    assert((end_block-start_block)/leaf_blocks_+1 == (int) leaf_keys.size());
+
+    // -------------------------------------------------------------------------
+    //  build the locator of leaves. it is stored in the header block, so the
+    //  error bound is relaxed until it fits into the header.
+    // -------------------------------------------------------------------------
+    int capacity = file_->get_blocklength() - BFHEAD_LENGTH - sizeof(int)*5;
+    int eps = BTREE_LOC_EPS;
+    while (true) {
+        loc_.build((int) leaf_keys.size(), leaf_keys.data(), start_block, eps);
+        if (loc_.get_size() <= capacity) break;
+        eps *= 2;
+    }
 
     // -------------------------------------------------------------------------
     //  build b-tree level by level
@@ -141,7 +362,8 @@ int BTree::bulkload(                // bulkload a tree from memory
     
     while (last_end_block > last_start_block) {
         first_node = true;
-        for (int i = last_start_block; i <= last_end_block; ++i) {
+        int step = cur_level == 1 ? leaf_blocks_ : 1; // blocks of a child
+        for (int i = last_start_block; i <= last_end_block; i += step) {
             block = i;
             if (cur_level == 1) {
                 leaf_child = new BLeafNode();
@@ -196,6 +418,94 @@ int BTree::bulkload(                // bulkload a tree from memory
     return 0;
 }
 
+// -----------------------------------------------------------------------------
+//  the leaf is found by the index nodes from root, and the path is kept. a 
+//  split of a node inserts its new right sibling into its parent, and a split
+//  of the root creates a new root. new nodes are appended to the file, so the
+//  leaves are no longer consecutive blocks and the locator is dropped. a new 
+//  smallest key of the leaf replaces its key in the parent, and so on upward
+//  while the node is the first child, so the search still finds it.
+// -----------------------------------------------------------------------------
+int BTree::insert(                  // insert an entry into b-tree
+    int   id,                           // object id
+    float key)                          // key (hash value) of object
+{
+    if (version_ < 3) {
+        printf("Could not insert into b-tree of version %d\n", version_);
+        return 1;
+    }
+    if (version_ != BTREE_VERSION) {
+        version_ = BTREE_VERSION;   // leaves may be grouped from now on
+        init_leaf_keys();
+    }
+
+    // -------------------------------------------------------------------------
+    //  find the leaf node and keep the index nodes on the path
+    // -------------------------------------------------------------------------
+    std::vector<BIndexNode*> path;  // index nodes from root
+    std::vector<int> follows;       // position of son in each index node
+
+    char *blk = new char[file_->get_blocklength()];
+    int block = root_;
+    while (file_->fetch_block(block, blk)[0] > 0) { // level of node
+        BIndexNode *node = new BIndexNode();
+        node->init_restore(this, block);
+        int follow = MAX(node->find_position_by_key(key), 0);
+
+        path.push_back(node);
+        follows.push_back(follow);
+        block = node->get_son(follow);
+    }
+    delete[] blk;
+
+    BLeafNode *leaf = new BLeafNode();
+    leaf->init_restore(this, block);
+
+    float sep = MINREAL;            // first key of new right sibling
+    int   son = -1;                 // new right sibling (-1: no split)
+    BLeafNode *right = leaf->insert(id, key);
+
+    float min_key = leaf->get_key_of_node();
+    for (int i = (int) path.size() - 1; i >= 0; --i) {
+        if (path[i]->get_key(follows[i]) <= min_key) break;
+        path[i]->set_key(follows[i], min_key);
+        if (follows[i] > 0) break;
+    }
+    int   level    = path.empty() ? 0 : path[0]->get_level();
+    float root_key = path.empty() ? leaf->get_key_of_node() : 
+        path[0]->get_key_of_node();
+    if (right != NULL) {
+        sep = right->get_key_of_node(); son = right->get_block();
+        delete right;
+        loc_ = BLocator();
+    }
+    delete leaf;
+
+    // -------------------------------------------------------------------------
+    //  insert the new right siblings into their parents from bottom to top
+    // -------------------------------------------------------------------------
+    for (int i = (int) path.size() - 1; i >= 0; --i) {
+        if (son != -1) {
+            BIndexNode *node = path[i]->insert_child(follows[i], sep, son);
+            son = -1;
+            if (node != NULL) {
+                sep = node->get_key_of_node(); son = node->get_block();
+                delete node;
+            }
+        }
+        delete path[i];
+    }
+    if (son != -1) {                // split of root
+        BIndexNode *root = new BIndexNode();
+        root->init(level + 1, this);
+        root->add_new_child(root_key, root_);
+        root->add_new_child(sep, son);
+        root_ = root->get_block();
+        delete root;
+    }
+    return 0;
+}
+
 // -----------------------------------------------------------------------------
 void BTree::load_root()             // load root of b-tree
 {    
@@ -16,6 +16,65 @@ namespace nns {
 class BlockFile;
 class BNode;
 
+// -----------------------------------------------------------------------------
+//  BLocSeg: a linear segment of the leaf locator
+// -----------------------------------------------------------------------------
+struct BLocSeg {
+    float key_;                     // first key of this segment
+    float slope_;                   // leaves per unit of key
+    int   first_;                   // first leaf (position) of this segment
+};
+
+// -----------------------------------------------------------------------------
+//  BLocator: a learned locator of leaf nodes, i.e., a piecewise linear model 
+//  from a key to the position of the last leaf whose first key <= this key. 
+//  The predicted position is at most err_ away from the right one, so the 
+//  leaf can be found by a local search without reading index nodes.
+//
+//  bulkload writes the leaf nodes in consecutive blocks, so the j-th leaf is 
+//  stored in block (first_leaf_ + j).
+// -----------------------------------------------------------------------------
+class BLocator {
+public:
+    int   first_leaf_;              // block of first leaf (-1: no locator)
+    int   num_leaves_;              // number of leaf nodes
+    int   err_;                     // max error of predicted position
+    std::vector<BLocSeg> segs_;     // segments sorted by key_
+
+    // -------------------------------------------------------------------------
+    BLocator();                     // default constructor
+
+    // -------------------------------------------------------------------------
+    void build(                     // build locator with error bound eps
+        int   n,                        // number of leaf nodes
+        const float *keys,              // first keys of leaf nodes
+        int   first_leaf,               // block of first leaf
+        int   eps);                     // error bound of segments
+
+    // -------------------------------------------------------------------------
+    int predict(                    // predict position of leaf (-1: no leaf)
+        float key,                      // query key
+        int   &lo,                      // lowest  possible position (return)
+        int   &hi) const;               // highest possible position (return)
+
+    // -------------------------------------------------------------------------
+    inline int get_size() const {   // size of locator in header
+        return sizeof(int)*4 + (int) segs_.size()*sizeof(BLocSeg);
+    }
+
+    // -------------------------------------------------------------------------
+    int read(const char *buf);      // read locator from buffer
+
+    // -------------------------------------------------------------------------
+    int write(char *buf) const;     // write locator into buffer
+
+protected:
+    // -------------------------------------------------------------------------
+    int position(                   // position of a key in a segment
+        int   sid,                      // segment id
+        float key) const;               // query key
+};
+
 // -----------------------------------------------------------------------------
 //  BTree: b-tree to index hash tables produced by qalsh
 // -----------------------------------------------------------------------------
@@ -24,6 +83,15 @@ public:
     int   root_;                    // disk address of root
     BNode *root_ptr_;               // pointer of root
     BlockFile *file_;               // file in disk to store
+    int   version_;                 // format version (0: legacy)
+    int   id_bits_;                 // number of bits of ids for new leaves
+    int   interval_;                // one key for every interval_ ids in leaf
+    int   leaf_blocks_;             // number of blocks of a leaf node
+    BLocator loc_;                  // learned locator of leaves (version 2)
+
+    // max number of keys of a leaf node by whether it is grouped and by the
+    // bits of its ids, so the views of leaf nodes do not compute them
+    int   leaf_keys_[2][BTREE_MAX_BITS+1];
     
     // -------------------------------------------------------------------------
     BTree();                        // default constructor
@@ -31,29 +99,86 @@ public:
 
     // -------------------------------------------------------------------------
     void init(                      // init a new b-tree
-        int   b_length,                 // block length
-        const char *fname);             // file name    
+        int   b_length,                 // block length (index node size)
+        const char *fname,              // file name    
+        int   leaf_blocks = 1,          // number of blocks of a leaf node
+        int   interval = BTREE_INTERVAL); // one key for every interval ids
 
     // -------------------------------------------------------------------------
     void init_restore(              // load an exist b-tree
-        const char *fname);             // file name
+        const char *fname,              // file name
+        bool  use_mmap = false,         // map the file into memory
+        bool  read_only = false);       // open the file read-only
+
+    // -------------------------------------------------------------------------
+    void init_restore(              // load an exist b-tree from an opened file
+        BlockFile *file);               // block file (owned by this tree)
 
     // -------------------------------------------------------------------------
     int bulkload(                   // bulkload b-tree from hash table in mem
         int   n,                        // number of entries
         const Result *table);           // hash table
 
+    // -------------------------------------------------------------------------
+    int insert(                     // insert an entry into b-tree
+        int   id,                       // object id
+        float key);                     // key (hash value) of object
+
+    // -------------------------------------------------------------------------
+    inline int get_leaf_length() {  // leaf node size in bytes
+        return file_->get_blocklength() * leaf_blocks_;
+    }
+
+    // -------------------------------------------------------------------------
+    inline int get_leaf_block(int pos) { // first block of the pos-th leaf
+        return loc_.first_leaf_ + pos * leaf_blocks_;
+    }
+
+    // -------------------------------------------------------------------------
+    void init_leaf_keys();          // init leaf_keys_ by the format of leaves
+
 protected:
     // -------------------------------------------------------------------------
-    inline int read_header(const char *buf) {// read root_ from buffer
-        memcpy(&root_, buf, sizeof(int));
-        return sizeof(int);
+    //  header: root_, BTREE_MAGIC, version_, interval_ and leaf_blocks_ 
+    //  (version >= 3), and loc_ (version >= 2). the legacy format (version 0)
+    //  only has root_. earlier versions use BTREE_INTERVAL and one block.
+    // -------------------------------------------------------------------------
+    inline int read_header(const char *buf) {// read header from buffer
+        int magic = -1;
+        memcpy(&root_, buf,               sizeof(int));
+        memcpy(&magic, &buf[sizeof(int)], sizeof(int));
+        if (magic != BTREE_MAGIC) { version_ = 0; return sizeof(int); }
+
+        memcpy(&version_, &buf[sizeof(int)*2], sizeof(int));
+        if (version_ > BTREE_VERSION) {
+            printf("Unsupported b-tree version %d\n", version_); exit(1);
+        }
+        int size = sizeof(int)*3;
+        if (version_ >= 3) {
+            memcpy(&interval_,    &buf[size],             sizeof(int));
+            memcpy(&leaf_blocks_, &buf[size+sizeof(int)], sizeof(int));
+            size += sizeof(int)*2;
+        }
+        if (version_ >= 2) size += loc_.read(&buf[size]);
+        return size;
     }
 
     // -------------------------------------------------------------------------
-    inline int write_header(char *buf) {// write root_ into buffer
+    inline int write_header(char *buf) {// write header into buffer
         memcpy(buf, &root_, sizeof(int));
-        return sizeof(int);
+        if (version_ == 0) return sizeof(int);
+
+        int magic = BTREE_MAGIC;
+        memcpy(&buf[sizeof(int)],   &magic,    sizeof(int));
+        memcpy(&buf[sizeof(int)*2], &version_, sizeof(int));
+        int size = sizeof(int)*3;
+        if (version_ >= 3) {
+            memcpy(&buf[size],             &interval_,    sizeof(int));
+            memcpy(&buf[size+sizeof(int)], &leaf_blocks_, sizeof(int));
+            size += sizeof(int)*2;
+        }
+        if (version_ >= 2) size += loc_.write(&buf[size]);
+        return size;
     }
 
     // -------------------------------------------------------------------------
@@ -1,3 +1,6 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include "block_file.h"
 #include "def.h"
 
@@ -6,17 +9,33 @@ namespace nns {
 // -----------------------------------------------------------------------------
 BlockFile::BlockFile(               // constructor
     int   b_length,                     // block length
-    const char *name)                   // file name
+    const char *name,                   // file name
+    bool  read_only)                    // open an exist file read-only
 {
     strcpy(fname_, name);
+    read_only_    = read_only;
     block_length_ = b_length;
     num_blocks_   = 0;
+    map_          = NULL;
+    map_size_     = 0;
+    fd_           = -1;
+    base_         = 0;
 
     // -------------------------------------------------------------------------
     //  init fp_ and open file_name_. if file_name_ exists, then fp_ != 0
     //  rb+: read binary data from disk
+    //  rb:  read binary data from disk (read-only, the file must exist). it 
+    //       works on read-only file systems, and the file is never modified.
     // -------------------------------------------------------------------------
-    if ((fp_ = fopen(fname_, "rb+")) != 0) {
+    if (read_only_) {
+        if ((fp_ = fopen(fname_, "rb")) == 0) {
+            printf("Could not open %s read-only\n", fname_); exit(1);
+        }
+        new_flag_ = false;
+        block_length_ = fread_number(); // get block_length_ from header
+        num_blocks_   = fread_number(); // get num_blocks_   from header
+    }
+    else if ((fp_ = fopen(fname_, "rb+")) != 0) {
         // since the file exists, new_flag_ is false
         new_flag_ = false;
         block_length_ = fread_number(); // get block_length_ from header
@@ -54,12 +73,51 @@ BlockFile::BlockFile(               // constructor
     act_block_ = 0;
 }
 
+// -----------------------------------------------------------------------------
+//  NOTE: a block file in a pack is read-only. it does not own the file 
+//  descriptor and the mapping of pack, and it reads blocks by pread() or from 
+//  the mapping, so that all block files of a pack can share them.
+// -----------------------------------------------------------------------------
+BlockFile::BlockFile(               // constructor (a block file in a pack)
+    int   fd,                           // file descriptor of pack
+    uint64_t base,                      // offset of this file in pack
+    const char *map)                    // mapping of this file (NULL: none)
+{
+    fp_           = NULL;
+    fname_[0]     = '\0';
+    new_flag_     = false;
+    read_only_    = true;
+    fd_           = fd;
+    base_         = base;
+    map_          = (char*) map;
+    act_block_    = 0;
+
+    int header[2];
+    read_at(0, (char*) header, BFHEAD_LENGTH);
+    block_length_ = header[0];
+    num_blocks_   = header[1];
+    map_size_     = map_ ? (uint64_t) (num_blocks_ + 1) * block_length_ : 0;
+}
+
 // -----------------------------------------------------------------------------
 BlockFile::~BlockFile()             // destructor
 {
+    if (map_ && fp_) munmap(map_, map_size_); // the mapping of pack is shared
     if (fp_) fclose(fp_);
 }
 
+// -----------------------------------------------------------------------------
+void BlockFile::read_at(            // read bytes at a position of this file
+    uint64_t pos,                       // position (start from 0)
+    char  *bytes,                       // bytes (return)
+    int   num)                          // number of bytes
+{
+    if (map_ != NULL) { memcpy(bytes, &map_[pos], num); return; }
+    if (pread(fd_, bytes, num, base_ + pos) != num) {
+        printf("Could not read %d bytes from pack\n", num); exit(1);
+    }
+}
+
 // -----------------------------------------------------------------------------
 //  Note: this func does not read the header of block file. it fetches the info 
 //  (the root of b+ tree) in the 1st block excluding the header.
@@ -67,6 +125,10 @@ BlockFile::~BlockFile()             // destructor
 void BlockFile::read_header(        // read remain bytes excluding header
     char *buffer)                       // buffer with remain bytes (return)
 {
+    if (fp_ == NULL) {              // a block file in a pack
+        read_at(BFHEAD_LENGTH, buffer, block_length_ - BFHEAD_LENGTH);
+        return;
+    }
     fseek(fp_, BFHEAD_LENGTH, SEEK_SET); // jump out of first 8 bytes
     get_bytes(buffer, block_length_ - BFHEAD_LENGTH); // read remaining bytes
 
@@ -90,6 +152,7 @@ void BlockFile::read_header(        // read remain bytes excluding header
 void BlockFile::set_header(         // set remain bytes excluding header
     const char *buffer)                 // buffer with remain bytes
 {
+    assert(!read_only_);
     fseek(fp_, BFHEAD_LENGTH, SEEK_SET); // jump out of first 8 bytes
     put_bytes(buffer, block_length_ - BFHEAD_LENGTH); // write remain bytes
     
@@ -132,20 +195,25 @@ void BlockFile::set_header(         // set remain bytes excluding header
 //  position of the 3rd data block. As we know it has read or written 3 blocks, 
 //  thus currently act_block_ = index + 1 = 2 + 1 = 3.
 // -----------------------------------------------------------------------------
-bool BlockFile::read_block(         // read a block from index
-    Block block,                        // a block (return)
-    int   index)                        // position of this block (start from 0)
+bool BlockFile::read_block(         // read blocks from index
+    Block block,                        // num blocks (return)
+    int   index,                        // position of 1st block (start from 0)
+    int   num)                          // number of consecutive blocks
 {
-    ++index; assert(index > 0 && index <= num_blocks_);
+    ++index; assert(index > 0 && index + num - 1 <= num_blocks_);
+    if (fp_ == NULL) {              // a block file in a pack
+        read_at((uint64_t) index * block_length_, block, num*block_length_);
+        return true;
+    }
     seek_block(index);
-    get_bytes(block, block_length_);// read this block
+    get_bytes(block, num*block_length_);// read these blocks
 
     // update act_block_
-    if (index + 1 > num_blocks_) {
+    if (index + num > num_blocks_) {
         // fp_ reaches the end of this block file, so rewinds to start position
         fseek(fp_, 0, SEEK_SET); act_block_ = 0;
     } else {
-        act_block_ = index + 1;     // act_block_ to the next position
+        act_block_ = index + num;   // act_block_ to the next position
     }
     return true;
 }
@@ -155,42 +223,46 @@ bool BlockFile::read_block(         // read a block from index
 //  range of num_blocks_).
 //  If you allocate a new block, please call append_block() instead.
 // -----------------------------------------------------------------------------
-bool BlockFile::write_block(        // write a block to index
-    Block block,                        // a block
-    int index)                          // position of this block (start from 0)
+bool BlockFile::write_block(        // write blocks to index
+    Block block,                        // num blocks
+    int   index,                        // position of 1st block (start from 0)
+    int   num)                          // number of consecutive blocks
 {
-    ++index; assert(index > 0 && index <= num_blocks_);
+    assert(!read_only_);
+    ++index; assert(index > 0 && index + num - 1 <= num_blocks_);
     seek_block(index);
-    put_bytes(block, block_length_);// write this block
+    put_bytes(block, num*block_length_);// write these blocks
 
     // update act_block_
-    if (index + 1 > num_blocks_) {
+    if (index + num > num_blocks_) {
         fseek(fp_, 0, SEEK_SET); act_block_ = 0;
     } else {
-        act_block_ = index + 1;
+        act_block_ = index + num;
     }
     return true;
 }
 
 // -----------------------------------------------------------------------------
-int BlockFile::append_block(        // append new block at the end of file
-    Block block)                        // the new block
+int BlockFile::append_block(        // append new blocks at the end of file
+    Block block,                        // the new blocks
+    int   num)                          // number of consecutive blocks
 {
+    assert(!read_only_);
     fseek(fp_, 0, SEEK_END);        // fp_ points to the end of file
-    put_bytes(block, block_length_);// write a block
-    ++num_blocks_;                  // add 1 to num_blocks_
+    put_bytes(block, num*block_length_);// write num blocks
+    num_blocks_ += num;             // add num to num_blocks_
     
     // fp_ points to the position to store num_blocks_ & update header
     fseek(fp_, sizeof(int), SEEK_SET); 
     fwrite_number(num_blocks_);
 
     // -------------------------------------------------------------------------
-    //  fp_ points to the start position of new added block
-    //  act_block_ = num_blocks_ indicates that fp_ points to new added block.
-    //  return the index of new added block
+    //  fp_ points to the start position of the first new added block
+    //  act_block_ = num_blocks_-num+1 indicates that fp_ points to it.
+    //  return the index of the first new added block
     // -------------------------------------------------------------------------
-    fseek(fp_, -block_length_, SEEK_END);
-    return (act_block_ = num_blocks_) - 1;
+    fseek(fp_, -(long) num*block_length_, SEEK_END);
+    return (act_block_ = num_blocks_ - num + 1) - 1;
 }
 
 // -----------------------------------------------------------------------------
@@ -200,7 +272,7 @@ int BlockFile::append_block(        // append new block at the end of file
 bool BlockFile::delete_last_blocks( // delete the last `num` blocks
     int num)                            // number of blocks to be deleted
 {
-    if (num > num_blocks_) return false;
+    if (read_only_ || num > num_blocks_) return false;
 
     // only update num_blocks_ & re-write it to disk
     num_blocks_ -= num;
@@ -212,4 +284,43 @@ bool BlockFile::delete_last_blocks( // delete the last `num` blocks
     return true;
 }
 
+// -----------------------------------------------------------------------------
+//  NOTE: the mapping is read-only and shared, so the page cache of kernel is 
+//  the buffer pool for all processes which open the same file. the file 
+//  cannot be appended after it is mapped.
+// -----------------------------------------------------------------------------
+bool BlockFile::map_file()          // map the file into memory (read-only)
+{
+    if (map_ != NULL) return true;
+    if (fp_ == NULL || num_blocks_ < 1) return false;
+
+    map_size_ = (uint64_t) (num_blocks_ + 1) * block_length_;
+    void *addr = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fileno(fp_), 0);
+    if (addr == MAP_FAILED) { map_size_ = 0; return false; }
+
+    map_ = (char*) addr;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+void BlockFile::advise_blocks(      // give access hint for a range of blocks
+    int   start,                        // first block (start from 0)
+    int   end,                          // last  block (inclusive)
+    bool  sequential)                   // sequential or random access
+{
+    if (map_ == NULL || start > end) return;
+
+    // -------------------------------------------------------------------------
+    //  madvise requires the start address aligned to the page size. the 
+    //  mapping of a block file in a pack may not start at a page boundary.
+    // -------------------------------------------------------------------------
+    uint64_t page  = (uint64_t) sysconf(_SC_PAGESIZE);
+    uint64_t first = (uint64_t) (start+1) * block_length_;
+    uint64_t last  = MIN((uint64_t) (end+2) * block_length_, map_size_);
+    char *addr = (char*) ((uintptr_t) (map_ + first) / page * page);
+
+    madvise(addr, map_ + last - addr, sequential ? MADV_SEQUENTIAL : 
+        MADV_RANDOM);
+}
+
 } // end namespace nns
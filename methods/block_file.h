@@ -22,15 +22,29 @@ public:
     FILE *fp_;                      // file pointer
     char fname_[200];               // file name
     bool new_flag_;                 // specifies if this is a new file
+    bool read_only_;                // opened read-only (no writes allowed)
     
     int  block_length_;             // length of a block
     int  act_block_;                // block num of fp position
     int  num_blocks_;               // total num of blocks
 
+    char *map_;                     // read-only mapping of file (NULL: none)
+    uint64_t map_size_;             // size of mapping
+
+    int  fd_;                       // file descriptor of pack (-1: no pack)
+    uint64_t base_;                 // offset of this file in pack
+
     // -------------------------------------------------------------------------
     BlockFile(                      // constructor
         int  b_length,                  // length of a block
-        const char *name);              // file name
+        const char *name,               // file name
+        bool read_only = false);        // open an exist file read-only
+
+    // -------------------------------------------------------------------------
+    BlockFile(                      // constructor (a block file in a pack)
+        int   fd,                       // file descriptor of pack
+        uint64_t base,                  // offset of this file in pack
+        const char *map);               // mapping of this file (NULL: none)
 
     // -------------------------------------------------------------------------
     ~BlockFile();                   // destructor
@@ -53,6 +67,9 @@ public:
     // -------------------------------------------------------------------------
     inline bool file_new() { return new_flag_; } // is this block modified?
 
+    // -------------------------------------------------------------------------
+    inline bool is_read_only() { return read_only_; }
+
     // -------------------------------------------------------------------------
     inline int get_blocklength() { return block_length_; }
 
@@ -78,22 +95,58 @@ public:
         const char *buffer);            // contain remain bytes
 
     // -------------------------------------------------------------------------
-    bool read_block(                // read a block in the `index` position
-        Block block,                    // a block
-        int   index);                   // position of the block
+    bool read_block(                // read blocks from the `index` position
+        Block block,                    // `num` blocks (return)
+        int   index,                    // position of the first block
+        int   num = 1);                 // number of consecutive blocks
 
     // -------------------------------------------------------------------------
-    bool write_block(               // write a block in the `index` position
-        Block block,                    // a block
-        int   index);                   // pos of the block
+    bool write_block(               // write blocks to the `index` position
+        Block block,                    // `num` blocks
+        int   index,                    // pos of the first block
+        int   num = 1);                 // number of consecutive blocks
 
     // -------------------------------------------------------------------------
-    int append_block(               // append a block at the end of file
-        Block block);                   // a block
+    int append_block(               // append blocks at the end of file
+        Block block,                    // `num` blocks
+        int   num = 1);                 // number of consecutive blocks
 
     // -------------------------------------------------------------------------
     bool delete_last_blocks(        // delete the last `num` blocks
         int num);                       // number of blocks to be deleted
+
+    // -------------------------------------------------------------------------
+    bool map_file();                // map the file into memory (read-only)
+
+    // -------------------------------------------------------------------------
+    void advise_blocks(             // give access hint for a range of blocks
+        int   start,                    // first block (start from 0)
+        int   end,                      // last  block (inclusive)
+        bool  sequential);              // sequential or random access
+
+    // -------------------------------------------------------------------------
+    //  fetch `num` blocks from the `index` position. if the file is mapped, 
+    //  return the address of these blocks in the mapping (zero copy). 
+    //  otherwise, read them into `block` and return `block`.
+    // -------------------------------------------------------------------------
+    inline const char* fetch_block( // fetch blocks from the `index` position
+        int   index,                    // position of the first block
+        Block block,                    // `num` blocks (used if not mapped)
+        int   num = 1) {                // number of consecutive blocks
+        if (map_ != NULL) {
+            assert(index >= 0 && index + num <= num_blocks_);
+            return &map_[(uint64_t) (index+1) * block_length_];
+        }
+        read_block(block, index, num);
+        return block;
+    }
+
+protected:
+    // -------------------------------------------------------------------------
+    void read_at(                   // read bytes at a position of this file
+        uint64_t pos,                   // position (start from 0)
+        char  *bytes,                   // bytes (return)
+        int   num);                     // number of bytes
 };
 
 } // end namespace nns
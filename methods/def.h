@@ -38,9 +38,28 @@ const float ANGLE            = PI / 8.0f;
 
 const int   CANDIDATES       = 100;
 const int   BFHEAD_LENGTH    = sizeof(int)*2;
-const int   BTREE_LEAF_SIZE  = 128;
+const int   BTREE_INTERVAL   = 32;         // ids per key of leaf nodes
+const int   BTREE_MAGIC      = 0x31544251; // "QBT1"
+const int   BTREE_VERSION    = 4;
+const int   BTREE_GROUPED    = 0x80;       // flag of grouped leaf nodes
+const int   BTREE_BITS_MASK  = 0x7F;       // mask of id bits of leaf nodes
+const int   BTREE_MAX_BITS   = 32;         // max number of bits of an id
+const int   BTREE_LOC_EPS    = 1;
+const int   PARA_MAGIC       = 0x52415051; // QPAR
+const int   PARA_VERSION     = 1;
+const float COMPACT_RATIO    = 0.1f;       // deleted entries to compact trees
+const int   PACK_MAGIC       = 0x4B504151; // "QAPK"
+const int   PACK_VERSION     = 1;
+const int   PACK_ALIGN       = 4096;
+const int   PACK_NAME_LEN    = 64;
+const int   KMEANS_BATCH     = 256;
+const int   KMEANS_ITER      = 50;
+const int   WATCH_INTERVAL   = 100;        // interval to check versions (ms)
+const int   STAGE_NICE       = 10;         // nice value of staged builds
 
 const std::vector<int> TOPKs = { 1, 2, 5, 10, 20, 50, 100 };
+const std::vector<float> TUNE_Cs = { 1.5f, 2.0f, 2.5f, 3.0f };
+const std::vector<int> TUNE_BUDGETs = { 25, 50, 100, 200, 400, 800, 1600 };
 const int MAXK = TOPKs.back(); 
 
 } // end namespace nns
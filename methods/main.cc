@@ -24,15 +24,38 @@ void usage()                        // usage of the package
         "    -qn   (integer)   number of queries\n"
         "    -d    (integer)   dimensionality\n"
         "    -B    (integer)   page size\n"
+        "    -lb   (integer)   leaf node size of b+ trees (multiple of B)\n"
+        "    -ki   (integer)   number of ids per key in leaf nodes\n"
         "    -p    (real)      l_p distance <==> p-stable distr. (0, 2]\n"
         "    -z    (real)      symmetric factor of p-stable distr. [-1, 1]\n"
         "    -c    (real)      approximation ratio (c > 1)\n"
         "    -lf   (integer)   leaf size of kd-tree\n"
         "    -L       (integer)   number of projections (drusilla)\n"
         "    -M    (integer)   number of candidates  (drusilla)\n"
+        "    -sh   (integer)   share hash functions among blocks (0 or 1)\n"
+        "    -pt   (integer)   partition: 0-kd-tree, 1-k-means, 2-rp-tree\n"
+        "    -ic   (integer)   incremental evaluation of #blocks (0 or 1)\n"
+        "    -mm   (integer)   map b+ trees into memory (0 or 1)\n"
+        "    -pk   (integer)   pack index into one file (0 or 1)\n"
+        "    -lc   (integer)   find leaves by learned locators (0 or 1)\n"
+        "    -sn   (integer)   number of data points of a new segment\n"
+        "    -st   (integer)   build a new version and publish it (0 or 1)\n"
+        "    -ht   (integer)   number of hash tables of QALSH\n"
+        "    -qc   (real)      approximation ratio of queries (c > 1)\n"
+        "    -qb   (integer)   max number of candidates of queries\n"
+        "    -ql   (integer)   collision threshold of queries\n"
+        "    -qt   (real)      deadline of query time (ms)\n"
+        "    -qi   (integer)   deadline of I/Os of queries\n"
+        "    -qd   (integer)   deadline of candidates of queries\n"
+        "    -tk   (integer)   top-k value of tuning (default: 10)\n"
+        "    -tr   (real)      target recall (%%) of tuning\n"
+        "    -ta   (real)      target ratio of tuning\n"
+        "    -tt   (real)      target query time (ms) of tuning\n"
+        "    -tu   (integer)   use tuned parameters of search (0 or 1)\n"
         "    -dt   (string)    data type\n"
         "    -pf   (string)    prefix folder\n"
         "    -df   (string)    data folder to store new format of data\n"
+        "    -rf   (string)    file of ids of data points to delete\n"
         "    -of   (string)    output folder\n"
         "\n"
         "--------------------------------------------------------------------\n"
@@ -43,19 +66,69 @@ void usage()                        // usage of the package
         "\n"
         "    1 - Two Level Indexing of QALSH+\n"
         "        Params: -alg 1 -n -d -B -lf -L -M -p -z -c -dt -pf -df -of\n"
+        "        Option: -sh -pt -pk -lb -ki -st\n"
         "\n"
         "    2 - Two Level c-k-ANNS of QALSH+\n"
         "        Params: -alg 2 -qn -d -p -dt -pf -df -of\n"
+        "        Option: -ic -mm -pk -lc -qc -qb -ql -qt -qi -qd -tu\n"
         "\n"
         "    3 - Indexing of QALSH\n"
         "        Params: -alg 3 -n -d -B -p -z -c -dt -pf -df -of\n"
+        "        Option: -pk -lb -ki -st\n"
         "\n"
         "    4 - c-k-ANN Search of QALSH\n"
         "        Params: -alg 4 -qn -d -p -dt -pf -df -of\n"
+        "        Option: -mm -pk -lc -ht -qc -qb -ql -qt -qi -qd -tu\n"
         "\n"
         "    5 - Linear Scan Search\n"
         "        Params: -alg 5 -n -qn -d -B -p -dt -pf -df -of\n"
         "\n"
+        "    6 - Insertion of QALSH (insert data points [n0, n) into an \n"
+        "        index of n0 points)\n"
+        "        Params: -alg 6 -n -d -dt -pf -df -of\n"
+        "\n"
+        "    7 - Deletion of QALSH (delete the data points of ids in -rf from\n"
+        "        an index of n points)\n"
+        "        Params: -alg 7 -n -d -dt -pf -rf -of\n"
+        "\n"
+        "    8 - Insertion of Segmented QALSH (insert data points [n0, n) as \n"
+        "        segments of sn points, and merge segments)\n"
+        "        Params: -alg 8 -n -d -B -sn -p -z -c -dt -pf -df -of\n"
+        "        Option: -lb -ki\n"
+        "\n"
+        "    9 - c-k-ANN Search of Segmented QALSH\n"
+        "        Params: -alg 9 -qn -d -p -dt -pf -df -of\n"
+        "        Option: -mm -qc -qb -ql -qt -qi -qd\n"
+        "\n"
+        "    10 - Insertion of QALSH+ (insert data points [n0, n) into an \n"
+        "        index of n0 points, and split blocks of more than lf points)\n"
+        "        Params: -alg 10 -n -d -lf -L -M -dt -pf -df -of\n"
+        "\n"
+        "    11 - Extension of QALSH (add hash tables to an index of n \n"
+        "        points, up to ht tables or the tables tuned for c)\n"
+        "        Params: -alg 11 -n -d -dt -pf -of\n"
+        "        Option: -ht -c\n"
+        "\n"
+        "    12 - Tuning of QALSH (find the cheapest c and budget which meet\n"
+        "        the targets on qn queries, saved in qalsh.tune)\n"
+        "        Params: -alg 12 -qn -d -p -dt -pf -df -of\n"
+        "        Option: -tk -tr -ta -tt\n"
+        "\n"
+        "    13 - Tuning of QALSH+ (find the cheapest c, budget, and nb which\n"
+        "        meet the targets on qn queries, saved in qalsh_plus.tune)\n"
+        "        Params: -alg 13 -qn -d -p -dt -pf -df -of\n"
+        "        Option: -tk -tr -ta -tt\n"
+        "\n"
+        "    14 - Incremental k-NN Search of QALSH (fetch the next neighbors\n"
+        "        by an iterator without restarting the search)\n"
+        "        Params: -alg 14 -qn -d -p -dt -pf -df -of\n"
+        "        Option: -ht -qc -qb -ql -qt -qi -qd\n"
+        "\n"
+        "    15 - Range Search of QALSH (the radius of top-k is the distance\n"
+        "        of the exact k-th NN)\n"
+        "        Params: -alg 15 -qn -d -p -dt -pf -df -of\n"
+        "        Option: -ht -qc -qb -ql -qt -qi -qd\n"
+        "\n"
         "--------------------------------------------------------------------\n"
         " Author: HUANG Qiang (huangq@comp.nus.edu.sg)                       \n"
         "--------------------------------------------------------------------\n"
@@ -70,17 +143,35 @@ void interface(                     // interface for calling function
     int   qn,                           // number of query points
     int   d,                            // dimensionality
     int   B,                            // page size
+    int   LB,                           // leaf node size of b+ trees
+    int   interval,                     // number of ids per key in leaves
     int   leaf,                         // leaf size of kd-tree
     int   L,                            // number of projection (drusilla)
     int   M,                            // number of candidates (drusilla)
     float p,                            // p-stable distr. (0,2]
     float zeta,                         // symmetric factor of p-distr. [-1,1]
     float c,                            // approximation ratio
+    int   share,                        // share hash functions among blocks
+    int   part,                         // 0: kd-tree, 1: k-means, 2: rp-tree
+    int   incr,                         // incremental evaluation of nb
+    int   use_mmap,                     // map b+ trees into memory
+    int   use_pack,                     // pack index into one file
+    int   use_loc,                      // find leaves by learned locators
+    int   seg_size,                     // number of points of a new segment
+    int   stage,                        // build a new version and publish it
+    int   n_tables,                     // number of hash tables of qalsh
+    const QueryParams *params,          // parameters of queries
+    int   use_tune,                     // use tuned parameters of search
+    int   tune_k,                       // top-k value of tuning
+    float t_recall,                     // target recall of tuning
+    float t_ratio,                      // target ratio of tuning
+    float t_time,                       // target query time of tuning
     const char *prefix,                 // prefix of data, query, and truth
     const char *dfolder,                // data folder
+    const char *rfile,                  // file of ids of deleted points
     const char *ofolder)                // output folder
 {
-    assert(alg >= 0 && alg <= 5);
+    assert(alg >= 0 && alg <= 15);
 
     // read data set, query set, and ground truth file
     gettimeofday(&g_start_time, NULL);
@@ -88,7 +179,8 @@ void interface(                     // interface for calling function
     DType  *query = NULL;
     Result *truth = NULL;
 
-    if (alg == 0 || alg == 1 || alg == 3) {
+    if (alg == 0 || alg == 1 || alg == 3 || alg == 6 || alg == 7 || 
+        alg == 8 || alg == 10 || alg == 11) {
         data = new DType[(uint64_t) n*d];
         if (read_data<DType>(n, d, 0, p, prefix, data)) exit(1);
         if (alg == 1 || alg == 3) {
@@ -96,11 +188,13 @@ void interface(                     // interface for calling function
             write_data_new_form<DType>(n, d, B, (const DType*) data, dfolder);
         }
     }
-    if (alg == 0 || alg == 2 || alg == 4 || alg == 5) {
+    if (alg == 0 || alg == 2 || alg == 4 || alg == 5 || alg == 9 || 
+        alg == 12 || alg == 13 || alg == 14 || alg == 15) {
         query = new DType[(uint64_t) qn*d];
         if (read_data<DType>(qn, d, 1, p, prefix, query)) exit(1);
     }
-    if (alg == 2 || alg == 4 || alg == 5) {
+    if (alg == 2 || alg == 4 || alg == 5 || alg == 9 || alg == 12 || 
+        alg == 13 || alg == 14 || alg == 15) {
         truth = new Result[(uint64_t) qn*MAXK];
         if (read_data<Result>(qn, MAXK, 2, p, prefix, truth)) exit(1);
     }
@@ -117,33 +211,82 @@ void interface(                     // interface for calling function
             (const DType*) query);
         break;
     case 1:
-        indexing_of_qalsh_plus<DType>(n, d, B, leaf, L, M, p, zeta, c,
-            (const DType*) data, ofolder);
+        indexing_of_qalsh_plus<DType>(n, d, B, LB, interval, leaf, L, M, p, 
+            zeta, c, share, part, use_pack, stage, (const DType*) data, 
+            ofolder);
         break;
     case 2:
-        knn_of_qalsh_plus<DType>(qn, d, (const DType*) query, 
-            (const Result*) truth, dfolder, ofolder);
+        knn_of_qalsh_plus<DType>(qn, d, incr, use_mmap, use_pack, use_loc,
+            use_tune, params, (const DType*) query, (const Result*) truth, 
+            dfolder, ofolder);
         break;
     case 3:
-        indexing_of_qalsh<DType>(n, d, B, p, zeta, c, (const DType*) data, 
-            ofolder);
+        indexing_of_qalsh<DType>(n, d, B, LB, interval, p, zeta, c, use_pack,
+            stage, (const DType*) data, ofolder);
         break;
     case 4:
-        knn_of_qalsh<DType>(qn, d, (const DType*) query, (const Result*) truth,
+        knn_of_qalsh<DType>(qn, d, n_tables, use_mmap, use_pack, use_loc, 
+            use_tune, params, (const DType*) query, (const Result*) truth, 
             dfolder, ofolder);
         break;
     case 5:
         linear_scan<DType>(n, qn, d, B, p, (const DType*) query, 
             (const Result*) truth, dfolder, ofolder);
         break;
+    case 6:
+        insert_of_qalsh<DType>(n, d, (const DType*) data, dfolder, ofolder);
+        break;
+    case 7:
+        delete_of_qalsh<DType>(n, (const DType*) data, rfile, ofolder);
+        break;
+    case 8:
+        insert_of_qalsh_lsm<DType>(n, d, B, LB, interval, seg_size, p, zeta, 
+            c, (const DType*) data, dfolder, ofolder);
+        break;
+    case 9:
+        knn_of_qalsh_lsm<DType>(qn, d, use_mmap, params, 
+            (const DType*) query, (const Result*) truth, dfolder, ofolder);
+        break;
+    case 10:
+        insert_of_qalsh_plus<DType>(n, d, leaf, L, M, (const DType*) data, 
+            dfolder, ofolder);
+        break;
+    case 11:
+        extend_of_qalsh<DType>(n, n_tables, c, (const DType*) data, ofolder);
+        break;
+    case 12:
+        tune_of_qalsh<DType>(qn, d, tune_k, t_recall, t_ratio, t_time, 
+            (const DType*) query, (const Result*) truth, dfolder, ofolder);
+        break;
+    case 13:
+        tune_of_qalsh_plus<DType>(qn, d, tune_k, t_recall, t_ratio, t_time, 
+            (const DType*) query, (const Result*) truth, dfolder, ofolder);
+        break;
+    case 14:
+        knn_of_qalsh_iter<DType>(qn, d, n_tables, params, (const DType*) query,
+            (const Result*) truth, dfolder, ofolder);
+        break;
+    case 15:
+        range_of_qalsh<DType>(qn, d, n_tables, params, (const DType*) query,
+            (const Result*) truth, dfolder, ofolder);
+        break;
     default:
         printf("Parameters error!\n");
         usage();
     }
     //  release space
-    if (alg == 0 || alg == 1 || alg == 3) delete[] data;
-    if (alg == 0 || alg == 2 || alg == 4 || alg == 5)delete[] query;
-    if (alg == 2 || alg == 4 || alg == 5) delete[] truth; 
+    if (alg == 0 || alg == 1 || alg == 3 || alg == 6 || alg == 7 || 
+        alg == 8 || alg == 10 || alg == 11) {
+        delete[] data;
+    }
+    if (alg == 0 || alg == 2 || alg == 4 || alg == 5 || alg == 9 || 
+        alg == 12 || alg == 13 || alg == 14 || alg == 15) {
+        delete[] query;
+    }
+    if (alg == 2 || alg == 4 || alg == 5 || alg == 9 || alg == 12 || 
+        alg == 13 || alg == 14 || alg == 15) {
+        delete[] truth;
+    }
 }
 
 // -----------------------------------------------------------------------------
@@ -157,15 +300,33 @@ int main(int nargs, char **args)
     int   qn   = -1;                // number of query points
     int   d    = -1;                // dimensionality
     int   B    = -1;                // page size
+    int   LB   = -1;                // leaf node size of b+ trees (-1: B)
+    int   interval = BTREE_INTERVAL; // number of ids per key in leaves
     float p    = -1.0f;             // p-stable distr. (0,2]
     float zeta = -2.0f;             // symmetric factor of p-distr. [-1,1]
     float c    = -1.0f;             // approximation ratio
     int   leaf = -1;                // leaf size of kd-tree (QALSH+)
     int   L    = -1;                // #projections for drusilla-select (QALSH+)
     int   M    = -1;                // #candidates  for drusilla-select (QALSH+)
+    int   share = 0;                // share hash functions among blocks (QALSH+)
+    int   part  = 0;                // partition method of blocks (QALSH+)
+    int   incr  = 0;                // incremental evaluation of nb (QALSH+)
+    int   use_mmap = 0;             // map b+ trees into memory
+    int   use_pack = 0;             // pack index into one file
+    int   use_loc  = 0;             // find leaves by learned locators
+    int   seg_size = -1;            // number of points of a new segment
+    int   stage    = 0;             // build a new version and publish it
+    int   n_tables = -1;            // number of hash tables of qalsh
+    QueryParams params;             // parameters of queries (-1: as built)
+    int   use_tune = 0;             // use tuned parameters of search
+    int   tune_k   = 10;            // top-k value of tuning
+    float t_recall = -1.0f;         // target recall of tuning
+    float t_ratio  = -1.0f;         // target ratio of tuning
+    float t_time   = -1.0f;         // target query time of tuning (ms)
     char  dtype[20];                // data type
     char  prefix[200];              // prefix of data, query, and truth set
     char  dfolder[200];             // data folder
+    char  rfile[200];               // file of ids of deleted points
     char  ofolder[200];             // output folder
 
     while (cnt < nargs) {
@@ -189,6 +350,14 @@ int main(int nargs, char **args)
             B = atoi(args[++cnt]); assert(B > 0);
             printf("B       = %d\n", B); 
         }
+        else if (strcmp(args[cnt], "-lb") == 0) {
+            LB = atoi(args[++cnt]); assert(LB > 0);
+            printf("LB      = %d\n", LB); 
+        }
+        else if (strcmp(args[cnt], "-ki") == 0) {
+            interval = atoi(args[++cnt]); assert(interval > 0);
+            printf("ki      = %d\n", interval);
+        }
         else if (strcmp(args[cnt], "-lf") == 0) {
             leaf = atoi(args[++cnt]); assert(leaf > 0);
             printf("leaf    = %d\n", leaf);
@@ -201,6 +370,90 @@ int main(int nargs, char **args)
             M = atoi(args[++cnt]); assert(M > 0);
             printf("M       = %d\n", M);
         }
+        else if (strcmp(args[cnt], "-sh") == 0) {
+            share = atoi(args[++cnt]); assert(share == 0 || share == 1);
+            printf("share   = %d\n", share);
+        }
+        else if (strcmp(args[cnt], "-pt") == 0) {
+            part = atoi(args[++cnt]); assert(part >= 0 && part <= 2);
+            printf("part    = %d\n", part);
+        }
+        else if (strcmp(args[cnt], "-ic") == 0) {
+            incr = atoi(args[++cnt]); assert(incr == 0 || incr == 1);
+            printf("incr    = %d\n", incr);
+        }
+        else if (strcmp(args[cnt], "-mm") == 0) {
+            use_mmap = atoi(args[++cnt]); 
+            assert(use_mmap == 0 || use_mmap == 1);
+            printf("mmap    = %d\n", use_mmap);
+        }
+        else if (strcmp(args[cnt], "-pk") == 0) {
+            use_pack = atoi(args[++cnt]); 
+            assert(use_pack == 0 || use_pack == 1);
+            printf("pack    = %d\n", use_pack);
+        }
+        else if (strcmp(args[cnt], "-lc") == 0) {
+            use_loc = atoi(args[++cnt]); 
+            assert(use_loc == 0 || use_loc == 1);
+            printf("locator = %d\n", use_loc);
+        }
+        else if (strcmp(args[cnt], "-sn") == 0) {
+            seg_size = atoi(args[++cnt]); assert(seg_size > 0);
+            printf("segment = %d\n", seg_size);
+        }
+        else if (strcmp(args[cnt], "-st") == 0) {
+            stage = atoi(args[++cnt]); assert(stage == 0 || stage == 1);
+            printf("stage   = %d\n", stage);
+        }
+        else if (strcmp(args[cnt], "-ht") == 0) {
+            n_tables = atoi(args[++cnt]); assert(n_tables > 0);
+            printf("tables  = %d\n", n_tables);
+        }
+        else if (strcmp(args[cnt], "-qc") == 0) {
+            params.c_ = (float) atof(args[++cnt]); assert(params.c_ > 1);
+            printf("qc      = %.1f\n", params.c_);
+        }
+        else if (strcmp(args[cnt], "-qb") == 0) {
+            params.budget_ = atoi(args[++cnt]); assert(params.budget_ > 0);
+            printf("qb      = %d\n", params.budget_);
+        }
+        else if (strcmp(args[cnt], "-ql") == 0) {
+            params.l_ = atoi(args[++cnt]); assert(params.l_ > 0);
+            printf("ql      = %d\n", params.l_);
+        }
+        else if (strcmp(args[cnt], "-qt") == 0) {
+            params.time_ = (float) atof(args[++cnt]); assert(params.time_ > 0);
+            printf("qt      = %.2f\n", params.time_);
+        }
+        else if (strcmp(args[cnt], "-qi") == 0) {
+            params.io_ = atoi(args[++cnt]); assert(params.io_ > 0);
+            printf("qi      = %d\n", params.io_);
+        }
+        else if (strcmp(args[cnt], "-qd") == 0) {
+            params.cand_ = atoi(args[++cnt]); assert(params.cand_ > 0);
+            printf("qd      = %d\n", params.cand_);
+        }
+        else if (strcmp(args[cnt], "-tk") == 0) {
+            tune_k = atoi(args[++cnt]); assert(tune_k > 0 && tune_k <= MAXK);
+            printf("tk      = %d\n", tune_k);
+        }
+        else if (strcmp(args[cnt], "-tr") == 0) {
+            t_recall = (float) atof(args[++cnt]); assert(t_recall > 0);
+            printf("tr      = %.2f\n", t_recall);
+        }
+        else if (strcmp(args[cnt], "-ta") == 0) {
+            t_ratio = (float) atof(args[++cnt]); assert(t_ratio >= 1);
+            printf("ta      = %.4f\n", t_ratio);
+        }
+        else if (strcmp(args[cnt], "-tt") == 0) {
+            t_time = (float) atof(args[++cnt]); assert(t_time > 0);
+            printf("tt      = %.2f\n", t_time);
+        }
+        else if (strcmp(args[cnt], "-tu") == 0) {
+            use_tune = atoi(args[++cnt]); 
+            assert(use_tune == 0 || use_tune == 1);
+            printf("tune    = %d\n", use_tune);
+        }
         else if (strcmp(args[cnt], "-p") == 0) {
             p = (float) atof(args[++cnt]); assert(p > 0 && p <= 2);
             printf("p       = %.1f\n", p);
@@ -228,6 +481,10 @@ int main(int nargs, char **args)
             printf("dfolder = %s\n", dfolder);
             create_dir(dfolder);
         }
+        else if (strcmp(args[cnt], "-rf") == 0) {
+            strncpy(rfile, args[++cnt], sizeof(rfile));
+            printf("rfile   = %s\n", rfile);
+        }
         else if (strcmp(args[cnt], "-of") == 0) {
             strncpy(ofolder, args[++cnt], sizeof(ofolder));
             int len = (int) strlen(ofolder);
@@ -241,22 +498,34 @@ int main(int nargs, char **args)
         ++cnt;
     }
     printf("\n");
+    if (LB != -1 && (LB < B || LB % B != 0)) {
+        printf("leaf node size (%d) must be a multiple of B (%d)\n", LB, B);
+        exit(1);
+    }
 
     if (strcmp(dtype, "uint8") == 0) {
-        interface<uint8_t>(alg, n, qn, d, B, leaf, L, M, p, zeta, c, prefix, 
-            dfolder, ofolder);
+        interface<uint8_t>(alg, n, qn, d, B, LB, interval, leaf, L, M, 
+            p, zeta, c, share, part, incr, use_mmap, use_pack, use_loc, 
+            seg_size, stage, n_tables, &params, use_tune, tune_k, t_recall, 
+            t_ratio, t_time, prefix, dfolder, rfile, ofolder);
     }
     else if (strcmp(dtype, "uint16") == 0) {
-        interface<uint16_t>(alg, n, qn, d, B, leaf, L, M, p, zeta, c, prefix, 
-            dfolder, ofolder);
+        interface<uint16_t>(alg, n, qn, d, B, LB, interval, leaf, L, M, 
+            p, zeta, c, share, part, incr, use_mmap, use_pack, use_loc, 
+            seg_size, stage, n_tables, &params, use_tune, tune_k, t_recall, 
+            t_ratio, t_time, prefix, dfolder, rfile, ofolder);
     }
     else if (strcmp(dtype, "int32") == 0) {
-        interface<int>(alg, n, qn, d, B, leaf, L, M, p, zeta, c, prefix, 
-            dfolder, ofolder);
+        interface<int>(alg, n, qn, d, B, LB, interval, leaf, L, M, 
+            p, zeta, c, share, part, incr, use_mmap, use_pack, use_loc, 
+            seg_size, stage, n_tables, &params, use_tune, tune_k, t_recall, 
+            t_ratio, t_time, prefix, dfolder, rfile, ofolder);
     }
     else if (strcmp(dtype, "float32") == 0) {
-        interface<float>(alg, n, qn, d, B, leaf, L, M, p, zeta, c, prefix, 
-            dfolder, ofolder);
+        interface<float>(alg, n, qn, d, B, LB, interval, leaf, L, M, 
+            p, zeta, c, share, part, incr, use_mmap, use_pack, use_loc, 
+            seg_size, stage, n_tables, &params, use_tune, tune_k, t_recall, 
+            t_ratio, t_time, prefix, dfolder, rfile, ofolder);
     }
     else {
         printf("Parameters error!\n"); usage();
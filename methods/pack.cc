@@ -0,0 +1,256 @@
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include "pack.h"
+
+namespace nns {
+
+// -----------------------------------------------------------------------------
+static bool entry_cmp(              // compare two entries by name
+    const PackEntry &a,                 // 1st entry
+    const PackEntry &b)                 // 2nd entry
+{
+    return strcmp(a.name_, b.name_) < 0;
+}
+
+// -----------------------------------------------------------------------------
+Pack::Pack()                        // default constructor
+{
+    root_[0] = '\0';
+    fd_      = -1;
+    map_     = NULL;
+    size_    = 0;
+}
+
+// -----------------------------------------------------------------------------
+Pack::~Pack()                       // destructor
+{
+    if (map_ != NULL) munmap(map_, size_);
+    if (fd_  >= 0) close(fd_);
+    entries_.clear(); entries_.shrink_to_fit();
+}
+
+// -----------------------------------------------------------------------------
+void Pack::get_pack_name(           // get file name of the pack of a folder
+    const char *root,                   // folder of index
+    char  *fname)                       // file name of pack (return)
+{
+    strcpy(fname, root);
+    int len = (int) strlen(fname);
+    if (len > 0 && fname[len-1] == '/') fname[--len] = '\0';
+    strcat(fname, ".pack");
+}
+
+// -----------------------------------------------------------------------------
+void Pack::list_files(              // list all files of a folder recursively
+    const char *root,                   // folder of index
+    const char *dir,                    // sub-folder relative to root
+    std::vector<PackEntry> &entries)    // files of folder (return)
+{
+    char path[300]; sprintf(path, "%s%s", root, dir);
+    DIR *dp = opendir(path);
+    if (!dp) return;
+
+    struct dirent *ent = NULL;
+    while ((ent = readdir(dp)) != NULL) {
+        if (ent->d_name[0] == '.') continue; // skip "." and ".."
+
+        char name[300]; sprintf(name, "%s%s", dir, ent->d_name);
+        char full[600]; sprintf(full, "%s%s", root, name);
+        struct stat st;
+        if (stat(full, &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            strcat(name, "/"); list_files(root, name, entries);
+        }
+        else if (S_ISREG(st.st_mode)) {
+            if (strlen(name) >= PACK_NAME_LEN) {
+                printf("File name %s is too long to pack\n", name); exit(1);
+            }
+            PackEntry entry; memset(&entry, 0, sizeof(PackEntry));
+            strcpy(entry.name_, name);
+            entries.push_back(entry);
+        }
+    }
+    closedir(dp);
+}
+
+// -----------------------------------------------------------------------------
+int Pack::write(                    // pack all files of a folder into one file
+    const char *root)                   // folder of index
+{
+    std::vector<PackEntry> entries;
+    list_files(root, "", entries);
+    std::sort(entries.begin(), entries.end(), entry_cmp);
+
+    char fname[200]; get_pack_name(root, fname);
+    FILE *fp = fopen(fname, "wb");
+    if (!fp) { printf("Could not create %s\n", fname); return 1; }
+
+    // -------------------------------------------------------------------------
+    //  write header (padded to PACK_ALIGN)
+    // -------------------------------------------------------------------------
+    char *zero = new char[PACK_ALIGN]; memset(zero, 0, PACK_ALIGN);
+    int magic = PACK_MAGIC, version = PACK_VERSION;
+    fwrite(&magic,   sizeof(int), 1, fp);
+    fwrite(&version, sizeof(int), 1, fp);
+    fwrite(zero, sizeof(char), PACK_ALIGN - sizeof(int)*2, fp);
+
+    // -------------------------------------------------------------------------
+    //  write sections: each file starts at a multiple of PACK_ALIGN
+    // -------------------------------------------------------------------------
+    const int size = 1 << 20;
+    char *buf = new char[size];
+    uint64_t offset = PACK_ALIGN;
+    for (PackEntry &entry : entries) {
+        char path[300]; sprintf(path, "%s%s", root, entry.name_);
+        FILE *in = fopen(path, "rb");
+        if (!in) { printf("Could not open %s\n", path); exit(1); }
+
+        entry.offset_ = offset;
+        entry.size_   = 0;
+        size_t num = 0;
+        while ((num = fread(buf, sizeof(char), size, in)) > 0) {
+            fwrite(buf, sizeof(char), num, fp);
+            entry.size_ += num;
+        }
+        fclose(in);
+
+        offset += entry.size_;
+        int pad = (int) ((PACK_ALIGN - offset % PACK_ALIGN) % PACK_ALIGN);
+        fwrite(zero, sizeof(char), pad, fp);
+        offset += pad;
+    }
+    delete[] buf;
+    delete[] zero;
+
+    // -------------------------------------------------------------------------
+    //  write directory and footer
+    // -------------------------------------------------------------------------
+    int num_entries = (int) entries.size();
+    fwrite(entries.data(), sizeof(PackEntry), num_entries, fp);
+    fwrite(&offset,      sizeof(uint64_t), 1, fp);
+    fwrite(&num_entries, sizeof(int),      1, fp);
+    fwrite(&magic,       sizeof(int),      1, fp);
+    fclose(fp);
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+int Pack::load(                     // load the pack of a folder
+    const char *root,                   // folder of index
+    bool  use_mmap)                     // map the pack into memory
+{
+    strcpy(root_, root);
+    char fname[200]; get_pack_name(root, fname);
+    fd_ = open(fname, O_RDONLY);
+    if (fd_ < 0) { printf("Could not open %s\n", fname); return 1; }
+
+    struct stat st; fstat(fd_, &st);
+    size_ = (uint64_t) st.st_size;
+
+    // -------------------------------------------------------------------------
+    //  read footer and header
+    // -------------------------------------------------------------------------
+    const int footer_size = sizeof(uint64_t) + sizeof(int)*2;
+    char footer[footer_size];
+    int  header[2] = { 0, 0 };
+    if (size_ < (uint64_t) PACK_ALIGN + footer_size ||
+        pread(fd_, footer, footer_size, size_ - footer_size) != footer_size ||
+        pread(fd_, header, sizeof(header), 0) != sizeof(header)) {
+        printf("Could not read %s\n", fname); return 1;
+    }
+    uint64_t dir_offset  = 0;
+    int      num_entries = 0;
+    int      magic       = 0;
+    memcpy(&dir_offset,  footer, sizeof(uint64_t));
+    memcpy(&num_entries, &footer[sizeof(uint64_t)], sizeof(int));
+    memcpy(&magic,       &footer[sizeof(uint64_t)+sizeof(int)], sizeof(int));
+
+    if (magic != PACK_MAGIC || header[0] != PACK_MAGIC) {
+        printf("%s is not a pack\n", fname); return 1;
+    }
+    if (header[1] > PACK_VERSION) {
+        printf("Unsupported pack version %d\n", header[1]); return 1;
+    }
+
+    // -------------------------------------------------------------------------
+    //  read directory
+    // -------------------------------------------------------------------------
+    ssize_t dir_size = (ssize_t) sizeof(PackEntry) * num_entries;
+    entries_.resize(num_entries);
+    if (pread(fd_, entries_.data(), dir_size, dir_offset) != dir_size) {
+        printf("Could not read directory of %s\n", fname); return 1;
+    }
+
+    // -------------------------------------------------------------------------
+    //  map the whole pack once (read-only and shared). the sections of b+ 
+    //  trees are read in place from this mapping.
+    // -------------------------------------------------------------------------
+    if (use_mmap) {
+        void *addr = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (addr != MAP_FAILED) map_ = (char*) addr;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+const PackEntry* Pack::find(        // find a file (NULL if not exists)
+    const char *fname)                  // file name (with prefix root_)
+{
+    int len = (int) strlen(root_);
+    if (strncmp(fname, root_, len) != 0) return NULL;
+
+    PackEntry key; strncpy(key.name_, &fname[len], PACK_NAME_LEN);
+    key.name_[PACK_NAME_LEN-1] = '\0';
+
+    std::vector<PackEntry>::iterator it = std::lower_bound(entries_.begin(),
+        entries_.end(), key, entry_cmp);
+    if (it == entries_.end() || strcmp(it->name_, key.name_) != 0) return NULL;
+    return &(*it);
+}
+
+// -----------------------------------------------------------------------------
+//  NOTE: if the pack is mapped, the returned file is a memory stream over the 
+//  mapping. otherwise, it is a duplicate of fd_ positioned at the file (no 
+//  more open of the pack). in both cases, the caller closes it by fclose().
+// -----------------------------------------------------------------------------
+FILE* Pack::open_entry(             // open a file for reading (NULL: failed)
+    const char *fname)                  // file name (with prefix root_)
+{
+    const PackEntry *entry = find(fname);
+    if (entry == NULL || entry->size_ == 0) return NULL;
+
+    if (map_ != NULL) {
+        return fmemopen(&map_[entry->offset_], entry->size_, "rb");
+    }
+    int fd = dup(fd_);
+    if (fd < 0) return NULL;
+
+    FILE *fp = fdopen(fd, "rb");
+    if (!fp) { close(fd); return NULL; }
+    fseeko(fp, (off_t) entry->offset_, SEEK_SET);
+
+    return fp;
+}
+
+// -----------------------------------------------------------------------------
+BlockFile* Pack::open_block_file(   // open a block file stored in pack
+    const char *fname)                  // file name (with prefix root_)
+{
+    const PackEntry *entry = find(fname);
+    if (entry == NULL) {
+        printf("tree file %s does not exist\n", fname); exit(1);
+    }
+
+    const char *map = map_ != NULL ? &map_[entry->offset_] : NULL;
+    return new BlockFile(fd_, entry->offset_, map);
+}
+
+} // end namespace nns
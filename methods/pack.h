@@ -0,0 +1,82 @@
+#pragma once
+
+#include <iostream>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "def.h"
+#include "block_file.h"
+
+namespace nns {
+
+// -----------------------------------------------------------------------------
+//  PackEntry: a file stored in a pack
+// -----------------------------------------------------------------------------
+struct PackEntry {
+    char     name_[PACK_NAME_LEN];  // file name relative to the packed folder
+    uint64_t offset_;               // offset of file in pack (PACK_ALIGN)
+    uint64_t size_;                 // size of file
+};
+
+// -----------------------------------------------------------------------------
+//  Pack: a single-file container of an index folder. 
+//
+//  The layout of a pack is as follows:
+//  (1) header: PACK_MAGIC and PACK_VERSION, padded to PACK_ALIGN bytes;
+//  (2) sections: the content of each file of the folder, each of which starts
+//      at a multiple of PACK_ALIGN, so that a b+ tree file stored in a pack 
+//      can be read in place from a mapping of the pack;
+//  (3) directory: one PackEntry for each file, sorted by name;
+//  (4) footer: offset of directory, number of entries, and PACK_MAGIC.
+//
+//  Loading a pack opens one file and (optionally) maps it once. All the files
+//  of the index are read from this file descriptor or this mapping.
+// -----------------------------------------------------------------------------
+class Pack {
+public:
+    char     root_[200];            // folder of index stored in this pack
+    int      fd_;                   // file descriptor of pack
+    char     *map_;                 // read-only mapping of pack (NULL: none)
+    uint64_t size_;                 // size of pack
+    std::vector<PackEntry> entries_;// directory of pack
+
+    // -------------------------------------------------------------------------
+    Pack();                         // default constructor
+    ~Pack();                        // destructor
+
+    // -------------------------------------------------------------------------
+    static int write(               // pack all files of a folder into one file
+        const char *root);              // folder of index
+
+    // -------------------------------------------------------------------------
+    int load(                       // load the pack of a folder
+        const char *root,               // folder of index
+        bool  use_mmap);                // map the pack into memory
+
+    // -------------------------------------------------------------------------
+    const PackEntry* find(          // find a file (NULL if not exists)
+        const char *fname);             // file name (with prefix root_)
+
+    // -------------------------------------------------------------------------
+    FILE* open_entry(               // open a file for reading (NULL: failed)
+        const char *fname);             // file name (with prefix root_)
+
+    // -------------------------------------------------------------------------
+    BlockFile* open_block_file(     // open a block file stored in pack
+        const char *fname);             // file name (with prefix root_)
+
+    // -------------------------------------------------------------------------
+    static void get_pack_name(      // get file name of the pack of a folder
+        const char *root,               // folder of index
+        char  *fname);                  // file name of pack (return)
+
+protected:
+    // -------------------------------------------------------------------------
+    static void list_files(         // list all files of a folder recursively
+        const char *root,               // folder of index
+        const char *dir,                // sub-folder relative to root
+        std::vector<PackEntry> &entries);// files of folder (return)
+};
+
+} // end namespace nns
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+
+#include "def.h"
+#include "random.h"
+#include "util.h"
+#include "pri_queue.h"
+#include "kd_tree.h"
+
+namespace nns {
+
+// -----------------------------------------------------------------------------
+//  Partition: interface to partition data into blocks for QALSH+. 
+//  
+//  partition() returns the block sizes and the data index in block order, 
+//  i.e., the ids of block i are index[sum(block_size[0..i-1])...].
+// -----------------------------------------------------------------------------
+template<class DType>
+class Partition {
+public:
+    Partition(                      // constructor
+        int   n,                        // number of data points
+        int   d,                        // dimensionality
+        int   leaf,                     // max number of points in a block
+        const DType *data)              // data points
+        : n_pts_(n), dim_(d), leaf_(leaf), data_(data) {}
+
+    // -------------------------------------------------------------------------
+    virtual ~Partition() {}         // destructor
+
+    // -------------------------------------------------------------------------
+    virtual void partition(         // partition data into blocks
+        std::vector<int> &block_size,   // block size (return)
+        int *index) = 0;                // data index with block order (return)
+
+protected:
+    int   n_pts_;                   // number of data points
+    int   dim_;                     // dimensionality
+    int   leaf_;                    // max number of points in a block
+    const DType *data_;             // data points
+};
+
+// -----------------------------------------------------------------------------
+//  KD_Partition: blocks are the leaves of kd-tree (sliding mid-point split)
+// -----------------------------------------------------------------------------
+template<class DType>
+class KD_Partition : public Partition<DType> {
+public:
+    KD_Partition(                   // constructor
+        int   n,                        // number of data points
+        int   d,                        // dimensionality
+        int   leaf,                     // leaf size of kd-tree
+        const DType *data)              // data points
+        : Partition<DType>(n, d, leaf, data) {}
+
+    // -------------------------------------------------------------------------
+    virtual void partition(         // partition data into blocks
+        std::vector<int> &block_size,   // block size (return)
+        int *index)                     // data index with block order (return)
+    {
+        KD_Tree<DType> *tree = new KD_Tree<DType>(this->n_pts_, this->dim_, 
+            this->leaf_, this->data_);
+        tree->traversal(block_size, index);
+        delete tree;
+    }
+};
+
+// -----------------------------------------------------------------------------
+//  Proj_Partition: binary space partition tree, which projects the points of 
+//  a node onto a direction and splits them at the median. the blocks are the 
+//  leaves of the tree, so they have balanced sizes in (leaf/2, leaf].
+// -----------------------------------------------------------------------------
+template<class DType>
+class Proj_Partition : public Partition<DType> {
+public:
+    Proj_Partition(                 // constructor
+        int   n,                        // number of data points
+        int   d,                        // dimensionality
+        int   leaf,                     // leaf size
+        const DType *data)              // data points
+        : Partition<DType>(n, d, leaf, data) {}
+
+    // -------------------------------------------------------------------------
+    virtual void partition(         // partition data into blocks
+        std::vector<int> &block_size,   // block size (return)
+        int *index)                     // data index with block order (return)
+    {
+        for (int i = 0; i < this->n_pts_; ++i) index[i] = i;
+
+        float  *proj = new float[this->dim_];
+        Result *pair = new Result[this->n_pts_];
+        rsplit(this->n_pts_, index, proj, pair, block_size);
+
+        delete[] proj;
+        delete[] pair;
+    }
+
+protected:
+    // -------------------------------------------------------------------------
+    virtual void calc_direction(    // calc split direction of a node
+        int   n,                        // number of points in this node
+        const int *index,               // data index of this node
+        float *proj) = 0;               // split direction (return)
+
+    // -------------------------------------------------------------------------
+    void rsplit(                    // recursive split
+        int   n,                        // number of points in this node
+        int   *index,                   // data index of this node (return)
+        float *proj,                    // split direction (buffer)
+        Result *pair,                   // projection of points (buffer)
+        std::vector<int> &block_size)   // block size (return)
+    {
+        if (n <= this->leaf_) { block_size.push_back(n); return; }
+
+        // project the points onto the split direction
+        int d = this->dim_;
+        calc_direction(n, (const int*) index, proj);
+        for (int i = 0; i < n; ++i) {
+            const DType *point = &this->data_[(uint64_t) index[i]*d];
+            pair[i].id_  = index[i];
+            pair[i].key_ = calc_inner_product<DType>(d, proj, point);
+        }
+        // split at the median (ties are broken by id)
+        int num_low = n / 2;
+        std::nth_element(pair, pair + num_low, pair + n, 
+            [](const Result &a, const Result &b) {
+                if (a.key_ != b.key_) return a.key_ < b.key_;
+                return a.id_ < b.id_; });
+        for (int i = 0; i < n; ++i) index[i] = pair[i].id_;
+
+        rsplit(num_low, index, proj, pair, block_size);
+        rsplit(n - num_low, &index[num_low], proj, pair, block_size);
+    }
+};
+
+// -----------------------------------------------------------------------------
+//  RP_Partition: random projection tree, which splits a node along a random 
+//  direction drawn from the Gaussian distribution
+// -----------------------------------------------------------------------------
+template<class DType>
+class RP_Partition : public Proj_Partition<DType> {
+public:
+    RP_Partition(                   // constructor
+        int   n,                        // number of data points
+        int   d,                        // dimensionality
+        int   leaf,                     // leaf size
+        const DType *data)              // data points
+        : Proj_Partition<DType>(n, d, leaf, data) {}
+
+protected:
+    // -------------------------------------------------------------------------
+    virtual void calc_direction(    // calc split direction of a node
+        int   /*n*/,                    // number of points in this node
+        const int * /*index*/,          // data index of this node
+        float *proj)                    // split direction (return)
+    {
+        for (int i = 0; i < this->dim_; ++i) proj[i] = gaussian(0.0f, 1.0f);
+    }
+};
+
+// -----------------------------------------------------------------------------
+//  KMeans_Partition: balanced k-means tree. each node is split by 2-means 
+//  trained with mini-batches (Sculley, WWW 2010), and the points are split at 
+//  the median along the direction between two centers, so that both sides 
+//  have the same size.
+// -----------------------------------------------------------------------------
+template<class DType>
+class KMeans_Partition : public Proj_Partition<DType> {
+public:
+    KMeans_Partition(               // constructor
+        int   n,                        // number of data points
+        int   d,                        // dimensionality
+        int   leaf,                     // leaf size
+        const DType *data)              // data points
+        : Proj_Partition<DType>(n, d, leaf, data) {}
+
+protected:
+    // -------------------------------------------------------------------------
+    virtual void calc_direction(    // calc split direction of a node
+        int   n,                        // number of points in this node
+        const int *index,               // data index of this node
+        float *proj)                    // split direction (return)
+    {
+        int d = this->dim_;
+        const DType *data = this->data_;
+        float *center = new float[2*d];
+        int   count[2] = { 0, 0 };
+
+        // init two centers by two random points of this node
+        int id0 = index[rand() % n];
+        int id1 = index[rand() % n];
+        for (int t = 0; t < 10 && id1 == id0; ++t) id1 = index[rand() % n];
+        for (int j = 0; j < d; ++j) {
+            center[j]   = (float) data[(uint64_t) id0*d+j];
+            center[d+j] = (float) data[(uint64_t) id1*d+j];
+        }
+
+        // mini-batch 2-means with per-center learning rate
+        int batch = MIN(n, KMEANS_BATCH);
+        int *sample = new int[batch];
+        int *label  = new int[batch];
+        for (int iter = 0; iter < KMEANS_ITER; ++iter) {
+            for (int i = 0; i < batch; ++i) {
+                sample[i] = index[rand() % n];
+                const DType *point = &data[(uint64_t) sample[i]*d];
+                float dist0 = 0.0f, dist1 = 0.0f;
+                for (int j = 0; j < d; ++j) {
+                    dist0 += SQR(center[j]   - (float) point[j]);
+                    dist1 += SQR(center[d+j] - (float) point[j]);
+                }
+                label[i] = dist0 <= dist1 ? 0 : 1;
+            }
+            for (int i = 0; i < batch; ++i) {
+                const DType *point = &data[(uint64_t) sample[i]*d];
+                float *c = &center[label[i]*d];
+                float eta = 1.0f / (++count[label[i]]);
+                for (int j = 0; j < d; ++j) {
+                    c[j] += eta * ((float) point[j] - c[j]);
+                }
+            }
+        }
+        // split direction: from center 0 to center 1
+        float norm = 0.0f;
+        for (int j = 0; j < d; ++j) {
+            proj[j] = center[d+j] - center[j];
+            norm += SQR(proj[j]);
+        }
+        // fall back to a random direction if two centers coincide
+        if (norm < FLOATZERO) {
+            for (int j = 0; j < d; ++j) proj[j] = gaussian(0.0f, 1.0f);
+        }
+        delete[] center;
+        delete[] sample;
+        delete[] label;
+    }
+};
+
+// -----------------------------------------------------------------------------
+template<class DType>
+Partition<DType>* create_partition( // create a partition method
+    int   part,                         // 0: kd-tree, 1: k-means, 2: rp-tree
+    int   n,                            // number of data points
+    int   d,                            // dimensionality
+    int   leaf,                         // max number of points in a block
+    const DType *data)                  // data points
+{
+    switch (part) {
+    case 0: return new KD_Partition<DType>(n, d, leaf, data);
+    case 1: return new KMeans_Partition<DType>(n, d, leaf, data);
+    case 2: return new RP_Partition<DType>(n, d, leaf, data);
+    default:
+        printf("Unknown partition method %d\n", part); exit(1);
+    }
+}
+
+} // end namespace nns
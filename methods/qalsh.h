@@ -1,7 +1,11 @@
 #pragma once
 
 #include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "def.h"
@@ -10,6 +14,7 @@
 #include "pri_queue.h"
 #include "b_node.h"
 #include "b_tree.h"
+#include "pack.h"
 
 namespace nns {
 
@@ -18,9 +23,65 @@ struct Page {                       // a buffer of one page for c-ANNS
     int size_;                          // size for one scan
     int key_pos_;                       // current pos of key_ in this leaf node
     int idx_pos_;                       // current pos of id_  in this leaf node
-    BLeafNode *node_;                   // leaf node (level = 0)
+    int block_;                         // leaf node in disk (-1: no node)
+    char *buf_;                         // block buffer of leaf node (owned)
+    const char *blk_;                   // block of leaf node (buf_ or mapped)
+    BLeafView node_;                    // view of leaf node (level = 0) in blk_
 };
 
+// -----------------------------------------------------------------------------
+//  the deadlines (-1: none) bound the cost of a query. when one expires, the 
+//  search stops and returns the k-NN found so far, and guarantee_ of the index
+//  is false, since the stop conditions of c-k-ANNS are not reached.
+// -----------------------------------------------------------------------------
+struct QueryParams {                // parameters of one query (-1: as built)
+    float c_      = -1.0f;              // approximation ratio
+    int   budget_ = -1;                 // max number of candidates
+    int   l_      = -1;                 // collision threshold
+    float time_   = -1.0f;              // deadline of query time (ms)
+    int   io_     = -1;                 // deadline of I/Os (pages+candidates)
+    int   cand_   = -1;                 // deadline of candidates
+};
+
+// -----------------------------------------------------------------------------
+//  the rest of the deadlines of a query which has spent <ms>, <io>, and <cand>
+//  on the indexes searched before (e.g., the blocks of QALSH+). return false 
+//  if a deadline has expired.
+// -----------------------------------------------------------------------------
+inline bool rest_deadlines(         // get the rest of deadlines of a query
+    const QueryParams &params,          // parameters of query
+    float ms,                           // query time spent (ms)
+    uint64_t io,                        // I/Os spent
+    uint64_t cand,                      // candidates spent
+    QueryParams &rest)                  // rest of parameters (return)
+{
+    rest = params;
+    if (params.time_ > 0) {
+        rest.time_ = params.time_ - ms;
+        if (rest.time_ <= 0) return false;
+    }
+    if (params.io_ > 0) {
+        if (io >= (uint64_t) params.io_) return false;
+        rest.io_ = params.io_ - (int) io;
+    }
+    if (params.cand_ > 0) {
+        if (cand >= (uint64_t) params.cand_) return false;
+        rest.cand_ = params.cand_ - (int) cand;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+inline bool has_deadlines(          // whether a query has deadlines
+    const QueryParams *params)          // parameters of query (NULL: default)
+{
+    return params != NULL && (params->time_ > 0 || params->io_ > 0 || 
+        params->cand_ > 0);
+}
+
+// -----------------------------------------------------------------------------
+template<class DType> class QALSH_Iter;
+
 // -----------------------------------------------------------------------------
 //  Query-Aware Locality-Sensitive Hashing (QALSH) is designed to deal with the 
 //  problem of c-Approximate Nearest Neighbor Search (c-ANNS). This is an 
@@ -34,6 +95,8 @@ struct Page {                       // a buffer of one page for c-ANNS
 template<class DType>
 class QALSH {
 public:
+    friend class QALSH_Iter<DType>;
+
     int   n_pts_;                   // number of data points
     int   dim_;                     // data dimension
     int   B_;                       // page size
@@ -46,10 +109,42 @@ public:
     float w_;                       // bucket width
     int   m_;                       // number of hash tables
     int   l_;                       // collision threshold
+    int   ms_;                      // number of hash tables for search
+    int   ls_;                      // collision threshold for search
+    float cq_;                      // approximation ratio of current query
+    float wq_;                      // bucket width of current query
+    int   mq_;                      // number of hash tables of current query
+    int   lq_;                      // collision threshold of current query
+    float tc_;                      // approximation ratio tuned for queries
+    float tw_;                      // bucket width tuned for tc_
+    int   tm_;                      // number of hash tables tuned for tc_
+    int   tl_;                      // collision threshold tuned for tc_
+    bool  dq_;                      // whether current query has deadlines
+    bool  expired_;                 // whether a deadline has expired
+    std::chrono::steady_clock::time_point eq_; // time deadline of query
+    uint64_t iq_;                   // I/O deadline of current query
+    uint64_t nq_;                   // candidate deadline of current query
+    bool  guarantee_;               // last query reached its stop conditions
+    int   shared_;                  // whether a_ is shared by other indexes
     float *a_;                      // query-aware lsh hash functions
     BTree **trees_;                 // B+ Trees
+    bool  mmap_;                    // map the files of b+ trees into memory
+    Pack  *pack_;                   // pack of index (NULL: separate files)
+    bool  locate_;                  // find leaves by the learned locators
     uint64_t dist_io_;              // io for computing distance
     uint64_t page_io_;              // io for scanning pages
+    uint8_t *tomb_;                 // tombstones of deleted ids (NULL: none)
+    int   tomb_n_;                  // number of ids covered by tomb_
+    int   n_dead_;                  // number of deleted ids
+    int   *purged_;                 // n_dead_ at last compaction of each tree
+    std::thread compactor_;         // worker thread of compaction
+    int   compact_ret_;             // result of the worker (-1: failed)
+    int   compact_dead_;            // n_dead_ of the tombstones it uses
+    std::vector<int> compacted_;    // trees rebuilt by the worker
+
+    Page  **lptrs_;                 // left  buffers for search (one per tree)
+    Page  **rptrs_;                 // right buffers for search (one per tree)
+    char  *index_buf_;              // block buffer of index node for search
 
     // -------------------------------------------------------------------------
     QALSH(                          // constructor (build lsh index)
@@ -61,58 +156,240 @@ public:
         float c,                        // approximation ratio
         const DType *data,              // data points
         const char *path,               // index path
-        const int *index = NULL);       // data index
+        const int *index = NULL,        // data index
+        const float *a = NULL,          // shared hash functions
+        int   LB = -1,                  // leaf node size (-1: page size)
+        int   interval = BTREE_INTERVAL, // one key for every interval ids
+        int   n_tune = -1);             // number of points to tune w, m, l
+
+    // -------------------------------------------------------------------------
+    //  merge the b+ trees of lsh indexes with the same hash functions, where 
+    //  the ids of the k-th index are shifted by the points of the indexes 
+    //  before it. the keys are re-computed from data, as the leaves only 
+    //  keep the smallest key of every interval ids.
+    // -------------------------------------------------------------------------
+    QALSH(                          // constructor (merge lsh indexes)
+        int   num,                      // number of lsh indexes
+        QALSH<DType> **lshs,            // lsh indexes
+        const DType *data,              // data points (shifted ids)
+        const char *path,               // index path
+        const int *index,               // data index
+        const float *a);                // shared hash functions
 
     // -------------------------------------------------------------------------
     QALSH(                          // constructor (load lsh index)
         const char *path,               // index path
-        const int  *index = NULL);      // data index
+        const int  *index = NULL,       // data index
+        const float *a = NULL,          // shared hash functions
+        bool  lazy = false,             // open b+ trees on first use
+        bool  use_mmap = false,         // map b+ trees into memory
+        Pack  *pack = NULL);            // read index from a pack
 
     // -------------------------------------------------------------------------
     ~QALSH();                       // destructor
 
+    // -------------------------------------------------------------------------
+    void open_trees();              // open b+ trees (if not opened)
+
+    // -------------------------------------------------------------------------
+    void close_trees();             // close b+ trees (if opened)
+
+    // -------------------------------------------------------------------------
+    inline bool trees_opened() { return trees_ != NULL; }
+
+    // -------------------------------------------------------------------------
+    inline void set_locator(bool on) { locate_ = on; } // use leaf locators
+
+    // -------------------------------------------------------------------------
+    void set_tables(                // search the first m hash tables
+        int   m);                       // number of hash tables (-1: all)
+
     // -------------------------------------------------------------------------
     void display();                 // display parameters
 
+    // -------------------------------------------------------------------------
+    void get_leaf_params(           // get leaf parameters of b+ trees
+        int   &LB,                      // leaf node size (return)
+        int   &interval);               // ids per key of leaves (return)
+
+    // -------------------------------------------------------------------------
+    void remove_files();            // remove the files of index from disk
+
+    // -------------------------------------------------------------------------
+    //  copy the files of index to a new folder (removed again on failure), 
+    //  or move them over the files of the same names in a folder, and then
+    //  the index is in this folder.
+    // -------------------------------------------------------------------------
+    int copy_files(                 // copy the files of index to a folder
+        const char *path);              // folder of the copy
+
+    int move_files(                 // move the files of index to a folder
+        const char *path);              // folder of index
+
     // -------------------------------------------------------------------------
     uint64_t get_memory_usage() {   // get estimated memory usage
         uint64_t ret = 0ULL;
         ret += sizeof(*this);
-        ret += sizeof(float)*m_*dim_;  // a_
+        if (!shared_) ret += sizeof(float)*m_*dim_; // a_
         for (int i = 0; i < m_; ++i) { // trees_
             ret += B_; // each tree only allocates B_ bytes
         }
+        if (tomb_ != NULL) ret += (tomb_n_ + 7) / 8 + sizeof(int)*m_; // tombs
         return ret;
     }
 
+    // -------------------------------------------------------------------------
+    //  insert new data points with ids n_pts_, n_pts_+1, ... into all b+ trees
+    //  by their hash values under the stored hash functions. if dfolder is 
+    //  not NULL, they are also appended to the data in new format.
+    // -------------------------------------------------------------------------
+    int insert(                     // insert new data points
+        int   n,                        // number of new data points
+        const DType *data,              // new data points
+        const char *dfolder = NULL);    // data folder (NULL: not appended)
+
+    // -------------------------------------------------------------------------
+    int check_insert();             // whether all b+ trees take new entries
+
+    // -------------------------------------------------------------------------
+    inline bool is_deleted(int id) const { // whether a point is deleted
+        return id < tomb_n_ && ((tomb_[id >> 3] >> (id & 7)) & 1);
+    }
+
+    // -------------------------------------------------------------------------
+    //  delete data points by marking their ids in the tombstones. the search 
+    //  skips them before collision counting, and they stay in the b+ trees 
+    //  until the trees are compacted. if data is given, the compaction is 
+    //  started in the background once a tree crosses the threshold, and data 
+    //  must be kept until wait_compact().
+    // -------------------------------------------------------------------------
+    int erase(                      // delete data points
+        int   n,                        // number of ids
+        const int *ids,                 // ids of deleted data points
+        const DType *data = NULL);      // data points (NULL: no compaction)
+
+    // -------------------------------------------------------------------------
+    //  rebuild each b+ tree in which the deleted entries exceed ratio * n_pts_
+    //  by bulkloading the points that are not deleted. return the number of 
+    //  rebuilt trees (-1: failed).
+    // -------------------------------------------------------------------------
+    int compact(                    // compact b+ trees
+        const DType *data,              // data points
+        float ratio = COMPACT_RATIO);   // ratio of deleted entries to compact
+
+    // -------------------------------------------------------------------------
+    //  start compact() on a worker thread. the worker rebuilds the trees from
+    //  a snapshot of the tombstones, so the search and erase() may go on 
+    //  meanwhile. wait_compact() joins it, and the rebuilt trees are used 
+    //  from then on. it returns the number of rebuilt trees (-1: failed).
+    // -------------------------------------------------------------------------
+    int start_compact(              // start compaction in the background
+        const DType *data,              // data points
+        float ratio = COMPACT_RATIO);   // ratio of deleted entries to compact
+
+    int wait_compact();             // wait for background compaction
+
+    // -------------------------------------------------------------------------
+    //  add hash tables: the hash functions of the new tables are appended to 
+    //  a_, and only their b+ trees are built. w_ and l_ are tuned for c again.
+    //  the old trees are kept, as they store the projections, which do not 
+    //  depend on c. the search may use any prefix of the tables.
+    // -------------------------------------------------------------------------
+    int extend(                     // add hash tables
+        int   m,                        // number of hash tables (-1: by c)
+        float c,                        // approximation ratio (-1: c_)
+        const DType *data);             // data points
+
     // -------------------------------------------------------------------------
     uint64_t knn(                   // k-NN search
         int   top_k,                    // top-k value
         const DType *query,             // query point
         const char *dfolder,            // data folder
-        MinK_List *list);               // k-NN results (return)
+        MinK_List *list,                // k-NN results (return)
+        const QueryParams *params = NULL); // parameters of query
 
     // -------------------------------------------------------------------------
     uint64_t knn2(                  // k-NN search (assis func for QALSH_PLUS)
         int   top_k,                    // top-k value
         const DType *query,             // query point
         const char *dfolder,            // data folder
-        MinK_List *list);               // k-NN results (return)
+        MinK_List *list,                // k-NN results (return)
+        const QueryParams *params = NULL); // parameters of query
+
+    // -------------------------------------------------------------------------
+    uint64_t knn2(                  // k-NN search with given hash values
+        int   top_k,                    // top-k value
+        const DType *query,             // query point
+        const float *q_val,             // hash values of query (>= m_)
+        const char *dfolder,            // data folder
+        MinK_List *list,                // k-NN results (return)
+        const QueryParams *params = NULL); // parameters of query
+
+    // -------------------------------------------------------------------------
+    //  range search: find the points within l_p distance R of the query. it is
+    //  one round of collision counting with a fixed radius R (bucket width 
+    //  w*R/2), which stops once the windows of all tables are out of bucket. 
+    //  each point is passed to visit(dist, id) once it is verified, and the 
+    //  search stops early if visit returns false. R must be positive.
+    // -------------------------------------------------------------------------
+    uint64_t range_search(          // range search with a visitor
+        float R,                        // radius of range
+        const DType *query,             // query point
+        const char *dfolder,            // data folder
+        const std::function<bool(float, int)> &visit, // visitor of points
+        const QueryParams *params = NULL); // parameters of query
+
+    // -------------------------------------------------------------------------
+    uint64_t range_search(          // range search (points appended to res)
+        float R,                        // radius of range
+        const DType *query,             // query point
+        const char *dfolder,            // data folder
+        std::vector<Result> &res,       // points within R (return)
+        const QueryParams *params = NULL) { // parameters of query
+        return range_search(R, query, dfolder, [&res](float dist, int id) {
+            res.push_back({ dist, id }); return true; }, params);
+    }
+
+    // -------------------------------------------------------------------------
+    static void calc_params(        // calc <w>, <m>, and <l> for n points
+        int   n,                        // number of data points
+        float p,                        // l_p distance, p \in (0,2]
+        float zeta,                     // symmetric factor of p-stable distr.
+        float c,                        // approximation ratio
+        float &w,                       // bucket width (return)
+        int   &m,                       // number of hash tables (return)
+        int   &l);                      // collision threshold (return)
+
+    // -------------------------------------------------------------------------
+    static void gen_hash_func(      // generate query-aware lsh functions
+        int   m,                        // number of hash functions
+        int   d,                        // data dimension
+        float p,                        // l_p distance, p \in (0,2]
+        float zeta,                     // symmetric factor of p-stable distr.
+        float *a);                      // hash functions (return)
 
 protected:
     // -------------------------------------------------------------------------
-    inline float calc_l0_prob(float x) { return new_levy_prob(x); }
+    static inline float calc_l0_prob(float x) { return new_levy_prob(x); }
 
-    inline float calc_l1_prob(float x) { return new_cauchy_prob(x); }
+    static inline float calc_l1_prob(float x) { return new_cauchy_prob(x); }
     
-    inline float calc_l2_prob(float x) { return new_gaussian_prob(x); }
+    static inline float calc_l2_prob(float x) { return new_gaussian_prob(x); }
 
     // -------------------------------------------------------------------------
     int write_params();             // write parameters to disk
 
     // -------------------------------------------------------------------------
     int bulkload(                   // build b+trees by bulkloading
-        const DType *data);             // data points
+        const DType *data,              // data points
+        int   leaf_blocks,              // number of pages of a leaf node
+        int   interval);                // one key for every interval ids
+
+    // -------------------------------------------------------------------------
+    int merge(                      // build b+ trees by merging lsh indexes
+        int   num,                      // number of lsh indexes
+        QALSH<DType> **lshs,            // lsh indexes
+        const DType *data);             // data points (shifted ids)
     
     // -------------------------------------------------------------------------
     inline float calc_hash_value(int tid, const DType *data) { 
@@ -127,12 +404,82 @@ protected:
     // -------------------------------------------------------------------------
     int read_params();              // read parameters from disk
 
+    // -------------------------------------------------------------------------
+    int save_params();              // (re)write parameters to disk atomically
+
+    // -------------------------------------------------------------------------
+    int update_params();            // update number of points on disk
+
+    // -------------------------------------------------------------------------
+    int read_tombs();               // read tombstones from disk (if exist)
+
+    // -------------------------------------------------------------------------
+    int write_tombs();              // write tombstones to disk
+
+    // -------------------------------------------------------------------------
+    int rebuild_trees(              // rebuild b+ trees without deleted points
+        const DType *data,              // data points
+        int   n,                        // number of points
+        int   LB,                       // leaf node size
+        int   interval,                 // ids per key of leaves
+        const std::vector<int> &tids,   // ids of trees
+        const std::vector<uint8_t> &tomb); // tombstones
+
+    // -------------------------------------------------------------------------
+    void get_filenames(             // get the names of the files of index
+        std::vector<std::string> &names); // file names (return)
+
+    // -------------------------------------------------------------------------
+    inline bool expired() {         // whether a deadline of query has expired
+        if (dq_ && !expired_) {
+            expired_ = page_io_ + dist_io_ >= iq_ || dist_io_ >= nq_ || 
+                std::chrono::steady_clock::now() >= eq_;
+        }
+        return expired_;
+    }
+
+    // -------------------------------------------------------------------------
+    int init_query_params(          // init parameters of a query
+        int   top_k,                    // top-k value
+        const QueryParams *params);     // parameters of query (NULL: default)
+
     // -------------------------------------------------------------------------
     void init_search_params(        // init parameters for k-NN search
-        const DType *query,             // query point
-        float *q_val,                   // hash values of query (return)
-        Page  **lptrs,                  // left  buffer (return)
-        Page  **rptrs);                 // right buffer (return)
+        const float *q_val);            // hash values of query
+
+    // -------------------------------------------------------------------------
+    void init_pages();              // init page buffers (if not allocated)
+
+    // -------------------------------------------------------------------------
+    void free_pages();              // release page buffers (if allocated)
+
+    // -------------------------------------------------------------------------
+    void locate_leaf(               // init page buffers by the leaf locator
+        BTree *tree,                    // b+ tree
+        float q_v,                      // hash value of query
+        Page  *&lptr,                   // left  buffer (return)
+        Page  *&rptr);                  // right buffer (return)
+
+    // -------------------------------------------------------------------------
+    void init_left_page(            // init left  buffer at a key position
+        Page  *ptr,                     // left  buffer with leaf node
+        int   pos);                     // position of key
+
+    void init_right_page(           // init right buffer at a key position
+        Page  *ptr,                     // right buffer with leaf node
+        int   pos);                     // position of key
+
+    // -------------------------------------------------------------------------
+    void read_leaf(                 // read a leaf node into a page buffer
+        BTree *tree,                    // b+ tree
+        int   block,                    // address of leaf node in disk
+        Page  *ptr);                    // page buffer (return)
+
+    // -------------------------------------------------------------------------
+    void copy_leaf(                 // copy the leaf node of a page buffer
+        BTree *tree,                    // b+ tree
+        const Page *src,                // source page buffer
+        Page  *dest);                   // destination page buffer (return)
 
     // -------------------------------------------------------------------------
     float find_radius(              // find proper radius
@@ -148,22 +495,17 @@ protected:
 
     // -------------------------------------------------------------------------
     void update_left_buffer(        // update left buffer
-        const Page *rptr,               // right buffer
-        Page *lptr);                    // left  buffer (return)
+        BTree *tree,                    // b+ tree
+        Page  *lptr);                   // left  buffer (return)
 
     void update_right_buffer(       // update right buffer
-        const Page *lptr,               // left  buffer
-        Page* rptr);                    // right buffer (return)
+        BTree *tree,                    // b+ tree
+        Page  *rptr);                   // right buffer (return)
 
     // -------------------------------------------------------------------------
     float calc_dist(                // calc projected distance
         float q_val,                    // hash value of query
         const Page *ptr);               // page buffer
-    
-    // -------------------------------------------------------------------------
-    void delete_tree_ptr(           // delete the pointers of b+trees
-        Page **lptrs,                   // left  buffer (return)
-        Page **rptrs);                  // right buffer (return)
 };
 
 // -----------------------------------------------------------------------------
@@ -177,52 +519,94 @@ QALSH<DType>::QALSH(                // constructor (build lsh index)
     float c,                            // approximation ratio
     const DType *data,                  // data points
     const char *path,                   // index path
-    const int *index)                   // data index
-    : n_pts_(n), dim_(d), B_(B), p_(p), zeta_(zeta), c_(c), index_(index)
+    const int *index,                   // data index
+    const float *a,                     // shared hash functions
+    int   LB,                           // leaf node size (-1: page size)
+    int   interval,                     // one key for every interval ids
+    int   n_tune)                       // number of points to tune w, m, l
+    : n_pts_(n), dim_(d), B_(B), p_(p), zeta_(zeta), c_(c), index_(index),
+    tc_(-1.0f), trees_(NULL), mmap_(false), pack_(NULL), locate_(false), 
+    tomb_(NULL), tomb_n_(0), n_dead_(0), purged_(NULL), compact_ret_(0), 
+    compact_dead_(0), lptrs_(NULL), rptrs_(NULL), index_buf_(NULL)
 {
     dist_io_ = 0;
     page_io_ = 0;
+    guarantee_ = true;
     strcpy(path_, path);
     create_dir(path_);
 
+    // init <w_> <m_> and <l_> (auto tuning-w)
+    if (n_tune < 0) n_tune = n_pts_;
+    calc_params(n_tune, p_, zeta_, c_, w_, m_, l_);
+    set_tables(-1);
+
+    // generate hash functions, or use the first <m_> shared hash functions
+    if (a != NULL) {
+        shared_ = 1;
+        a_ = (float*) a;
+    }
+    else {
+        shared_ = 0;
+        a_ = new float[m_*dim_];
+        gen_hash_func(m_, dim_, p_, zeta_, a_);
+    }
+
+    // write parameters to disk
+    if (write_params()) exit(1);
+
+    //  bulkloading (a leaf node takes LB / B pages)
+    if (LB < 0) LB = B_;
+    assert(LB >= B_ && LB % B_ == 0 && interval >= 1);
+    if (bulkload(data, LB / B_, interval)) exit(1);
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::calc_params(     // calc <w>, <m>, and <l> for n points
+    int   n,                            // number of data points
+    float p,                            // l_p distance, p \in (0,2]
+    float zeta,                         // symmetric factor of p-stable distr.
+    float c,                            // approximation ratio
+    float &w,                           // bucket width (return)
+    int   &m,                           // number of hash tables (return)
+    int   &l)                           // collision threshold (return)
+{
     // -------------------------------------------------------------------------
-    //  init <w_> <m_> and <l_> (auto tuning-w)
-    //  
     //  w0 ----- best w for L_{0.5} norm to minimize m (auto tuning-w)
     //  w1 ----- best w for L_{1.0} norm to minimize m (auto tuning-w)
     //  w2 ----- best w for L_{2.0} norm to minimize m (auto tuning-w)
     //  other w: use linear combination for interpolation
     // -------------------------------------------------------------------------
     float delta = 1.0f / E;
-    float beta  = (float) CANDIDATES / (float) n_pts_;
+    float beta  = (float) CANDIDATES / (float) n;
 
-    float w0 = (c_ - 1.0f) / log(sqrt(c_));
-    float w1 = 2.0f * sqrt(c_);
-    float w2 = sqrt((8.0f * SQR(c_) * log(c_)) / (SQR(c_) - 1.0f));
+    float w0 = (c - 1.0f) / log(sqrt(c));
+    float w1 = 2.0f * sqrt(c);
+    float w2 = sqrt((8.0f * SQR(c) * log(c)) / (SQR(c) - 1.0f));
     float p1 = -1.0f, p2 = -1.0f;
 
-    if (fabs(p_ - 0.5f) < FLOATZERO) {
-        w_ = w0;
-        p1 = calc_l0_prob(w_ / 2.0f);
-        p2 = calc_l0_prob(w_ / (2.0f * c_));
+    if (fabs(p - 0.5f) < FLOATZERO) {
+        w  = w0;
+        p1 = calc_l0_prob(w / 2.0f);
+        p2 = calc_l0_prob(w / (2.0f * c));
     }
-    else if (fabs(p_ - 1.0f) < FLOATZERO) {
-        w_ = w1;
-        p1 = calc_l1_prob(w_ / 2.0f);
-        p2 = calc_l1_prob(w_ / (2.0f * c_));
+    else if (fabs(p - 1.0f) < FLOATZERO) {
+        w  = w1;
+        p1 = calc_l1_prob(w / 2.0f);
+        p2 = calc_l1_prob(w / (2.0f * c));
     }
-    else if (fabs(p_ - 2.0f) < FLOATZERO) {
-        w_ = w2;
-        p1 = calc_l2_prob(w_ / 2.0f);
-        p2 = calc_l2_prob(w_ / (2.0f * c_));
+    else if (fabs(p - 2.0f) < FLOATZERO) {
+        w  = w2;
+        p1 = calc_l2_prob(w / 2.0f);
+        p2 = calc_l2_prob(w / (2.0f * c));
     }
     else {
-        if (fabs(p_-0.8f) < FLOATZERO) w_ = 2.503f;
-        else if (fabs(p_-1.2f) < FLOATZERO) w_ = 3.151f;
-        else if (fabs(p_-1.5f) < FLOATZERO) w_ = 3.465f;
-        else w_ = (w2 - w1) * p_ + (2.0f * w1 - w2);
+        if (fabs(p-0.8f) < FLOATZERO) w = 2.503f;
+        else if (fabs(p-1.2f) < FLOATZERO) w = 3.151f;
+        else if (fabs(p-1.5f) < FLOATZERO) w = 3.465f;
+        else w = (w2 - w1) * p + (2.0f * w1 - w2);
 
-        new_stable_prob(p_, zeta_, c_, 1.0f, w_, 1000000, p1, p2);
+        new_stable_prob(p, zeta, c, 1.0f, w, 1000000, p1, p2);
     }
 
     float para1 = sqrt(log(2.0f / beta));
@@ -231,23 +615,25 @@ QALSH<DType>::QALSH(                // constructor (build lsh index)
     float eta   = para1 / para2;
     float alpha = (eta * p1 + p2) / (1.0f + eta);
 
-    m_ = (int) ceil((para1 + para2) * (para1 + para2) / para3);
-    l_ = (int) ceil(alpha * m_);
+    m = (int) ceil((para1 + para2) * (para1 + para2) / para3);
+    l = (int) ceil(alpha * m);
+}
 
-    // generate hash functions
-    a_ = new float[m_*dim_];
-    for (int i = 0; i < m_*dim_; ++i) {
-        if (fabs(p_-0.5f) < FLOATZERO) a_[i] = levy(1.0f, 0.0f);
-        else if (fabs(p_-1.0f) < FLOATZERO) a_[i] = cauchy(1.0f, 0.0f);
-        else if (fabs(p_-2.0f) < FLOATZERO) a_[i] = gaussian(0.0f, 1.0f);
-        else a_[i] = p_stable(p_, zeta_, 1.0f, 0.0f);
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::gen_hash_func(   // generate query-aware lsh functions
+    int   m,                            // number of hash functions
+    int   d,                            // data dimension
+    float p,                            // l_p distance, p \in (0,2]
+    float zeta,                         // symmetric factor of p-stable distr.
+    float *a)                           // hash functions (return)
+{
+    for (int i = 0; i < m*d; ++i) {
+        if (fabs(p-0.5f) < FLOATZERO) a[i] = levy(1.0f, 0.0f);
+        else if (fabs(p-1.0f) < FLOATZERO) a[i] = cauchy(1.0f, 0.0f);
+        else if (fabs(p-2.0f) < FLOATZERO) a[i] = gaussian(0.0f, 1.0f);
+        else a[i] = p_stable(p, zeta, 1.0f, 0.0f);
     }
-
-    // write parameters to disk
-    if (write_params()) exit(1);
-
-    //  bulkloading
-    if (bulkload(data)) exit(1);
 }
 
 // -----------------------------------------------------------------------------
@@ -258,13 +644,29 @@ int QALSH<DType>::write_params()    // write parameters to disk
     FILE *fp = fopen(fname, "rb");
     if (fp) { printf("Hash Tables Already Exist\n\n"); exit(1); }
 
-    fp = fopen(fname, "wb");
+    return save_params();
+}
+
+// -----------------------------------------------------------------------------
+//  the file para starts with PARA_MAGIC and PARA_VERSION. a file without them
+//  is a legacy one, which has no shared_ and always stores a_. it is written
+//  to a temporary file and renamed, so a crash never leaves a partial para.
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::save_params()     // (re)write parameters to disk atomically
+{
+    char fname[200]; sprintf(fname, "%spara", path_);
+    char tname[200]; sprintf(tname, "%spara.tmp", path_);
+    FILE *fp = fopen(tname, "wb");
     if (!fp) {
-        printf("Could not create %s\n", fname);
+        printf("Could not create %s\n", tname);
         printf("Perhaps no such folder %s?\n", path_);
         return 1;
     }
 
+    int magic = PARA_MAGIC, version = PARA_VERSION;
+    fwrite(&magic,  sizeof(int),   1, fp);
+    fwrite(&version,sizeof(int),   1, fp);
     fwrite(&n_pts_, sizeof(int),   1, fp);
     fwrite(&dim_,   sizeof(int),   1, fp);
     fwrite(&B_,     sizeof(int),   1, fp);
@@ -274,16 +676,26 @@ int QALSH<DType>::write_params()    // write parameters to disk
     fwrite(&zeta_,  sizeof(float), 1, fp);
     fwrite(&c_,     sizeof(float), 1, fp);
     fwrite(&w_,     sizeof(float), 1, fp);
+    fwrite(&shared_,sizeof(int),   1, fp);
     
-    fwrite(a_, sizeof(float), m_*dim_, fp);
-    fclose(fp);
+    // shared hash functions are stored by the owner of them
+    if (!shared_) fwrite(a_, sizeof(float), m_*dim_, fp);
+    bool failed = ferror(fp) != 0;
+    if (fclose(fp) != 0 || failed) {
+        printf("Could not write %s\n", tname); std::remove(tname); return 1;
+    }
+    if (rename(tname, fname)) {
+        printf("Could not rename %s\n", tname); return 1;
+    }
     return 0;
 }
 
 // -----------------------------------------------------------------------------
 template<class DType>
 int QALSH<DType>::bulkload(         // build b+trees by bulkloading
-    const DType *data)                  // data set
+    const DType *data,                  // data set
+    int   leaf_blocks,                  // number of pages of a leaf node
+    int   interval)                     // one key for every interval ids
 {
     Result *table = new Result[n_pts_];
     trees_ = new BTree*[m_];
@@ -298,7 +710,7 @@ int QALSH<DType>::bulkload(         // build b+trees by bulkloading
         // use B+ tree to index the hash table
         char fname[200]; get_tree_filename(i, fname);
         trees_[i] = new BTree();
-        trees_[i]->init(B_, fname);
+        trees_[i]->init(B_, fname, leaf_blocks, interval);
 
         if (trees_[i]->bulkload(n_pts_, table)) return 1;
     }
@@ -308,59 +720,704 @@ int QALSH<DType>::bulkload(         // build b+trees by bulkloading
 
 // -----------------------------------------------------------------------------
 template<class DType>
-QALSH<DType>::~QALSH()              // destructor
+QALSH<DType>::QALSH(                // constructor (merge lsh indexes)
+    int   num,                          // number of lsh indexes
+    QALSH<DType> **lshs,                // lsh indexes
+    const DType *data,                  // data points (shifted ids)
+    const char *path,                   // index path
+    const int *index,                   // data index
+    const float *a)                     // shared hash functions
+    : index_(index), tc_(-1.0f), trees_(NULL), mmap_(false), pack_(NULL), 
+    locate_(false), tomb_(NULL), tomb_n_(0), n_dead_(0), purged_(NULL), 
+    compact_ret_(0), compact_dead_(0), lptrs_(NULL), rptrs_(NULL), 
+    index_buf_(NULL)
+{
+    dist_io_ = 0;
+    page_io_ = 0;
+    guarantee_ = true;
+    strcpy(path_, path);
+    create_dir(path_);
+
+    // the parameters are the same as the lsh indexes except n_pts_
+    const QALSH<DType> *lsh = lshs[0];
+    n_pts_ = 0; dim_ = lsh->dim_; B_ = lsh->B_; p_ = lsh->p_; 
+    zeta_  = lsh->zeta_; c_ = lsh->c_; w_ = lsh->w_; m_ = lsh->m_; l_ = lsh->l_;
+    for (int i = 0; i < num; ++i) {
+        assert(lshs[i]->a_ == a && lshs[i]->m_ == m_);
+        n_pts_ += lshs[i]->n_pts_;
+    }
+    set_tables(-1);
+    shared_ = 1;
+    a_ = (float*) a;
+
+    if (write_params()) exit(1);
+    if (merge(num, lshs, data)) exit(1);
+}
+
+// -----------------------------------------------------------------------------
+//  the leaves of a b+ tree keep one key for every interval ids, i.e., the 
+//  smallest key of them, so the keys read from the leaves are lower bounds, 
+//  and the bounds would get looser by each merge. thus, each b+ tree is 
+//  bulkloaded from the exact keys of the points, and the deleted points are 
+//  dropped. the lsh indexes are only read, so they may be searched meanwhile.
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::merge(            // build b+ trees by merging lsh indexes
+    int   num,                          // number of lsh indexes
+    QALSH<DType> **lshs,                // lsh indexes
+    const DType *data)                  // data points (shifted ids)
+{
+    // keep the leaf node size and the interval of keys of the first index
+    int LB = -1, interval = -1;
+    lshs[0]->get_leaf_params(LB, interval);
+
+    std::vector<Result> table(n_pts_);
+    for (int i = 0; i < m_; ++i) {
+        // calc hash values of the points which are not deleted
+        int n = 0, offset = 0;
+        for (int k = 0; k < num; ++k) {
+            for (int j = 0; j < lshs[k]->n_pts_; ++j) {
+                if (lshs[k]->is_deleted(j)) continue;
+                int id = offset + j;
+                table[n].id_  = id;
+                table[n].key_ = calc_hash_value(i, &data[(uint64_t) id*dim_]);
+                ++n;
+            }
+            offset += lshs[k]->n_pts_;
+        }
+        if (n == 0) { printf("No entries to merge\n"); return 1; }
+        qsort(table.data(), n, sizeof(Result), ResultComp);
+
+        // bulkload the merged entries into the i-th b+ tree
+        char fname[200]; get_tree_filename(i, fname);
+        BTree *tree = new BTree();
+        tree->init(B_, fname, LB / B_, interval);
+        int ret = tree->bulkload(n, table.data());
+        delete tree;
+        if (ret) return 1;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+QALSH<DType>::~QALSH()              // destructor
+{
+    wait_compact();
+    close_trees();
+    if (!shared_) delete[] a_;
+    delete[] tomb_;
+    delete[] purged_;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::open_trees()     // open b+ trees (if not opened)
+{
+    if (trees_ != NULL) return;
+
+    // -------------------------------------------------------------------------
+    //  each b+ tree holds one opened file. a loaded index is only searched, so
+    //  the files are opened read-only: they are never written back, and they
+    //  can live on a read-only or shared file system. the trees in a pack 
+    //  share the file descriptor and the mapping of the pack.
+    // -------------------------------------------------------------------------
+    trees_ = new BTree*[m_];
+    for (int i = 0; i < m_; ++i) {
+        char fname[200]; get_tree_filename(i, fname);
+        trees_[i] = new BTree();
+        if (pack_ != NULL) {
+            trees_[i]->init_restore(pack_->open_block_file(fname));
+        } else {
+            trees_[i]->init_restore(fname, mmap_, true);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::close_trees()    // close b+ trees (if opened)
+{
+    free_pages();
+    if (trees_ == NULL) return;
+
+    for (int i = 0; i < m_; ++i) {
+        delete trees_[i]; trees_[i] = NULL;
+    }
+    delete[] trees_; trees_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+QALSH<DType>::QALSH(                // constructor (load lsh index)
+    const char *path,                   // index path
+    const int  *index,                  // data index
+    const float *a,                     // shared hash functions
+    bool  lazy,                         // open b+ trees on first use
+    bool  use_mmap,                     // map b+ trees into memory
+    Pack  *pack)                        // read index from a pack
+    : index_(index), tc_(-1.0f), trees_(NULL), mmap_(use_mmap), pack_(pack), 
+    locate_(false), tomb_(NULL), tomb_n_(0), n_dead_(0), purged_(NULL), 
+    compact_ret_(0), compact_dead_(0), lptrs_(NULL), rptrs_(NULL), 
+    index_buf_(NULL)
+{
+    dist_io_ = 0;
+    page_io_ = 0;
+    guarantee_ = true;
+    strcpy(path_, path);
+
+    // read parameters from disk
+    if (read_params()) exit(1);
+    set_tables(-1);
+    if (shared_) {
+        if (a == NULL) { printf("No hash functions for %s\n", path_); exit(1); }
+        a_ = (float*) a;
+    }
+    if (read_tombs()) exit(1);
+
+    // init b+ trees for k-NN search
+    if (!lazy) open_trees();
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::read_params()     // read parameters from disk
+{
+    char fname[200]; sprintf(fname, "%spara", path_);
+    FILE *fp = pack_ ? pack_->open_entry(fname) : fopen(fname, "rb");
+    if (!fp) { printf("Could not open %s\n", fname); return 1; }
+
+    // a legacy para has no header, and it starts with n_pts_
+    int  magic = 0, version = 0;
+    bool ok = fread(&magic, sizeof(int), 1, fp) == 1;
+    if (ok && magic == PARA_MAGIC) {
+        ok = fread(&version, sizeof(int), 1, fp) == 1 &&
+            fread(&n_pts_, sizeof(int), 1, fp) == 1;
+        if (ok && version > PARA_VERSION) {
+            printf("Unsupported para version %d\n", version); 
+            fclose(fp); return 1;
+        }
+    }
+    else n_pts_ = magic;
+
+    ok = ok && fread(&dim_,  sizeof(int),   1, fp) == 1;
+    ok = ok && fread(&B_,    sizeof(int),   1, fp) == 1;
+    ok = ok && fread(&m_,    sizeof(int),   1, fp) == 1;
+    ok = ok && fread(&l_,    sizeof(int),   1, fp) == 1;
+    ok = ok && fread(&p_,    sizeof(float), 1, fp) == 1;
+    ok = ok && fread(&zeta_, sizeof(float), 1, fp) == 1;
+    ok = ok && fread(&c_,    sizeof(float), 1, fp) == 1;
+    ok = ok && fread(&w_,    sizeof(float), 1, fp) == 1;
+
+    shared_ = 0; // a legacy index stores its own a_
+    if (version >= 1) ok = ok && fread(&shared_, sizeof(int), 1, fp) == 1;
+    ok = ok && n_pts_ >= 0 && dim_ > 0 && m_ > 0;
+
+    a_ = NULL;
+    if (ok && !shared_) {
+        size_t size = (size_t) m_*dim_;
+        a_ = new float[size];
+        ok = fread(a_, sizeof(float), size, fp) == size;
+    }
+    fclose(fp);
+    if (!ok) { printf("Could not read %s\n", fname); return 1; }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::update_params()   // update number of points on disk
+{
+    // rewrite the whole file, which also upgrades a legacy para
+    return save_params();
+}
+
+// -----------------------------------------------------------------------------
+//  the file of tombstones stores tomb_n_, n_dead_, purged_, and one bit for 
+//  each of the tomb_n_ ids. it only exists after some points are deleted.
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::read_tombs()      // read tombstones from disk (if exist)
+{
+    char fname[200]; sprintf(fname, "%stomb", path_);
+    FILE *fp = NULL;
+    if (pack_ != NULL) {
+        if (pack_->find(fname) != NULL) fp = pack_->open_entry(fname);
+    } else {
+        fp = fopen(fname, "rb");
+    }
+    if (!fp) return 0;
+
+    bool ok = fread(&tomb_n_, sizeof(int), 1, fp) == 1 &&
+        fread(&n_dead_, sizeof(int), 1, fp) == 1;
+    ok = ok && tomb_n_ >= 0 && tomb_n_ <= n_pts_ && n_dead_ >= 0 && 
+        n_dead_ <= tomb_n_;
+    if (ok) {
+        purged_ = new int[m_];
+        ok = fread(purged_, sizeof(int), m_, fp) == (size_t) m_;
+    }
+    if (ok) {
+        int size = (tomb_n_ + 7) >> 3;
+        tomb_ = new uint8_t[size];
+        ok = fread(tomb_, sizeof(uint8_t), size, fp) == (size_t) size;
+    }
+    fclose(fp);
+    if (!ok) { printf("Could not read %s\n", fname); return 1; }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::write_tombs()     // write tombstones to disk
+{
+    // written to a temporary file and renamed, as save_params()
+    char fname[200]; sprintf(fname, "%stomb", path_);
+    char tname[200]; sprintf(tname, "%stomb.tmp", path_);
+    FILE *fp = fopen(tname, "wb");
+    if (!fp) { printf("Could not create %s\n", tname); return 1; }
+
+    fwrite(&tomb_n_, sizeof(int),     1,      fp);
+    fwrite(&n_dead_, sizeof(int),     1,      fp);
+    fwrite(purged_,  sizeof(int),     m_,     fp);
+    fwrite(tomb_,    sizeof(uint8_t), (tomb_n_ + 7) >> 3, fp);
+    bool failed = ferror(fp) != 0;
+    if (fclose(fp) != 0 || failed) {
+        printf("Could not write %s\n", tname); std::remove(tname); return 1;
+    }
+    if (rename(tname, fname)) {
+        printf("Could not rename %s\n", tname); return 1;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::erase(            // delete data points
+    int   n,                            // number of ids
+    const int *ids,                     // ids of deleted data points
+    const DType *data)                  // data points (NULL: no compaction)
+{
+    if (pack_ != NULL) { printf("Could not delete from a pack\n"); return 1; }
+
+    // all ids are checked before any of them is marked
+    for (int i = 0; i < n; ++i) {
+        if (ids[i] < 0 || ids[i] >= n_pts_) {
+            printf("Invalid id %d\n", ids[i]); return 1;
+        }
+    }
+
+    // the tombstones cover the points inserted after the last deletion
+    if (tomb_n_ < n_pts_) {
+        int old_size = (tomb_n_ + 7) >> 3;
+        int size = (n_pts_ + 7) >> 3;
+        uint8_t *tomb = new uint8_t[size]; memset(tomb, 0, size);
+        if (tomb_ != NULL) memcpy(tomb, tomb_, old_size);
+        delete[] tomb_; tomb_ = tomb; tomb_n_ = n_pts_;
+    }
+    if (purged_ == NULL) {
+        purged_ = new int[m_]; memset(purged_, 0, m_*sizeof(int));
+    }
+
+    for (int i = 0; i < n; ++i) {
+        int id = ids[i];
+        if (is_deleted(id)) continue;
+
+        tomb_[id >> 3] |= (uint8_t) (1 << (id & 7));
+        ++n_dead_;
+    }
+    if (write_tombs()) return 1;
+    if (data != NULL && start_compact(data)) return 1;
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::compact(          // compact b+ trees
+    const DType *data,                  // data points
+    float ratio)                        // ratio of deleted entries to compact
+{
+    if (start_compact(data, ratio)) return -1;
+    return wait_compact();
+}
+
+// -----------------------------------------------------------------------------
+//  the ids of deleted points are never reused, so n_dead_ only grows, and the
+//  deleted entries of tree i are (n_dead_ - purged_[i]). the worker only gets
+//  copies of the tombstones and the ids of trees, and it touches no member 
+//  except compacted_ and compact_ret_, which are read after it is joined.
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::start_compact(    // start compaction in the background
+    const DType *data,                  // data points
+    float ratio)                        // ratio of deleted entries to compact
+{
+    if (pack_ != NULL) { printf("Could not compact a pack\n"); return 1; }
+    if (wait_compact() < 0) return 1;
+
+    compact_ret_ = 0;
+    if (n_dead_ == 0 || n_dead_ >= n_pts_) return 0;
+
+    std::vector<int> tids;
+    for (int i = 0; i < m_; ++i) {
+        if (n_dead_ - purged_[i] > ratio * n_pts_) tids.push_back(i);
+    }
+    if (tids.empty()) return 0;
+
+    // keep the leaf node size and the interval of keys of the old trees
+    int LB = -1, interval = -1;
+    get_leaf_params(LB, interval);
+
+    std::vector<uint8_t> tomb(tomb_, tomb_ + ((tomb_n_ + 7) >> 3));
+    int n = n_pts_;
+    compact_dead_ = n_dead_;
+    compactor_ = std::thread([this, data, n, LB, interval, tids, tomb]() {
+        compact_ret_ = rebuild_trees(data, n, LB, interval, tids, tomb);
+    });
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+//  the opened trees are closed, so they are reopened from the rebuilt files
+//  on the next use. the trees rebuilt before a failure are also kept.
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::wait_compact()    // wait for background compaction
+{
+    if (!compactor_.joinable()) return 0;
+    compactor_.join();
+    if (compacted_.empty()) return compact_ret_;
+
+    close_trees();
+    for (int i : compacted_) purged_[i] = compact_dead_;
+    compacted_.clear();
+    if (write_tombs()) return -1;
+    return compact_ret_;
+}
+
+// -----------------------------------------------------------------------------
+//  a rebuilt tree is written to a temporary file and renamed, so it replaces 
+//  the old one only after it is complete, and the readers of the old one are
+//  not disturbed. it also has consecutive leaves and a new locator.
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::rebuild_trees(    // rebuild b+ trees without deleted points
+    const DType *data,                  // data points
+    int   n,                            // number of points
+    int   LB,                           // leaf node size
+    int   interval,                     // ids per key of leaves
+    const std::vector<int> &tids,       // ids of trees
+    const std::vector<uint8_t> &tomb)   // tombstones
+{
+    std::vector<Result> table(n);
+    for (int i : tids) {
+        // calc hash values of the points which are not deleted
+        int cnt = 0;
+        for (int j = 0; j < n; ++j) {
+            if ((tomb[j >> 3] >> (j & 7)) & 1) continue;
+            table[cnt].id_  = j;
+            table[cnt].key_ = calc_hash_value(i, &data[(uint64_t) j*dim_]);
+            ++cnt;
+        }
+        qsort(table.data(), cnt, sizeof(Result), ResultComp);
+
+        char fname[200]; get_tree_filename(i, fname);
+        char tname[200]; sprintf(tname, "%s.tmp", fname);
+        std::remove(tname);
+        BTree *tree = new BTree();
+        tree->init(B_, tname, LB / B_, interval);
+        int ret = tree->bulkload(cnt, table.data());
+        delete tree;
+        if (ret) { std::remove(tname); return -1; }
+
+        if (rename(tname, fname)) {
+            printf("Could not rename %s\n", tname); return -1;
+        }
+        compacted_.push_back(i);
+    }
+    return (int) tids.size();
+}
+
+// -----------------------------------------------------------------------------
+//  the search opens the b+ trees read-only, so they are closed and reopened 
+//  for writing, and each tree takes all new points at a time. w_, m_, and l_ 
+//  are kept, as they are tuned for the number of points at build time.
+//
+//  all trees are checked before anything is changed, and the new n_pts_ is 
+//  written before any tree refers to the new ids. thus, if a tree fails in 
+//  the middle, the ids in the trees are still < n_pts_ (the new points are 
+//  only indexed by some tables), and the search never reads out of range.
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::insert(           // insert new data points
+    int   n,                            // number of new data points
+    const DType *data,                  // new data points
+    const char *dfolder)                // data folder (NULL: not appended)
+{
+    if (check_insert()) return 1;
+    if (dfolder != NULL && append_data_new_form<DType>(n_pts_, n, dim_, B_, 
+        data, dfolder)) return 1;
+
+    int start = n_pts_;
+    n_pts_ += n;
+    if (update_params()) { n_pts_ = start; return 1; }
+
+    char fname[200];
+    for (int i = 0; i < m_; ++i) {
+        get_tree_filename(i, fname);
+        BTree *tree = new BTree();
+        tree->init_restore(fname);
+
+        for (int j = 0; j < n; ++j) {
+            float key = calc_hash_value(i, &data[(uint64_t) j*dim_]);
+            if (tree->insert(start + j, key)) {
+                printf("New points are partially indexed (table %d)\n", i);
+                delete tree; return 1;
+            }
+        }
+        delete tree;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::check_insert()    // whether all b+ trees take new entries
+{
+    if (pack_ != NULL) { printf("Could not insert into a pack\n"); return 1; }
+    wait_compact(); // the rebuilt trees do not have the new points
+
+    // the trees of old versions cannot take new entries
+    close_trees();
+    char fname[200];
+    for (int i = 0; i < m_; ++i) {
+        get_tree_filename(i, fname);
+        BTree *tree = new BTree();
+        tree->init_restore(fname);
+        int version = tree->version_;
+        delete tree;
+        if (version < 3) {
+            printf("Could not insert into b-tree of version %d\n", version);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+//  the new trees are complete before the parameters refer to them, so the 
+//  index stays valid until the parameters are written. the deleted points 
+//  are not inserted into the new trees.
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::extend(           // add hash tables
+    int   m,                            // number of hash tables (-1: by c)
+    float c,                            // approximation ratio (-1: c_)
+    const DType *data)                  // data points
+{
+    if (pack_ != NULL) { printf("Could not extend a pack\n"); return 1; }
+    if (shared_) { printf("Could not extend shared hash tables\n"); return 1; }
+    wait_compact();
+
+    // tune w and m for c, and keep the ratio of l to m for more tables. the
+    // members are only changed once all new b+ trees are on disk.
+    if (c <= 1.0f) c = c_;
+    float w = -1.0f;
+    int   m_c = -1, l_c = -1;
+    calc_params(n_pts_, p_, zeta_, c, w, m_c, l_c);
+    if (m < 0) m = m_c;
+    if (m < m_) m = m_;
+
+    // generate the hash functions of the new tables
+    int m0 = m_;
+    float *a = new float[(uint64_t) m*dim_];
+    memcpy(a, a_, sizeof(float)*m0*dim_);
+    gen_hash_func(m - m0, dim_, p_, zeta_, &a[(uint64_t) m0*dim_]);
+
+    // build the new b+ trees with the leaf parameters of the old ones
+    close_trees();
+    int LB = -1, interval = -1;
+    get_leaf_params(LB, interval);
+
+    char fname[200];
+    Result *table = new Result[n_pts_];
+    for (int i = m0; i < m; ++i) {
+        int n = 0;
+        for (int j = 0; j < n_pts_; ++j) {
+            if (is_deleted(j)) continue;
+            table[n].id_  = j;
+            table[n].key_ = calc_inner_product<DType>(dim_, 
+                &a[(uint64_t) i*dim_], &data[(uint64_t) j*dim_]);
+            ++n;
+        }
+        qsort(table, n, sizeof(Result), ResultComp);
+
+        get_tree_filename(i, fname);
+        std::remove(fname);
+        BTree *tree = new BTree();
+        tree->init(B_, fname, LB / B_, interval);
+        int ret = tree->bulkload(n, table);
+        delete tree;
+        if (ret) {
+            // drop the new trees, so the index stays as it was
+            for (int j = m0; j <= i; ++j) {
+                get_tree_filename(j, fname); std::remove(fname);
+            }
+            delete[] table; delete[] a; return 1;
+        }
+    }
+    delete[] table;
+
+    if (purged_ != NULL) {
+        int *purged = new int[m];
+        memcpy(purged, purged_, sizeof(int)*m0);
+        for (int i = m0; i < m; ++i) purged[i] = n_dead_;
+        delete[] purged_; purged_ = purged;
+    }
+    delete[] a_; a_ = a;
+    m_ = m; w_ = w; c_ = c;
+    l_ = (int) ceil((float) l_c * m_ / m_c);
+    set_tables(-1);
+
+    if (save_params()) return 1;
+    if (tomb_ != NULL && write_tombs()) return 1;
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::set_tables(      // search the first m hash tables
+    int   m)                            // number of hash tables (-1: all)
+{
+    // the collision threshold keeps its ratio to the number of tables
+    ms_ = (m <= 0 || m > m_) ? m_ : m;
+    ls_ = std::min((int) ceil((float) l_ * ms_ / m_), ms_ - 1);
+}
+
+// -----------------------------------------------------------------------------
+//  the trees store the projections, which do not depend on c, so a query may 
+//  take any c. w, m, and l are tuned for it as for a build (once for all the 
+//  queries of the same c). if it needs fewer tables than ms_, it searches the
+//  first ones only; otherwise, it searches ms_ tables with l scaled down.
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::init_query_params(// init parameters of a query
+    int   top_k,                        // top-k value
+    const QueryParams *params)          // parameters of query (NULL: default)
+{
+    cq_ = c_; wq_ = w_; mq_ = ms_; lq_ = ls_;
+    dq_ = has_deadlines(params); expired_ = false; guarantee_ = true;
+    if (dq_) {
+        // the time deadline starts before the query is projected
+        float ms = params->time_ > 0 ? params->time_ : 1e9f;
+        eq_ = std::chrono::steady_clock::now() + 
+            std::chrono::microseconds((int64_t) (ms * 1000.0f));
+        iq_ = params->io_   > 0 ? (uint64_t) params->io_   : UINT64_MAX;
+        nq_ = params->cand_ > 0 ? (uint64_t) params->cand_ : UINT64_MAX;
+    }
+    if (params == NULL) return CANDIDATES + top_k - 1;
+
+    if (params->c_ > 1.0f && fabs(params->c_ - c_) > FLOATZERO) {
+        if (fabs(params->c_ - tc_) > FLOATZERO) {
+            tc_ = params->c_;
+            calc_params(n_pts_, p_, zeta_, tc_, tw_, tm_, tl_);
+        }
+        cq_ = tc_; wq_ = tw_; mq_ = std::min(tm_, ms_);
+        lq_ = std::min((int) ceil((float) tl_ * mq_ / tm_), mq_ - 1);
+    }
+    if (params->l_ > 0) lq_ = std::min(params->l_, mq_ - 1);
+    
+    if (params->budget_ > 0) return params->budget_;
+    return CANDIDATES + top_k - 1;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::get_leaf_params( // get leaf parameters of b+ trees
+    int   &LB,                          // leaf node size (return)
+    int   &interval)                    // ids per key of leaves (return)
+{
+    // all b+ trees are built with the same parameters, so read the first one
+    char fname[200]; get_tree_filename(0, fname);
+    BTree *tree = new BTree();
+    tree->init_restore(fname, false, true);
+    LB       = tree->get_leaf_length();
+    interval = tree->interval_;
+    delete tree;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::remove_files()   // remove the files of index from disk
 {
+    wait_compact();
+    close_trees();
+    char fname[200];
     for (int i = 0; i < m_; ++i) {
-        delete trees_[i]; trees_[i] = NULL;
+        get_tree_filename(i, fname); std::remove(fname);
     }
-    delete[] trees_;
-    delete[] a_;
+    sprintf(fname, "%spara", path_); std::remove(fname);
+    sprintf(fname, "%stomb", path_); std::remove(fname);
+    rmdir(path_);
 }
 
 // -----------------------------------------------------------------------------
 template<class DType>
-QALSH<DType>::QALSH(                // constructor (load lsh index)
-    const char *path,                   // index path
-    const int  *index)                  // data index
-    : index_(index)
+void QALSH<DType>::get_filenames(   // get the names of the files of index
+    std::vector<std::string> &names)    // file names (return)
 {
-    dist_io_ = 0;
-    page_io_ = 0;
-    strcpy(path_, path);
-
-    // read parameters from disk
-    if (read_params()) exit(1);
-
-    // init b+ trees for k-NN search
-    trees_ = new BTree*[m_];
+    char fname[200];
     for (int i = 0; i < m_; ++i) {
-        char fname[200]; get_tree_filename(i, fname);
-        trees_[i] = new BTree();
-        trees_[i]->init_restore(fname);
+        sprintf(fname, "%d.qalsh", i); names.push_back(fname);
     }
+    names.push_back("para");
+    if (tomb_ != NULL) names.push_back("tomb");
 }
 
 // -----------------------------------------------------------------------------
 template<class DType>
-int QALSH<DType>::read_params()     // read parameters from disk
+int QALSH<DType>::copy_files(       // copy the files of index to a folder
+    const char *path)                   // folder of the copy
 {
-    char fname[200]; sprintf(fname, "%spara", path_);
-    FILE *fp = fopen(fname, "rb");
-    if (!fp) { printf("Could not open %s\n", fname); return 1; }
+    wait_compact();
+    close_trees();
+    std::vector<std::string> names;
+    get_filenames(names);
+
+    char src[200], dest[200];
+    strcpy(dest, path); create_dir(dest);
+    for (size_t i = 0; i < names.size(); ++i) {
+        sprintf(src,  "%s%s", path_, names[i].c_str());
+        sprintf(dest, "%s%s", path,  names[i].c_str());
+        if (copy_file(src, dest)) {
+            for (size_t j = 0; j <= i; ++j) {
+                sprintf(dest, "%s%s", path, names[j].c_str());
+                std::remove(dest);
+            }
+            rmdir(path);
+            return 1;
+        }
+    }
+    return 0;
+}
 
-    fread(&n_pts_, sizeof(int),   1, fp);
-    fread(&dim_,   sizeof(int),   1, fp);
-    fread(&B_,     sizeof(int),   1, fp);
-    fread(&m_,     sizeof(int),   1, fp);
-    fread(&l_,     sizeof(int),   1, fp);
-    fread(&p_,     sizeof(float), 1, fp);
-    fread(&zeta_,  sizeof(float), 1, fp);
-    fread(&c_,     sizeof(float), 1, fp);
-    fread(&w_,     sizeof(float), 1, fp);
-    
-    a_ = new float[m_*dim_];
-    fread(a_, sizeof(float), m_*dim_, fp);
-    fclose(fp);
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH<DType>::move_files(       // move the files of index to a folder
+    const char *path)                   // folder of index
+{
+    wait_compact();
+    close_trees();
+    std::vector<std::string> names;
+    get_filenames(names);
+
+    char src[200], dest[200];
+    for (const std::string &name : names) {
+        sprintf(src,  "%s%s", path_, name.c_str());
+        sprintf(dest, "%s%s", path,  name.c_str());
+        if (rename(src, dest)) { printf("Could not move %s\n", src); return 1; }
+    }
+    rmdir(path_);
+    strcpy(path_, path);
     return 0;
 }
 
@@ -378,6 +1435,8 @@ void QALSH<DType>::display()        // display parameters
     printf("w    = %f\n",   w_);
     printf("m    = %d\n",   m_);
     printf("l    = %d\n",   l_);
+    if (ms_ < m_) printf("ms   = %d (ls = %d)\n", ms_, ls_);
+    printf("sh   = %d\n",   shared_);
     printf("path = %s\n\n", path_);
 }
 
@@ -387,39 +1446,38 @@ uint64_t QALSH<DType>::knn(         // k-NN search
     int   top_k,                        // top-k value
     const DType *query,                 // query point
     const char *dfolder,                // data folder
-    MinK_List *list)                    // k-NN results (return)
+    MinK_List *list,                    // k-NN results (return)
+    const QueryParams *params)          // parameters of query (NULL: default)
 {
     list->reset();
 
     // initialize parameters for c-k-ANNS
+    int   candidates = init_query_params(top_k, params); // candidates size
     int  *freq    = new int[n_pts_]; memset(freq, 0, n_pts_*sizeof(float));
     bool *checked = new bool[n_pts_]; memset(checked, false, n_pts_*sizeof(bool));
-    bool *flag    = new bool[m_]; memset(flag, true, m_*sizeof(bool));
+    bool *flag    = new bool[mq_]; memset(flag, true, mq_*sizeof(bool));
     
     DType *data  = new DType[dim_];
-    float *q_val = new float[m_];
-    Page **lptrs = new Page*[m_];
-    Page **rptrs = new Page*[m_];
-    for (int i = 0; i < m_; ++i) {
-        lptrs[i] = new Page();
-        rptrs[i] = new Page();
-    }
-    init_search_params(query, q_val, lptrs, rptrs);
+    float *q_val = new float[mq_];
+    for (int i = 0; i < mq_; ++i) q_val[i] = calc_hash_value(i, query);
+    init_search_params((const float*) q_val);
+
+    Page **lptrs = lptrs_;
+    Page **rptrs = rptrs_;
 
     // c-k-ANNS via dynamic collision counting framework
-    int   candidates = CANDIDATES + top_k - 1; // candidates size
     float kdist  = MAXREAL;
     float radius = find_radius(q_val, (const Page**)lptrs, (const Page**)rptrs);
-    float bucket = w_ * radius / 2.0f;
+    float bucket = wq_ * radius / 2.0f;
 
     while (true) {
         // step 1: initialize the stop condition for current round
         int num_flag = 0;
-        memset(flag, true, m_*sizeof(bool));
+        memset(flag, true, mq_*sizeof(bool));
 
         // step 2: (R,c)-NN search (find frequent data points)
-        while (num_flag < m_) {
-            for (int i = 0; i < m_; ++i) {
+        while (num_flag < mq_) {
+            for (int i = 0; i < mq_; ++i) {
                 if (!flag[i]) continue;
 
                 // step 2.1: compute <ldist> and <rdist>
@@ -438,16 +1496,17 @@ uint64_t QALSH<DType>::knn(         // k-NN search
                     int start = end - count;
 
                     for (int j = end; j > start; --j) {
-                        int id = lptr->node_->get_entry_id(j);
-                        if (++freq[id] > l_ && !checked[id]) {
+                        int id = lptr->node_.get_entry_id(j);
+                        if (is_deleted(id)) continue;
+                        if (++freq[id] > lq_ && !checked[id]) {
                             checked[id] = true;
                             read_data_new_format<DType>(id, dim_, B_, dfolder, data);
                             dist  = calc_lp_dist<DType>(dim_, p_, kdist, data, query);
                             kdist = list->insert(dist, id);
-                            if (++dist_io_ >= candidates) break;
+                            if (++dist_io_ >= candidates || expired()) break;
                         }
                     }
-                    update_left_buffer(rptr, lptr);
+                    update_left_buffer(trees_[i], lptr);
                 }
                 else if (rdist < bucket && ldist > rdist) {
                     int count = rptr->size_;
@@ -455,36 +1514,38 @@ uint64_t QALSH<DType>::knn(         // k-NN search
                     int end   = start + count;
 
                     for (int j = start; j < end; ++j) {
-                        int id = rptr->node_->get_entry_id(j);
-                        if (++freq[id] > l_ && !checked[id]) {
+                        int id = rptr->node_.get_entry_id(j);
+                        if (is_deleted(id)) continue;
+                        if (++freq[id] > lq_ && !checked[id]) {
                             checked[id] = true;
                             read_data_new_format<DType>(id, dim_, B_, dfolder, data);
                             dist  = calc_lp_dist<DType>(dim_, p_, kdist, data, query);
                             kdist = list->insert(dist, id);
-                            if (++dist_io_ >= candidates) break;
+                            if (++dist_io_ >= candidates || expired()) break;
                         }
                     }
-                    update_right_buffer(lptr, rptr);
+                    update_right_buffer(trees_[i], rptr);
                 }
                 else {
                     flag[i] = false;
                     ++num_flag;
                 }
-                if (num_flag >= m_ || dist_io_ >= candidates) break;
+                if (num_flag >= mq_ || dist_io_ >= candidates) break;
+                if (expired()) break;
             }
-            if (num_flag >= m_ || dist_io_ >= candidates) break;
+            if (num_flag >= mq_ || dist_io_ >= candidates || expired()) break;
         }
-        // step 3: stop conditions 1 & 2
-        if (kdist < c_*radius && dist_io_ >= top_k) break;
+        // step 3: stop conditions 1 & 2 (or a deadline)
+        if (expired_) { guarantee_ = false; break; }
+        if (kdist < cq_*radius && dist_io_ >= top_k) break;
         if (dist_io_ >= candidates) break;
 
         // step 4: auto-update <radius>
         radius = update_radius(radius, q_val, (const Page**) lptrs, 
             (const Page**) rptrs);
-        bucket = radius * w_ / 2.0f;
+        bucket = radius * wq_ / 2.0f;
     }
     // release space
-    delete_tree_ptr(lptrs, rptrs);
     delete[] freq;
     delete[] checked;
     delete[] flag;
@@ -500,41 +1561,59 @@ uint64_t QALSH<DType>::knn2(        // k-NN search
     int   top_k,                        // top-k value
     const DType *query,                 // query point
     const char *dfolder,                // data folder
-    MinK_List *list)                    // k-NN results (return)
+    MinK_List *list,                    // k-NN results (return)
+    const QueryParams *params)          // parameters of query (NULL: default)
+{
+    // a query searches at most the first ms_ tables
+    float *q_val = new float[ms_];
+    for (int i = 0; i < ms_; ++i) q_val[i] = calc_hash_value(i, query);
+
+    uint64_t ret = knn2(top_k, query, (const float*) q_val, dfolder, list, 
+        params);
+    delete[] q_val;
+
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+uint64_t QALSH<DType>::knn2(        // k-NN search with given hash values
+    int   top_k,                        // top-k value
+    const DType *query,                 // query point
+    const float *q_val,                 // hash values of query (>= m_)
+    const char *dfolder,                // data folder
+    MinK_List *list,                    // k-NN results (return)
+    const QueryParams *params)          // parameters of query (NULL: default)
 {
     // initialize parameters for c-k-ANNS
+    int   candidates = init_query_params(top_k, params); // candidates size
     int  *freq = new int[n_pts_]; memset(freq, 0, n_pts_*sizeof(float));
     bool *checked = new bool[n_pts_]; memset(checked, false, n_pts_*sizeof(bool));
-    bool *bucket_flag = new bool[m_]; memset(bucket_flag, true, m_*sizeof(bool));
-    bool *range_flag = new bool[m_]; memset(range_flag, true, m_*sizeof(bool));
+    bool *bucket_flag = new bool[mq_]; memset(bucket_flag, true, mq_*sizeof(bool));
+    bool *range_flag = new bool[mq_]; memset(range_flag, true, mq_*sizeof(bool));
     
     DType *data  = new DType[dim_];
-    float *q_val = new float[m_];
-    Page **lptrs = new Page*[m_];
-    Page **rptrs = new Page*[m_];
-    for (int i = 0; i < m_; ++i) {
-        lptrs[i] = new Page();
-        rptrs[i] = new Page();
-    }
-    init_search_params(query, q_val, lptrs, rptrs);
+    init_search_params(q_val);
+
+    Page **lptrs = lptrs_;
+    Page **rptrs = rptrs_;
 
     // c-k-ANNS via dynamic collision counting framework
-    int candidates = CANDIDATES+top_k-1; // candidates size
     int num_range  = 0;                // used for search range bound
     
     float kdist  = list->max_key();
     float radius = find_radius(q_val, (const Page**)lptrs, (const Page**)rptrs);
-    float bucket = w_ * radius / 2.0f;
-    float range  = kdist > MAXREAL-1.0f ? MAXREAL : kdist*w_/2.0f;
+    float bucket = wq_ * radius / 2.0f;
+    float range  = kdist > MAXREAL-1.0f ? MAXREAL : kdist*wq_/2.0f;
 
     while (true) {
         // step 1: initialize the stop condition for current round
         int num_bucket = 0;
-        memset(bucket_flag, true, m_*sizeof(bool));
+        memset(bucket_flag, true, mq_*sizeof(bool));
 
         // step 2: (R,c)-NN search (find frequent data points)
-        while (num_bucket < m_ && num_range < m_) {
-            for (int i = 0; i < m_; ++i) {
+        while (num_bucket < mq_ && num_range < mq_) {
+            for (int i = 0; i < mq_; ++i) {
                 if (!bucket_flag[i]) continue;
 
                 // step 2.1: compute <ldist> and <rdist>
@@ -553,17 +1632,18 @@ uint64_t QALSH<DType>::knn2(        // k-NN search
                     int start = end - count;
 
                     for (int j = end; j > start; --j) {
-                        int id = lptr->node_->get_entry_id(j);
-                        if (++freq[id] > l_ && !checked[id]) {
+                        int id = lptr->node_.get_entry_id(j);
+                        if (is_deleted(id)) continue;
+                        if (++freq[id] > lq_ && !checked[id]) {
                             checked[id] = true;
                             int oid = index_[id];
                             read_data_new_format<DType>(oid, dim_, B_, dfolder, data);
                             dist  = calc_lp_dist<DType>(dim_, p_, kdist, data, query);
                             kdist = list->insert(dist, oid);
-                            if (++dist_io_ >= candidates) break;
+                            if (++dist_io_ >= candidates || expired()) break;
                         }
                     }
-                    update_left_buffer(rptr, lptr);
+                    update_left_buffer(trees_[i], lptr);
                 }
                 else if (rdist < bucket && rdist < range && ldist > rdist) {
                     int count = rptr->size_;
@@ -571,17 +1651,18 @@ uint64_t QALSH<DType>::knn2(        // k-NN search
                     int end   = start + count;
 
                     for (int j = start; j < end; ++j) {
-                        int id = rptr->node_->get_entry_id(j);
-                        if (++freq[id] > l_ && !checked[id]) {
+                        int id = rptr->node_.get_entry_id(j);
+                        if (is_deleted(id)) continue;
+                        if (++freq[id] > lq_ && !checked[id]) {
                             checked[id] = true;
                             int oid = index_[id];
                             read_data_new_format<DType>(oid, dim_, B_, dfolder, data);
                             dist  = calc_lp_dist<DType>(dim_, p_, kdist, data, query);
                             kdist = list->insert(dist, oid);
-                            if (++dist_io_ >= candidates) break;
+                            if (++dist_io_ >= candidates || expired()) break;
                         }
                     }
-                    update_right_buffer(lptr, rptr);
+                    update_right_buffer(trees_[i], rptr);
                 }
                 else {
                     bucket_flag[i] = false;
@@ -591,26 +1672,129 @@ uint64_t QALSH<DType>::knn2(        // k-NN search
                         ++num_range;
                     }
                 }
-                if (num_bucket >= m_ || num_range >= m_) break;
-                if (dist_io_ >= candidates) break;
+                if (num_bucket >= mq_ || num_range >= mq_) break;
+                if (dist_io_ >= candidates || expired()) break;
             }
-            if (num_bucket >= m_ || num_range >= m_) break;
-            if (dist_io_ >= candidates) break;
+            if (num_bucket >= mq_ || num_range >= mq_) break;
+            if (dist_io_ >= candidates || expired()) break;
         }
-        // step 3: stop conditions 1 & 2
-        if (dist_io_ >= candidates || num_range >= m_) break;
+        // step 3: stop conditions 1 & 2 (or a deadline)
+        if (expired_) { guarantee_ = false; break; }
+        if (dist_io_ >= candidates || num_range >= mq_) break;
 
         // step 4: auto-update <radius>
         radius = update_radius(radius, q_val, (const Page**) lptrs, 
             (const Page**) rptrs);
-        bucket = radius * w_ / 2.0f;
+        bucket = radius * wq_ / 2.0f;
     }
     // release space
-    delete_tree_ptr(lptrs, rptrs);
     delete[] freq;
     delete[] checked;
     delete[] bucket_flag;
     delete[] range_flag;
+    delete[] data;
+
+    return page_io_ + dist_io_;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+uint64_t QALSH<DType>::range_search(// range search with a visitor
+    float R,                            // radius of range
+    const DType *query,                 // query point
+    const char *dfolder,                // data folder
+    const std::function<bool(float, int)> &visit, // visitor of points
+    const QueryParams *params)          // parameters of query (NULL: default)
+{
+    if (R <= 0.0f) { printf("Invalid radius %f\n", R); return 0; }
+
+    // there is no top-k, so the candidates are not bounded unless given
+    int candidates = n_pts_;
+    init_query_params(1, params);
+    if (params != NULL && params->budget_ > 0) candidates = params->budget_;
+
+    int  *freq    = new int[n_pts_]; memset(freq, 0, n_pts_*sizeof(int));
+    bool *checked = new bool[n_pts_]; memset(checked, false, n_pts_*sizeof(bool));
+    bool *flag    = new bool[mq_]; memset(flag, true, mq_*sizeof(bool));
+    
+    DType *data  = new DType[dim_];
+    float *q_val = new float[mq_];
+    for (int i = 0; i < mq_; ++i) q_val[i] = calc_hash_value(i, query);
+    init_search_params((const float*) q_val);
+
+    Page **lptrs = lptrs_;
+    Page **rptrs = rptrs_;
+
+    // (R,c)-NN search with the fixed radius R
+    float bucket = wq_ * R / 2.0f;
+    int  num_flag = 0;
+    bool stop = false; // whether visit asks to stop
+    while (num_flag < mq_) {
+        for (int i = 0; i < mq_; ++i) {
+            if (!flag[i]) continue;
+
+            Page *lptr = lptrs[i];
+            Page *rptr = rptrs[i];
+
+            float dist, ldist = MAXREAL, rdist = MAXREAL;
+            if (lptr->size_ != -1) ldist = calc_dist(q_val[i], lptr);
+            if (rptr->size_ != -1) rdist = calc_dist(q_val[i], rptr);
+
+            // scan the closer direction, and verify the frequent points
+            if (ldist < bucket && ldist <= rdist) {
+                int count = lptr->size_;
+                int end   = lptr->idx_pos_;
+                int start = end - count;
+
+                for (int j = end; j > start; --j) {
+                    int id = lptr->node_.get_entry_id(j);
+                    if (is_deleted(id)) continue;
+                    if (++freq[id] > lq_ && !checked[id]) {
+                        checked[id] = true;
+                        read_data_new_format<DType>(id, dim_, B_, dfolder, data);
+                        dist = calc_lp_dist<DType>(dim_, p_, R, data, query);
+                        if (dist <= R && !visit(dist, id)) stop = true;
+                        ++dist_io_;
+                        if (stop || dist_io_ >= candidates || expired()) break;
+                    }
+                }
+                update_left_buffer(trees_[i], lptr);
+            }
+            else if (rdist < bucket && ldist > rdist) {
+                int count = rptr->size_;
+                int start = rptr->idx_pos_;
+                int end   = start + count;
+
+                for (int j = start; j < end; ++j) {
+                    int id = rptr->node_.get_entry_id(j);
+                    if (is_deleted(id)) continue;
+                    if (++freq[id] > lq_ && !checked[id]) {
+                        checked[id] = true;
+                        read_data_new_format<DType>(id, dim_, B_, dfolder, data);
+                        dist = calc_lp_dist<DType>(dim_, p_, R, data, query);
+                        if (dist <= R && !visit(dist, id)) stop = true;
+                        ++dist_io_;
+                        if (stop || dist_io_ >= candidates || expired()) break;
+                    }
+                }
+                update_right_buffer(trees_[i], rptr);
+            }
+            else {
+                // the window of this table is out of the bucket
+                flag[i] = false;
+                ++num_flag;
+            }
+            if (stop || num_flag >= mq_ || dist_io_ >= candidates) break;
+            if (expired()) break;
+        }
+        if (stop || dist_io_ >= candidates || expired()) break;
+    }
+    if (expired_) guarantee_ = false;
+
+    // release space
+    delete[] freq;
+    delete[] checked;
+    delete[] flag;
     delete[] q_val;
     delete[] data;
 
@@ -620,48 +1804,49 @@ uint64_t QALSH<DType>::knn2(        // k-NN search
 // -----------------------------------------------------------------------------
 template<class DType>
 void QALSH<DType>::init_search_params(// init parameters for k-NN search
-    const DType *query,                 // query point
-    float *q_val,                       // hash values of query (return)
-    Page  **lptrs,                      // left buffer (return)
-    Page  **rptrs)                      // right buffer (return)
+    const float *q_val)                 // hash values of query
 {
     page_io_ = 0;
     dist_io_ = 0;
-
-    for (int i = 0; i < m_; ++i) {
-        lptrs[i]->node_    = NULL;
-        lptrs[i]->key_pos_ = -1;
-        lptrs[i]->idx_pos_ = -1;
-        lptrs[i]->size_    = -1;
-
-        rptrs[i]->node_    = NULL;
-        rptrs[i]->key_pos_ = -1;
-        rptrs[i]->idx_pos_ = -1;
-        rptrs[i]->size_    = -1;
+    open_trees();
+    init_pages();
+
+    for (int i = 0; i < mq_; ++i) {
+        lptrs_[i]->block_   = -1;
+        lptrs_[i]->key_pos_ = -1;
+        lptrs_[i]->idx_pos_ = -1;
+        lptrs_[i]->size_    = -1;
+
+        rptrs_[i]->block_   = -1;
+        rptrs_[i]->key_pos_ = -1;
+        rptrs_[i]->idx_pos_ = -1;
+        rptrs_[i]->size_    = -1;
     }
 
-    BIndexNode *index_node = NULL;
+    BIndexView index_node;
     int  block       = -1; // variables for index node
     int  follow      = -1;
     bool lescape     = false;
     int  pos         = -1; // variables for leaf node
-    int  increment   = -1;
-    int  num_entries = -1;
 
-    for (int i = 0; i < m_; ++i) {
-        float q_v = calc_hash_value(i, query);
+    for (int i = 0; i < mq_; ++i) {
+        float q_v = q_val[i];
         BTree *tree = trees_[i];
-        Page  *lptr = lptrs[i];
-        Page  *rptr = rptrs[i];
+        Page  *lptr = lptrs_[i];
+        Page  *rptr = rptrs_[i];
+
+        if (locate_ && tree->loc_.first_leaf_ >= 0) {
+            // find the leaf node by the learned locator (no index node)
+            locate_leaf(tree, q_v, lptrs_[i], rptrs_[i]);
+            continue;
+        }
 
-        q_val[i] = q_v;
         block = tree->root_;
         if (block > 1) {
             // -----------------------------------------------------------------
             //  at least two levels in the B+ Tree: index node and lead node
             // -----------------------------------------------------------------
-            index_node = new BIndexNode();
-            index_node->init_restore(tree, block);
+            index_node.set(tree->file_->fetch_block(block, index_buf_));
             ++page_io_;
 
             // -----------------------------------------------------------------
@@ -669,8 +1854,8 @@ void QALSH<DType>::init_search_params(// init parameters for k-NN search
             //  key of query q
             // -----------------------------------------------------------------
             lescape = false;        // locate the position of branch
-            while (index_node->get_level() > 1) {
-                follow = index_node->find_position_by_key(q_v);
+            while (index_node.get_level() > 1) {
+                follow = index_node.find_position_by_key(q_v);
 
                 if (follow == -1) { // scan the most left branch
                     if (lescape) { 
@@ -683,11 +1868,8 @@ void QALSH<DType>::init_search_params(// init parameters for k-NN search
                         }
                     }
                 }
-                block = index_node->get_son(follow);
-                delete index_node; index_node = NULL;
-
-                index_node = new BIndexNode();
-                index_node->init_restore(tree, block);
+                block = index_node.get_son(follow);
+                index_node.set(tree->file_->fetch_block(block, index_buf_));
                 ++page_io_; // access a new node (a new page)
             }
 
@@ -698,7 +1880,7 @@ void QALSH<DType>::init_search_params(// init parameters for k-NN search
             //  <lescape> = true is that the query has no <lptrs>, the query is 
             //  the smallest value.
             // -----------------------------------------------------------------
-            follow = index_node->find_position_by_key(q_v);
+            follow = index_node.find_position_by_key(q_v);
             if (follow < 0) {
                 lescape = true; follow = 0;
             }
@@ -707,71 +1889,33 @@ void QALSH<DType>::init_search_params(// init parameters for k-NN search
                 // -------------------------------------------------------------
                 //  only init right buffer
                 // -------------------------------------------------------------
-                block = index_node->get_son(0);
-                rptr->node_ = new BLeafNode();
-                rptr->node_->init_restore(tree, block);
-                rptr->key_pos_ = 0;
-                rptr->idx_pos_ = 0;
-
-                increment = rptr->node_->get_increment();
-                num_entries = rptr->node_->get_num_entries();
-                if (increment > num_entries) rptr->size_ = num_entries;
-                else rptr->size_ = increment;
-
-                ++page_io_;
+                block = index_node.get_son(0);
+                read_leaf(tree, block, rptr);
+                init_right_page(rptr, 0);
             }
             else {                    
                 // -------------------------------------------------------------
                 //  init left buffer
                 // -------------------------------------------------------------
-                block = index_node->get_son(follow);
-                lptr->node_ = new BLeafNode();
-                lptr->node_->init_restore(tree, block);
+                block = index_node.get_son(follow);
+                read_leaf(tree, block, lptr);
 
-                pos = lptr->node_->find_position_by_key(q_v);
+                pos = lptr->node_.find_position_by_key(q_v);
                 if (pos < 0) pos = 0;
-                lptr->key_pos_ = pos;
-
-                increment = lptr->node_->get_increment();
-                if (pos == lptr->node_->get_num_keys()-1) {
-                    num_entries = lptr->node_->get_num_entries();
-
-                    lptr->idx_pos_ = num_entries - 1;
-                    lptr->size_ = num_entries - pos*increment;
-                }
-                else {
-                    lptr->idx_pos_ = pos*increment + increment - 1;
-                    lptr->size_ = increment;
-                }
-                ++page_io_;
+                init_left_page(lptr, pos);
 
                 // -------------------------------------------------------------
                 //  init right buffer
                 // -------------------------------------------------------------
-                if (pos < lptr->node_->get_num_keys() - 1) {
-                    rptr->node_    = lptr->node_;
-                    rptr->key_pos_ = pos + 1;
-                    rptr->idx_pos_ = (pos+1) * increment;
-
-                    if ((pos+1) == rptr->node_->get_num_keys()-1) {
-                        num_entries = rptr->node_->get_num_entries();
-                        rptr->size_ = num_entries - (pos+1)*increment;
-                    } else {
-                        rptr->size_ = increment;
-                    }
+                if (pos < lptr->node_.get_num_keys() - 1) {
+                    copy_leaf(tree, lptr, rptr);
+                    init_right_page(rptr, pos + 1);
                 }
                 else {
-                    rptr->node_ = lptr->node_->get_right_sibling();
-                    if (rptr->node_) {
-                        rptr->key_pos_ = 0;
-                        rptr->idx_pos_ = 0;
-
-                        increment = rptr->node_->get_increment();
-                        num_entries = rptr->node_->get_num_entries();
-                        if (increment > num_entries) rptr->size_ = num_entries;
-                        else rptr->size_ = increment;
-                        
-                        ++page_io_;
+                    block = lptr->node_.get_right_sibling();
+                    if (block != -1) {
+                        read_leaf(tree, block, rptr);
+                        init_right_page(rptr, 0);
                     }
                 }
             }
@@ -781,52 +1925,200 @@ void QALSH<DType>::init_search_params(// init parameters for k-NN search
             //  only one level in the B+ Tree: one lead node
             //  (1) init left buffer
             // -----------------------------------------------------------------
-            lptr->node_ = new BLeafNode();
-            lptr->node_->init_restore(tree, block);
+            read_leaf(tree, block, lptr);
 
-            pos = lptr->node_->find_position_by_key(q_v);
+            pos = lptr->node_.find_position_by_key(q_v);
             if (pos < 0) pos = 0;
-            lptr->key_pos_ = pos;
-
-            increment = lptr->node_->get_increment();
-            if (pos == lptr->node_->get_num_keys() - 1) {
-                num_entries = lptr->node_->get_num_entries();
-
-                lptr->idx_pos_ = num_entries - 1;
-                lptr->size_ = num_entries - pos*increment;
-            }
-            else {
-                lptr->idx_pos_ = pos*increment + increment - 1;
-                lptr->size_ = increment;
-            }
-            ++page_io_;
+            init_left_page(lptr, pos);
             
             // -----------------------------------------------------------------
             //  (2) init right buffer
             // -----------------------------------------------------------------
-            if (pos < lptr->node_->get_num_keys() - 1) {
-                rptr->node_    = lptr->node_;
-                rptr->key_pos_ = pos + 1;
-                rptr->idx_pos_ = (pos+1) * increment;
-
-                if ((pos+1) == rptr->node_->get_num_keys()-1) {
-                    num_entries = rptr->node_->get_num_entries();
-                    rptr->size_ = num_entries - (pos+1)*increment;
-                } else {
-                    rptr->size_ = increment;
-                }
+            if (pos < lptr->node_.get_num_keys() - 1) {
+                copy_leaf(tree, lptr, rptr);
+                init_right_page(rptr, pos + 1);
             }
             else {
-                rptr->node_    = NULL;
+                rptr->block_   = -1;
                 rptr->key_pos_ = -1;
                 rptr->idx_pos_ = -1;
                 rptr->size_    = -1;
             }
         }
-        if (index_node != NULL) { delete index_node; index_node = NULL; }
     }
 }
 
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::init_pages()     // init page buffers (if not allocated)
+{
+    if (lptrs_ != NULL) return;
+
+    // -------------------------------------------------------------------------
+    //  each page owns a buffer of one leaf node, which is reused by all 
+    //  queries. the left and right pages never share a buffer: if both of them
+    //  are in the same leaf node, the node is copied. if the b+ trees are 
+    //  mapped into memory, the pages point to the mapping and the buffers are
+    //  not used.
+    // -------------------------------------------------------------------------
+    lptrs_ = new Page*[m_];
+    rptrs_ = new Page*[m_];
+    for (int i = 0; i < m_; ++i) {
+        int leaf_length = trees_[i]->get_leaf_length();
+        lptrs_[i] = new Page(); lptrs_[i]->buf_ = new char[leaf_length];
+        rptrs_[i] = new Page(); rptrs_[i]->buf_ = new char[leaf_length];
+        lptrs_[i]->block_ = rptrs_[i]->block_ = -1;
+    }
+    index_buf_ = new char[B_];
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::free_pages()     // release page buffers (if allocated)
+{
+    if (lptrs_ == NULL) return;
+
+    for (int i = 0; i < m_; ++i) {
+        delete[] lptrs_[i]->buf_; delete lptrs_[i];
+        delete[] rptrs_[i]->buf_; delete rptrs_[i];
+    }
+    delete[] lptrs_;    lptrs_     = NULL;
+    delete[] rptrs_;    rptrs_     = NULL;
+    delete[] index_buf_; index_buf_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+//  the locator predicts the position of the leaf node whose first key is the 
+//  last one <= q_v, which is the leaf found by the index nodes. the error of 
+//  prediction is bounded by [lo, hi]. the leaf is verified by its own first 
+//  key (move left) and the first key of its right sibling (move right), where
+//  the right sibling is needed as the right buffer in that case anyway.
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::locate_leaf(     // init page buffers by the leaf locator
+    BTree *tree,                        // b+ tree
+    float q_v,                          // hash value of query
+    Page  *&lptr,                       // left  buffer (return)
+    Page  *&rptr)                       // right buffer (return)
+{
+    const BLocator &loc = tree->loc_;
+    int lo = -1, hi = -1;
+    int leaf = loc.predict(q_v, lo, hi);
+
+    if (leaf < 0 && loc.num_leaves_ > 1) {
+        // q_v is smaller than all keys, only init right buffer
+        read_leaf(tree, tree->get_leaf_block(0), rptr);
+        init_right_page(rptr, 0);
+        return;
+    }
+    else if (leaf < 0) {
+        // the root is the only leaf, which is scanned from the 1st key
+        leaf = lo = hi = 0;
+    }
+
+    // -------------------------------------------------------------------------
+    //  init left buffer
+    // -------------------------------------------------------------------------
+    read_leaf(tree, tree->get_leaf_block(leaf), lptr);
+    while (leaf > lo && q_v < lptr->node_.get_key(0)) {
+        --leaf; read_leaf(tree, tree->get_leaf_block(leaf), lptr);
+    }
+    int  pos  = lptr->node_.find_position_by_key(q_v);
+    bool next = false;              // rptr holds the right sibling of lptr
+    while (pos == lptr->node_.get_num_keys()-1 && leaf < hi) {
+        read_leaf(tree, tree->get_leaf_block(leaf + 1), rptr);
+        if (rptr->node_.get_key(0) > q_v) { next = true; break; }
+
+        std::swap(lptr, rptr); ++leaf;
+        pos = lptr->node_.find_position_by_key(q_v);
+    }
+    if (pos < 0) pos = 0;
+    init_left_page(lptr, pos);
+
+    // -------------------------------------------------------------------------
+    //  init right buffer
+    // -------------------------------------------------------------------------
+    if (pos < lptr->node_.get_num_keys() - 1) {
+        copy_leaf(tree, lptr, rptr);
+        init_right_page(rptr, pos + 1);
+    }
+    else if (next) {
+        init_right_page(rptr, 0);
+    }
+    else {
+        int block = lptr->node_.get_right_sibling();
+        if (block != -1) {
+            read_leaf(tree, block, rptr);
+            init_right_page(rptr, 0);
+        } else {
+            rptr->block_   = -1;
+            rptr->key_pos_ = -1;
+            rptr->idx_pos_ = -1;
+            rptr->size_    = -1;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::init_left_page(  // init left  buffer at a key position
+    Page  *ptr,                         // left  buffer with leaf node
+    int   pos)                          // position of key
+{
+    int start = ptr->node_.get_start(pos);
+    int end   = ptr->node_.get_start(pos + 1);
+    ptr->key_pos_ = pos;
+    ptr->idx_pos_ = end - 1;        // scan the group from right to left
+    ptr->size_    = end - start;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::init_right_page( // init right buffer at a key position
+    Page  *ptr,                         // right buffer with leaf node
+    int   pos)                          // position of key
+{
+    int start = ptr->node_.get_start(pos);
+    int end   = ptr->node_.get_start(pos + 1);
+    ptr->key_pos_ = pos;
+    ptr->idx_pos_ = start;          // scan the group from left to right
+    ptr->size_    = end - start;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::read_leaf(       // read a leaf node into a page buffer
+    BTree *tree,                        // b+ tree
+    int   block,                        // address of leaf node in disk
+    Page  *ptr)                         // page buffer (return)
+{
+    ptr->blk_   = tree->file_->fetch_block(block, ptr->buf_, 
+        tree->leaf_blocks_);
+    ptr->block_ = block;
+    ptr->node_.set(ptr->blk_, tree->version_, tree->interval_, 
+        tree->leaf_keys_);
+    page_io_ += tree->leaf_blocks_; // count pages of size B_
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH<DType>::copy_leaf(       // copy the leaf node of a page buffer
+    BTree *tree,                        // b+ tree
+    const Page *src,                    // source page buffer
+    Page  *dest)                        // destination page buffer (return)
+{
+    // a mapped block is read-only, so it can be shared without copy
+    if (src->blk_ == src->buf_) {
+        memcpy(dest->buf_, src->buf_, tree->get_leaf_length());
+        dest->blk_ = dest->buf_;
+    } else {
+        dest->blk_ = src->blk_;
+    }
+    dest->block_ = src->block_;
+    dest->node_.set(dest->blk_, tree->version_, tree->interval_, 
+        tree->leaf_keys_);
+}
+
 // -----------------------------------------------------------------------------
 template<class DType>
 float QALSH<DType>::find_radius(    // find proper radius
@@ -834,7 +2126,7 @@ float QALSH<DType>::find_radius(    // find proper radius
     const Page **lptrs,                 // left buffer
     const Page **rptrs)                 // right buffer
 {
-    float radius = update_radius(1.0f / c_, q_val, lptrs, rptrs);
+    float radius = update_radius(1.0f / cq_, q_val, lptrs, rptrs);
     if (radius < 1.0f) radius = 1.0f;
 
     return radius;
@@ -850,7 +2142,7 @@ float QALSH<DType>::update_radius(  // update radius
 {
     // calc the projected distance which is closest to q among m hash tables 
     std::vector<float> list;
-    for (int i = 0; i < m_; ++i) {
+    for (int i = 0; i < mq_; ++i) {
         if (lptrs[i]->size_ != -1) list.push_back(calc_dist(q_val[i], lptrs[i]));
         if (rptrs[i]->size_ != -1) list.push_back(calc_dist(q_val[i], rptrs[i]));
     }
@@ -858,112 +2150,63 @@ float QALSH<DType>::update_radius(  // update radius
 
     // find the median distance and return the new radius
     int num = (int) list.size();
-    if (num == 0) return c_ * old_radius;
+    if (num == 0) return cq_ * old_radius;
 
     float dist = -1.0f;
     if (num % 2 == 0) dist = (list[num/2-1] + list[num/2]) / 2.0f;
     else dist = list[num / 2];
     
-    int kappa = (int) ceil(log(2.0f*dist/w_) / log(c_));
+    int kappa = (int) ceil(log(2.0f*dist/wq_) / log(cq_));
     list.clear(); list.shrink_to_fit();
 
-    return pow(c_, kappa);
+    return pow(cq_, kappa);
 }
 
 // -----------------------------------------------------------------------------
 template<class DType>
 void QALSH<DType>::update_left_buffer(// update left buffer
-    const Page *rptr,                   // right buffer
-    Page *lptr)                         // left buffer (return)
+    BTree *tree,                        // b+ tree
+    Page  *lptr)                        // left buffer (return)
 {
-    BLeafNode *leaf_node = NULL;
-    BLeafNode *old_leaf_node = NULL;
-
     if (lptr->key_pos_ > 0) {
-        lptr->key_pos_--;
-
-        int pos        = lptr->key_pos_;
-        int increment  = lptr->node_->get_increment();
-        lptr->idx_pos_ = pos*increment + increment - 1;
-        lptr->size_    = increment;
+        init_left_page(lptr, lptr->key_pos_ - 1);
     }
     else {
-        old_leaf_node = lptr->node_;
-        leaf_node = lptr->node_->get_left_sibling();
-
-        if (leaf_node) {
-            lptr->node_     = leaf_node;
-            lptr->key_pos_  = lptr->node_->get_num_keys() - 1;
-
-            int pos         = lptr->key_pos_;
-            int increment   = lptr->node_->get_increment();
-            int num_entries = lptr->node_->get_num_entries();
-            lptr->idx_pos_  = num_entries - 1;
-            lptr->size_     = num_entries - pos*increment;
-            ++page_io_;
+        int block = lptr->node_.get_left_sibling();
+        if (block != -1) {
+            read_leaf(tree, block, lptr);
+            init_left_page(lptr, lptr->node_.get_num_keys() - 1);
         }
         else {
-            lptr->node_    = NULL;
+            lptr->block_   = -1;
             lptr->key_pos_ = -1;
             lptr->idx_pos_ = -1;
             lptr->size_    = -1;
         }
-
-        if (rptr->node_ != old_leaf_node) {
-            delete old_leaf_node; old_leaf_node = NULL;
-        }
     }
 }
 
 // -----------------------------------------------------------------------------
 template<class DType>
 void QALSH<DType>::update_right_buffer(// update right buffer
-    const Page *lptr,                   // left buffer
-    Page *rptr)                         // right buffer (return)
+    BTree *tree,                        // b+ tree
+    Page  *rptr)                        // right buffer (return)
 {
-    BLeafNode *leaf_node = NULL;
-    BLeafNode *old_leaf_node = NULL;
-
-    if (rptr->key_pos_ < rptr->node_->get_num_keys()-1) {
-        rptr->key_pos_++;
-
-        int pos       = rptr->key_pos_;
-        int increment = rptr->node_->get_increment();
-        
-        rptr->idx_pos_ = pos * increment;
-        if (pos == rptr->node_->get_num_keys()-1) {
-            int num_entries = rptr->node_->get_num_entries();
-            rptr->size_ = num_entries - pos*increment;
-        } else {
-            rptr->size_ = increment;
-        }
+    if (rptr->key_pos_ < rptr->node_.get_num_keys()-1) {
+        init_right_page(rptr, rptr->key_pos_ + 1);
     }
     else {
-        old_leaf_node = rptr->node_;
-        leaf_node = rptr->node_->get_right_sibling();
-
-        if (leaf_node) {
-            rptr->node_    = leaf_node;
-            rptr->key_pos_ = 0;
-            rptr->idx_pos_ = 0;
-
-            int increment   = rptr->node_->get_increment();
-            int num_entries = rptr->node_->get_num_entries();
-            if (increment > num_entries) rptr->size_ = num_entries;
-            else rptr->size_ = increment;
-
-            ++page_io_;
+        int block = rptr->node_.get_right_sibling();
+        if (block != -1) {
+            read_leaf(tree, block, rptr);
+            init_right_page(rptr, 0);
         }
         else {
-            rptr->node_    = NULL;
+            rptr->block_   = -1;
             rptr->key_pos_ = -1;
             rptr->idx_pos_ = -1;
             rptr->size_    = -1;
         }
-
-        if (lptr->node_ != old_leaf_node) {
-            delete old_leaf_node; old_leaf_node = NULL;
-        }
     }
 }
 
@@ -974,37 +2217,247 @@ inline float QALSH<DType>::calc_dist(// calc projected distance
     const Page *ptr)                    // page buffer
 {
     int   pos = ptr->key_pos_;
-    float key = ptr->node_->get_key(pos);
+    float key = ptr->node_.get_key(pos);
 
     return fabs(key - q_val);
 }
 
+// -----------------------------------------------------------------------------
+//  QALSH_Iter: the incremental k-NN search of QALSH, which returns the nearest
+//  neighbors one by one. it keeps the state of dynamic collision counting 
+//  (the collision numbers, the page buffers, and the radius), so each call of
+//  next() resumes the search where the last one stopped and expands the 
+//  radius only on demand. thus, fetching more neighbors does not repeat the 
+//  I/O of the ones returned before.
+//
+//  the j-th neighbor is returned under the stop conditions of knn() with 
+//  top_k = j: a verified point within c*radius at the end of a round, or the 
+//  budget of candidates. a point verified later may be closer than one which 
+//  is returned before, so the neighbors are not strictly in ascending order.
+//
+//  NOTE: the iterator uses the page buffers of the index, so the index must
+//  not run other queries until the iterator is released.
+// -----------------------------------------------------------------------------
+template<class DType>
+class QALSH_Iter {
+public:
+    QALSH_Iter(                     // constructor (start a query)
+        QALSH<DType> *lsh,              // qalsh index
+        const DType *query,             // query point
+        const char *dfolder,            // data folder
+        const QueryParams *params = NULL); // parameters of query
+
+    // -------------------------------------------------------------------------
+    ~QALSH_Iter();                  // destructor
+
+    // -------------------------------------------------------------------------
+    bool next(                      // get the next nearest neighbor
+        Result &res);                   // next neighbor (return)
+
+    // -------------------------------------------------------------------------
+    int next(                       // get the next n nearest neighbors
+        int   n,                        // number of neighbors
+        Result *res);                   // next neighbors (return)
+
+    // -------------------------------------------------------------------------
+    inline int get_num_returned() { return n_out_; }
+
+    // -------------------------------------------------------------------------
+    inline uint64_t get_io() { return lsh_->page_io_ + lsh_->dist_io_; }
+
+protected:
+    QALSH<DType> *lsh_;             // qalsh index
+    const DType *query_;            // query point
+    const char  *dfolder_;          // data folder
+    int   base_;                    // candidates size of the first neighbor
+    int   n_out_;                   // number of neighbors returned
+    int   num_flag_;                // number of tables done in current round
+    float radius_;                  // current radius
+    float bucket_;                  // current bucket width
+    int   *freq_;                   // collision number of each point
+    bool  *checked_;                // whether a point is verified
+    bool  *flag_;                   // whether a table is open in this round
+    float *q_val_;                  // hash values of query
+    DType *data_;                   // buffer of a data point
+    std::vector<Result> heap_;      // verified points not returned (min-heap)
+
+    // -------------------------------------------------------------------------
+    static inline bool heap_cmp(const Result &a, const Result &b) {
+        return a.key_ > b.key_;     // the smallest key on the top
+    }
+
+    // -------------------------------------------------------------------------
+    void verify(                    // count a collision and verify a point
+        int   id);                      // data id
+
+    // -------------------------------------------------------------------------
+    void scan(                      // scan one page of each open table
+        uint64_t candidates);           // candidates size
+
+    // -------------------------------------------------------------------------
+    bool exhausted();               // whether all tables are scanned
+};
+
+// -----------------------------------------------------------------------------
+template<class DType>
+QALSH_Iter<DType>::QALSH_Iter(      // constructor (start a query)
+    QALSH<DType> *lsh,                  // qalsh index
+    const DType *query,                 // query point
+    const char *dfolder,                // data folder
+    const QueryParams *params)          // parameters of query (NULL: default)
+    : lsh_(lsh), query_(query), dfolder_(dfolder), n_out_(0), num_flag_(0)
+{
+    // the budget grows by one for each neighbor, as knn() with top_k = j
+    base_ = lsh_->init_query_params(1, params);
+
+    int n  = lsh_->n_pts_;
+    int mq = lsh_->mq_;
+    freq_    = new int[n];   memset(freq_, 0, n*sizeof(int));
+    checked_ = new bool[n];  memset(checked_, false, n*sizeof(bool));
+    flag_    = new bool[mq]; memset(flag_, true, mq*sizeof(bool));
+    data_    = new DType[lsh_->dim_];
+    q_val_   = new float[mq];
+    for (int i = 0; i < mq; ++i) q_val_[i] = lsh_->calc_hash_value(i, query);
+    lsh_->init_search_params((const float*) q_val_);
+
+    radius_ = lsh_->find_radius(q_val_, (const Page**) lsh_->lptrs_, 
+        (const Page**) lsh_->rptrs_);
+    bucket_ = lsh_->wq_ * radius_ / 2.0f;
+}
+
 // -----------------------------------------------------------------------------
 template<class DType>
-void QALSH<DType>::delete_tree_ptr( // delete the pointers of b+trees
-    Page **lptrs,                       // left buffer (return)
-    Page **rptrs)                       // right buffer (return)
+QALSH_Iter<DType>::~QALSH_Iter()    // destructor
 {
-    for (int i = 0; i < m_; ++i) {
-        // ---------------------------------------------------------------------
-        //  Note: CANNOT remove the condition
-        //              lptrs[i]->leaf_node != rptrs[i]->leaf_node
-        //  because "lptrs[i]->leaf_node" and "rptrs[i]->leaf_node" may point 
-        //  to the same address, then we would delete it twice and receive the 
-        //  runtime error or segmentation fault.
-        // ---------------------------------------------------------------------
-        if (lptrs[i]->node_ && lptrs[i]->node_ != rptrs[i]->node_) {
-            delete lptrs[i]->node_; lptrs[i]->node_ = NULL;
+    delete[] freq_;
+    delete[] checked_;
+    delete[] flag_;
+    delete[] q_val_;
+    delete[] data_;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+bool QALSH_Iter<DType>::next(       // get the next nearest neighbor
+    Result &res)                        // next neighbor (return)
+{
+    QALSH<DType> *lsh = lsh_;
+    int mq = lsh->mq_;
+    uint64_t candidates = (uint64_t) base_ + n_out_;
+
+    while (!lsh->expired()) {
+        if (num_flag_ >= mq) {
+            // stop condition 1 at the end of a round
+            if (!heap_.empty() && heap_[0].key_ < lsh->cq_*radius_) break;
+            if (exhausted()) break;
+
+            // auto-update <radius> and start a new round
+            radius_ = lsh->update_radius(radius_, q_val_, 
+                (const Page**) lsh->lptrs_, (const Page**) lsh->rptrs_);
+            bucket_ = radius_ * lsh->wq_ / 2.0f;
+            num_flag_ = 0;
+            memset(flag_, true, mq*sizeof(bool));
+        }
+        // stop condition 2
+        if (lsh->dist_io_ >= candidates) break;
+
+        scan(candidates);
+    }
+    if (lsh->expired_) lsh->guarantee_ = false;
+    if (heap_.empty()) return false;
+
+    std::pop_heap(heap_.begin(), heap_.end(), heap_cmp);
+    res = heap_.back(); heap_.pop_back();
+    ++n_out_;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH_Iter<DType>::next(        // get the next n nearest neighbors
+    int   n,                            // number of neighbors
+    Result *res)                        // next neighbors (return)
+{
+    int num = 0;
+    while (num < n && next(res[num])) ++num;
+    return num;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH_Iter<DType>::verify(     // count a collision and verify a point
+    int   id)                           // data id
+{
+    QALSH<DType> *lsh = lsh_;
+    if (lsh->is_deleted(id)) return;
+    if (++freq_[id] <= lsh->lq_ || checked_[id]) return;
+
+    // keep the exact distance, since the point may be returned later
+    checked_[id] = true;
+    read_data_new_format<DType>(id, lsh->dim_, lsh->B_, dfolder_, data_);
+    Result r;
+    r.key_ = calc_lp_dist<DType>(lsh->dim_, lsh->p_, MAXREAL, data_, query_);
+    r.id_  = id;
+    heap_.push_back(r); std::push_heap(heap_.begin(), heap_.end(), heap_cmp);
+    ++lsh->dist_io_;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH_Iter<DType>::scan(       // scan one page of each open table
+    uint64_t candidates)                // candidates size
+{
+    // -------------------------------------------------------------------------
+    //  unlike knn(), a page is always scanned to its end, even if the budget 
+    //  is used up in the middle, so that the search can resume from the next 
+    //  page without missing any collision
+    // -------------------------------------------------------------------------
+    QALSH<DType> *lsh = lsh_;
+    int mq = lsh->mq_;
+    for (int i = 0; i < mq; ++i) {
+        if (!flag_[i]) continue;
+
+        Page *lptr = lsh->lptrs_[i];
+        Page *rptr = lsh->rptrs_[i];
+
+        float ldist = MAXREAL, rdist = MAXREAL;
+        if (lptr->size_ != -1) ldist = lsh->calc_dist(q_val_[i], lptr);
+        if (rptr->size_ != -1) rdist = lsh->calc_dist(q_val_[i], rptr);
+
+        if (ldist < bucket_ && ldist <= rdist) {
+            int end   = lptr->idx_pos_;
+            int start = end - lptr->size_;
+            for (int j = end; j > start; --j) {
+                verify(lptr->node_.get_entry_id(j));
+            }
+            lsh->update_left_buffer(lsh->trees_[i], lptr);
         }
-        if (rptrs[i]->node_) {
-            delete rptrs[i]->node_; rptrs[i]->node_ = NULL;
+        else if (rdist < bucket_ && ldist > rdist) {
+            int start = rptr->idx_pos_;
+            int end   = start + rptr->size_;
+            for (int j = start; j < end; ++j) {
+                verify(rptr->node_.get_entry_id(j));
+            }
+            lsh->update_right_buffer(lsh->trees_[i], rptr);
+        }
+        else {
+            flag_[i] = false;
+            ++num_flag_;
         }
+        if (num_flag_ >= mq || lsh->dist_io_ >= candidates) break;
+        if (lsh->expired()) break;
+    }
+}
 
-        delete lptrs[i]; lptrs[i] = NULL;
-        delete rptrs[i]; rptrs[i] = NULL;
+// -----------------------------------------------------------------------------
+template<class DType>
+bool QALSH_Iter<DType>::exhausted() // whether all tables are scanned
+{
+    for (int i = 0; i < lsh_->mq_; ++i) {
+        if (lsh_->lptrs_[i]->size_ != -1) return false;
+        if (lsh_->rptrs_[i]->size_ != -1) return false;
     }
-    delete[] lptrs; lptrs = NULL;
-    delete[] rptrs; rptrs = NULL;
+    return true;
 }
 
 } // end namespace nns
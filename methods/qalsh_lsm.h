@@ -0,0 +1,518 @@
+#pragma once
+
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "def.h"
+#include "util.h"
+#include "pri_queue.h"
+#include "qalsh.h"
+
+namespace nns {
+
+// -----------------------------------------------------------------------------
+//  QALSH_LSM: a segmented QALSH index in the style of log-structured merge
+//  trees. New data points are inserted as a new segment, i.e., a small QALSH
+//  index of these points, so that the insertion does not touch the existing
+//  b+ trees. All segments share one family of hash functions (a_) and the
+//  same parameters w, m, and l, so that the segments can be merged into one
+//  with the same hash tables.
+//
+//  The segments are sorted by their ids of data points, i.e., from the oldest
+//  (largest) to the newest (smallest). A segment is merged with all the newer
+//  ones once they hold as many points as it does, so there are O(log n)
+//  segments, and each point is merged O(log n) times.
+// -----------------------------------------------------------------------------
+template<class DType>
+class QALSH_LSM {
+public:
+    int   n_pts_;                   // number of data points
+    int   dim_;                     // data dimension
+    bool  guarantee_;               // last query reached its stop conditions
+
+    // -------------------------------------------------------------------------
+    QALSH_LSM(                      // constructor (init an empty index)
+        int   n,                        // expected number of data points
+        int   d,                        // data dimension
+        int   B,                        // page size
+        float p,                        // l_p distance, p \in (0,2]
+        float zeta,                     // symmetric factor of p-stable distr.
+        float c,                        // approximation ratio
+        const char *path,               // index path
+        int   LB = -1,                  // leaf node size (-1: page size)
+        int   interval = BTREE_INTERVAL); // one key for every interval ids
+
+    // -------------------------------------------------------------------------
+    QALSH_LSM(                      // constructor (load index)
+        const char *path,               // index path
+        bool  use_mmap = false);        // map b+ trees into memory
+
+    // -------------------------------------------------------------------------
+    ~QALSH_LSM();                   // destructor
+
+    // -------------------------------------------------------------------------
+    inline int get_num_segments() { return (int) segs_.size(); }
+
+    // -------------------------------------------------------------------------
+    void display();                 // display parameters
+
+    // -------------------------------------------------------------------------
+    uint64_t get_memory_usage() {   // get estimated memory usage
+        uint64_t ret = 0ULL;
+        ret += sizeof(*this);
+        ret += sizeof(float)*m_*(dim_+1);       // a_ and q_val_
+        ret += sizeof(int)*n_pts_;              // index_
+        for (QALSH<DType> *lsh : segs_) {       // segments
+            ret += lsh->get_memory_usage();
+        }
+        return ret;
+    }
+
+    // -------------------------------------------------------------------------
+    //  insert new data points with ids n_pts_, n_pts_+1, ... as a new segment.
+    //  if dfolder is not NULL, they are also appended to the data in new form.
+    // -------------------------------------------------------------------------
+    int insert(                     // insert new data points
+        int   n,                        // number of new data points
+        const DType *data,              // new data points
+        const char *dfolder = NULL);    // data folder (NULL: not appended)
+
+    // -------------------------------------------------------------------------
+    //  merge the segments until no segment holds at most as many points as
+    //  the newer ones. it is separated from insert(), so that insertions stay
+    //  fast and the merges can be run later. the keys are re-computed from 
+    //  data, i.e., all data points by their ids. return the number of merges
+    //  (-1: failed).
+    // -------------------------------------------------------------------------
+    int merge(                      // merge segments
+        const DType *data);             // data points
+
+    // -------------------------------------------------------------------------
+    //  start merge() on a worker thread, which builds the merged segment from
+    //  the segments at this time. the search and insert() may go on meanwhile,
+    //  and data must be kept until wait_merge(). wait_merge() joins it, and 
+    //  the merged segment replaces its segments. it returns the number of 
+    //  merges (-1: failed).
+    // -------------------------------------------------------------------------
+    int start_merge(                // start merge in the background
+        const DType *data);             // data points
+
+    int wait_merge();               // wait for background merge
+
+    // -------------------------------------------------------------------------
+    uint64_t knn(                   // k-NN search
+        int   top_k,                    // top-k value
+        const DType *query,             // query point
+        const char *dfolder,            // data folder
+        MinK_List *list,                // k-NN results (return)
+        const QueryParams *params = NULL); // parameters of query
+
+protected:
+    int   B_;                       // page size
+    int   LB_;                      // leaf node size of b+ trees
+    int   interval_;                // one key for every interval ids
+    int   n_tune_;                  // number of points to tune w, m, l
+    float p_;                       // l_p distance, p \in (0,2]
+    float zeta_;                    // symmetric factor of p-stable distr.
+    float c_;                       // approximation ratio
+    char  path_[200];               // index path
+    bool  mmap_;                    // map the files of b+ trees into memory
+
+    int   m_;                       // number of shared hash functions
+    float *a_;                      // shared hash functions
+    float *q_val_;                  // hash values of query for a_
+    int   *index_;                  // data index (ids of points in order)
+    int   next_sid_;                // folder id of next segment
+    std::vector<int> sids_;         // folder id of each segment
+    std::vector<QALSH<DType>*> segs_; // segments (from oldest to newest)
+
+    std::thread merger_;            // worker thread of merge
+    int   merge_num_;               // number of merges done by the worker
+    int   merge_first_;             // first segment to merge
+    int   merge_end_;               // end of segments to merge
+    int   merged_sid_;              // folder id of merged segment
+    QALSH<DType> *merged_;          // merged segment (from the worker)
+
+    // -------------------------------------------------------------------------
+    inline void get_segment_path(int sid, char *path) { // path of a segment
+        sprintf(path, "%s%d/", path_, sid);
+    }
+
+    // -------------------------------------------------------------------------
+    void init_index(                // init index_ for n data points
+        int   n);                       // number of data points
+
+
+    // -------------------------------------------------------------------------
+    int write_params();             // write parameters
+
+    // -------------------------------------------------------------------------
+    int read_params();              // read parameters
+};
+
+// -----------------------------------------------------------------------------
+template<class DType>
+QALSH_LSM<DType>::QALSH_LSM(        // constructor (init an empty index)
+    int   n,                            // expected number of data points
+    int   d,                            // data dimension
+    int   B,                            // page size
+    float p,                            // l_p distance, p \in (0,2]
+    float zeta,                         // symmetric factor of p-stable distr.
+    float c,                            // approximation ratio
+    const char *path,                   // index path
+    int   LB,                           // leaf node size (-1: page size)
+    int   interval)                     // one key for every interval ids
+    : n_pts_(0), dim_(d), guarantee_(true), B_(B), LB_(LB), 
+    interval_(interval), n_tune_(n), p_(p), zeta_(zeta), c_(c), mmap_(false), 
+    index_(NULL), next_sid_(0), merge_num_(0), merged_(NULL)
+{
+    strcpy(path_, path);
+    create_dir(path_);
+
+    char fname[200]; sprintf(fname, "%spara", path_);
+    FILE *fp = fopen(fname, "rb");
+    if (fp) { printf("Hash Tables Already Exist\n\n"); exit(1); }
+
+    // -------------------------------------------------------------------------
+    //  w, m, and l are tuned for the expected number of points, and they are
+    //  used by all segments no matter how many points a segment holds
+    // -------------------------------------------------------------------------
+    float w = -1.0f; int l = -1;
+    QALSH<DType>::calc_params(n_tune_, p_, zeta_, c_, w, m_, l);
+
+    a_ = new float[m_*dim_];
+    QALSH<DType>::gen_hash_func(m_, dim_, p_, zeta_, a_);
+    q_val_ = new float[m_];
+
+    if (write_params()) exit(1);
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+QALSH_LSM<DType>::QALSH_LSM(        // constructor (load index)
+    const char *path,                   // index path
+    bool  use_mmap)                     // map b+ trees into memory
+    : guarantee_(true), mmap_(use_mmap), index_(NULL), merge_num_(0), 
+    merged_(NULL)
+{
+    strcpy(path_, path);
+
+    // read parameters from disk
+    if (read_params()) exit(1);
+    q_val_ = new float[m_];
+    init_index(n_pts_);
+
+    // the b+ trees of a segment are opened on its first use
+    int start = 0;
+    for (int sid : sids_) {
+        char seg_path[200]; get_segment_path(sid, seg_path);
+        QALSH<DType> *lsh = new QALSH<DType>(seg_path, &index_[start],
+            (const float*) a_, true, mmap_);
+        segs_.push_back(lsh);
+        start += lsh->n_pts_;
+    }
+    assert(start == n_pts_);
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+QALSH_LSM<DType>::~QALSH_LSM()      // destructor
+{
+    wait_merge();
+    for (QALSH<DType> *lsh : segs_) delete lsh;
+    segs_.clear(); segs_.shrink_to_fit();
+
+    delete[] a_;
+    delete[] q_val_;
+    delete[] index_;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH_LSM<DType>::init_index(  // init index_ for n data points
+    int   n)                            // number of data points
+{
+    // the segments hold the positions of their first points in index_
+    delete[] index_;
+    index_ = new int[n];
+    for (int i = 0; i < n; ++i) index_[i] = i;
+
+    int start = 0;
+    for (QALSH<DType> *lsh : segs_) {
+        lsh->index_ = &index_[start];
+        start += lsh->n_pts_;
+    }
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH_LSM<DType>::write_params()// write parameters
+{
+    // -------------------------------------------------------------------------
+    //  the parameters are written to a temporary file and renamed, so that a
+    //  crash never leaves a partial list of segments
+    // -------------------------------------------------------------------------
+    char fname[200]; sprintf(fname, "%spara", path_);
+    char tname[200]; sprintf(tname, "%spara.tmp", path_);
+    FILE *fp = fopen(tname, "wb");
+    if (!fp) {
+        printf("Could not create %s\n", tname);
+        printf("Perhaps no such folder %s?\n", path_);
+        return 1;
+    }
+
+    // write general parameters
+    fwrite(&n_pts_,    sizeof(int),   1, fp);
+    fwrite(&dim_,      sizeof(int),   1, fp);
+    fwrite(&B_,        sizeof(int),   1, fp);
+    fwrite(&LB_,       sizeof(int),   1, fp);
+    fwrite(&interval_, sizeof(int),   1, fp);
+    fwrite(&n_tune_,   sizeof(int),   1, fp);
+    fwrite(&p_,        sizeof(float), 1, fp);
+    fwrite(&zeta_,     sizeof(float), 1, fp);
+    fwrite(&c_,        sizeof(float), 1, fp);
+
+    // write shared hash functions
+    fwrite(&m_, sizeof(int),   1,       fp);
+    fwrite(a_,  sizeof(float), m_*dim_, fp);
+
+    // write folder ids of segments
+    int n_segs = (int) sids_.size();
+    fwrite(&next_sid_, sizeof(int), 1, fp);
+    fwrite(&n_segs,    sizeof(int), 1, fp);
+    if (n_segs > 0) fwrite(sids_.data(), sizeof(int), n_segs, fp);
+    fclose(fp);
+
+    if (rename(tname, fname)) {
+        printf("Could not rename %s\n", tname); return 1;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH_LSM<DType>::read_params() // read parameters
+{
+    char fname[200]; sprintf(fname, "%spara", path_);
+    FILE *fp = fopen(fname, "rb");
+    if (!fp) { printf("Could not open %s\n", fname); return 1; }
+
+    // read general parameters
+    fread(&n_pts_,    sizeof(int),   1, fp);
+    fread(&dim_,      sizeof(int),   1, fp);
+    fread(&B_,        sizeof(int),   1, fp);
+    fread(&LB_,       sizeof(int),   1, fp);
+    fread(&interval_, sizeof(int),   1, fp);
+    fread(&n_tune_,   sizeof(int),   1, fp);
+    fread(&p_,        sizeof(float), 1, fp);
+    fread(&zeta_,     sizeof(float), 1, fp);
+    fread(&c_,        sizeof(float), 1, fp);
+
+    // read shared hash functions
+    fread(&m_, sizeof(int), 1, fp);
+    a_ = new float[m_*dim_];
+    fread(a_, sizeof(float), m_*dim_, fp);
+
+    // read folder ids of segments
+    int n_segs = -1;
+    fread(&next_sid_, sizeof(int), 1, fp);
+    fread(&n_segs,    sizeof(int), 1, fp);
+    sids_.resize(n_segs);
+    if (n_segs > 0) fread(sids_.data(), sizeof(int), n_segs, fp);
+    fclose(fp);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH_LSM<DType>::display()    // display parameters
+{
+    printf("Parameters of QALSH_LSM:\n");
+    printf("n        = %d\n", n_pts_);
+    printf("d        = %d\n", dim_);
+    printf("B        = %d\n", B_);
+    printf("n_tune   = %d\n", n_tune_);
+    printf("m_shared = %d\n", m_);
+    printf("n_segs   = %d (", (int) segs_.size());
+    for (size_t i = 0; i < segs_.size(); ++i) {
+        printf(i == 0 ? "%d" : ", %d", segs_[i]->n_pts_);
+    }
+    printf(")\n");
+    printf("path     = %s\n", path_);
+    printf("\n");
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH_LSM<DType>::insert(       // insert new data points
+    int   n,                            // number of new data points
+    const DType *data,                  // new data points
+    const char *dfolder)                // data folder (NULL: not appended)
+{
+    if (dfolder != NULL && append_data_new_form<DType>(n_pts_, n, dim_, B_,
+        data, dfolder)) return 1;
+
+    // build a qalsh of the new points with the shared hash functions
+    init_index(n_pts_ + n);
+    int sid = next_sid_++;
+    char seg_path[200]; get_segment_path(sid, seg_path);
+
+    QALSH<DType> *lsh = new QALSH<DType>(n, dim_, B_, p_, zeta_, c_, data,
+        seg_path, &index_[n_pts_], (const float*) a_, LB_, interval_, n_tune_);
+    lsh->close_trees(); // re-opened on first use
+
+    segs_.push_back(lsh);
+    sids_.push_back(sid);
+    n_pts_ += n;
+    return write_params();
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH_LSM<DType>::merge(        // merge segments
+    const DType *data)                  // data points
+{
+    if (start_merge(data)) return -1;
+    return wait_merge();
+}
+
+// -----------------------------------------------------------------------------
+//  each merge merges a segment with all the newer ones, so the merges of one 
+//  call end with a single segment of [first, end), where first is the first 
+//  segment of the last merge. as the keys are re-computed, this segment is 
+//  built at once. the worker only reads the old segments and a_, and it 
+//  writes a new folder, whose id is taken here.
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH_LSM<DType>::start_merge(  // start merge in the background
+    const DType *data)                  // data points
+{
+    if (wait_merge() < 0) return 1;
+
+    // count the merges on the sizes of segments
+    std::vector<int> sizes;
+    for (QALSH<DType> *lsh : segs_) sizes.push_back(lsh->n_pts_);
+    int first = -1;
+    merge_num_ = 0;
+    while (true) {
+        // find the oldest segment with at most as many points as newer ones
+        int last  = -1;
+        int count = 0;
+        for (int i = (int) sizes.size() - 1; i > 0; --i) {
+            count += sizes[i];
+            if (sizes[i-1] <= count) last = i - 1;
+        }
+        if (last == -1) break;
+
+        int total = 0;
+        for (size_t i = last; i < sizes.size(); ++i) total += sizes[i];
+        sizes.resize(last); sizes.push_back(total);
+        first = last; ++merge_num_;
+    }
+    if (first == -1) return 0;
+
+    // the folder id is written before the worker creates the folder
+    merge_first_ = first;
+    merge_end_   = (int) segs_.size();
+    merged_sid_  = next_sid_++;
+    if (write_params()) return 1;
+
+    int start = 0;
+    for (int i = 0; i < first; ++i) start += segs_[i]->n_pts_;
+    const DType *seg_data = &data[(uint64_t) start*dim_];
+    std::vector<QALSH<DType>*> lshs(segs_.begin() + first, segs_.end());
+    merger_ = std::thread([this, lshs, seg_data]() mutable {
+        char seg_path[200]; get_segment_path(merged_sid_, seg_path);
+        merged_ = new QALSH<DType>((int) lshs.size(), lshs.data(), seg_data,
+            seg_path, NULL, (const float*) a_);
+    });
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+//  the merged segment is written to a new folder, and the list of segments is
+//  updated before the old folders are removed, so the index on disk is valid
+//  at any time. the segments inserted during the merge stay after it.
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH_LSM<DType>::wait_merge()  // wait for background merge
+{
+    if (!merger_.joinable()) return 0;
+    merger_.join();
+
+    int first = merge_first_, end = merge_end_;
+    std::vector<QALSH<DType>*> old_segs(segs_.begin() + first, 
+        segs_.begin() + end);
+    segs_.erase(segs_.begin() + first, segs_.begin() + end);
+    segs_.insert(segs_.begin() + first, merged_);
+    sids_.erase(sids_.begin() + first, sids_.begin() + end);
+    sids_.insert(sids_.begin() + first, merged_sid_);
+    merged_ = NULL;
+    init_index(n_pts_);
+    if (write_params()) return -1;
+
+    for (QALSH<DType> *old : old_segs) { old->remove_files(); delete old; }
+    return merge_num_;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+uint64_t QALSH_LSM<DType>::knn(     // k-NN search
+    int   top_k,                        // top-k value
+    const DType *query,                 // query point
+    const char *dfolder,                // data folder
+    MinK_List *list,                    // k-NN results (return)
+    const QueryParams *params)          // parameters of query (NULL: default)
+{
+    list->reset();
+    for (int i = 0; i < m_; ++i) {
+        q_val_[i] = calc_inner_product<DType>(dim_, &a_[i*dim_], query);
+    }
+
+    // -------------------------------------------------------------------------
+    //  all segments share one budget of candidates. each segment takes a part
+    //  of the rest budget in proportion to its size, and the part it does not
+    //  use is left to the newer ones. the k-NN found so far bound the search
+    //  range of the next segments. the deadlines are shared in the same way.
+    // -------------------------------------------------------------------------
+    QueryParams seg_params;
+    if (params != NULL) seg_params = *params;
+    int budget = CANDIDATES + top_k - 1;
+    if (seg_params.budget_ > 0) budget = seg_params.budget_;
+    
+    guarantee_ = true;
+    bool deadline = has_deadlines(params);
+    auto start = std::chrono::steady_clock::now();
+    uint64_t cand = 0;
+
+    int rest = n_pts_;
+    uint64_t io = 0;
+    for (QALSH<DType> *lsh : segs_) {
+        int part = (int) ceil((double) budget * lsh->n_pts_ / rest);
+        rest -= lsh->n_pts_;
+        if (part <= 0) continue;
+
+        if (deadline) {
+            float ms = std::chrono::duration<float, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+            if (!rest_deadlines(*params, ms, io, cand, seg_params)) {
+                guarantee_ = false; break;
+            }
+        }
+        seg_params.budget_ = part;
+        io += lsh->knn2(top_k, query, (const float*) q_val_, dfolder, list,
+            &seg_params);
+        budget -= (int) lsh->dist_io_;
+        cand   += lsh->dist_io_;
+        if (!lsh->guarantee_) { guarantee_ = false; break; }
+    }
+    return io;
+}
+
+} // end namespace nns
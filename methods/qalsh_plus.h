@@ -3,15 +3,21 @@
 #include <iostream>
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstring>
+#include <limits>
+#include <list>
 #include <unordered_map>
 #include <vector>
 
+#include <sys/resource.h>
+
 #include "def.h"
 #include "util.h"
 #include "pri_queue.h"
 #include "kd_tree.h"
+#include "partition.h"
 #include "qalsh.h"
 
 namespace nns {
@@ -31,11 +37,18 @@ public:
         float zeta,                     // a parameter of p-stable distr.
         float c,                        // approximation ratio
         const DType *data,              // data points
-        const char *path);              // index path
+        const char *path,               // index path
+        int   share = 0,                // share hash functions among blocks
+        int   part = 0,                 // 0: kd-tree, 1: k-means, 2: rp-tree
+        int   LB = -1,                  // leaf node size (-1: page size)
+        int   interval = BTREE_INTERVAL); // one key for every interval ids
 
     // -------------------------------------------------------------------------
     QALSH_PLUS(                     // constructor (load index)
-        const char *path);              // index path
+        const char *path,               // index path
+        int   max_files = -1,           // max number of opened tree files
+        bool  use_mmap = false,         // map b+ trees into memory
+        Pack  *pack = NULL);            // read index from a pack
 
     // -------------------------------------------------------------------------
     ~QALSH_PLUS();                  // destructor
@@ -43,6 +56,18 @@ public:
     // -------------------------------------------------------------------------
     inline int get_num_blocks() { return n_blocks_; }
 
+    // -------------------------------------------------------------------------
+    inline int get_num_points() { return n_pts_; }
+
+    // -------------------------------------------------------------------------
+    inline bool get_guarantee() { return guarantee_; } // of last query
+
+    // -------------------------------------------------------------------------
+    inline void set_locator(bool on) { // use leaf locators of all b+ trees
+        lsh_->set_locator(on);
+        for (QALSH<DType> *lsh : blocks_) lsh->set_locator(on);
+    }
+
     // -------------------------------------------------------------------------
     void display();                 // display parameters
 
@@ -54,6 +79,9 @@ public:
         ret += sizeof(int)*n_pts_;               // index_
         ret += sizeof(int)*n_blocks_*n_samples_; // sample_index_
         ret += sizeof(int)*n_pts_;               // sample_index_to_block_
+        ret += sizeof(DType)*2*n_blocks_*dim_;   // rects_
+        ret += sizeof(float)*n_blocks_;          // box_dist_
+        ret += sizeof(float)*m_*(dim_+1);        // a_ and q_val_
         ret += lsh_->get_memory_usage();         // first level lsh
         for (int i = 0; i < n_blocks_; ++i) {    // second level lsh
             ret += blocks_[i]->get_memory_usage();
@@ -61,13 +89,46 @@ public:
         return ret;
     }
 
+    // -------------------------------------------------------------------------
+    //  insert new data points with ids n_pts_, n_pts_+1, ... each point is 
+    //  routed to the block of the closest bounding rectangle and inserted 
+    //  into the qalsh of this block. a block with more than leaf points is 
+    //  split by a median split, and only the new blocks and the first level 
+    //  lsh index of sample data are rebuilt. the parameters and all blocks 
+    //  are checked before the data folder or any block is changed.
+    // -------------------------------------------------------------------------
+    int insert(                     // insert new data points
+        int   n,                        // number of new data points
+        int   leaf,                     // max number of points in a block
+        int   L,                        // number of projection (drusilla)
+        int   M,                        // number of candidates (drusilla)
+        const DType *data,              // new data points
+        const char *dfolder);           // data folder
+
     // -------------------------------------------------------------------------
     uint64_t knn(                   // k-NN search
         int   top_k,                    // top-k value
         int   nb,                       // number of blocks for search
         const DType *query,             // query point
         const char *dfolder,            // data folder
-        MinK_List *list);               // top-k results (return)
+        MinK_List *list,                // top-k results (return)
+        const QueryParams *params = NULL); // parameters of query
+
+    // -------------------------------------------------------------------------
+    uint64_t get_block_order(       // get block order
+        int nb,                         // number of blocks for search
+        const DType *query,             // query point
+        const char *dfolder,            // data folder
+        std::vector<int> &block_order); // block order (return)
+
+    // -------------------------------------------------------------------------
+    uint64_t knn_block(             // k-NN search in one block
+        int   top_k,                    // top-k value
+        int   bid,                      // block id
+        const DType *query,             // query point
+        const char *dfolder,            // data folder
+        MinK_List *list,                // top-k results (update)
+        const QueryParams *params = NULL); // parameters of query
 
 protected:
     int  n_pts_;                    // number of data points
@@ -80,14 +141,47 @@ protected:
     int  *index_;                   // data index after kd-tree partition
     int  *sample_index_;            // sample data index
     int  *sample_index_to_block_;   // sample data id to block
+    float *box_dist_;               // box distance from query to each block
+    std::vector<KD_Rect<DType>*> rects_; // bounding rectangle of each block
+
+    int   m_;                       // number of shared hash functions
+    float *a_;                      // shared hash functions (NULL if m_ = 0)
+    float *q_val_;                  // hash values of query for a_
     QALSH<DType> *lsh_;             // first level lsh index for sample data
     std::vector<QALSH<DType>*> blocks_; // second level lsh index for blocks
+    Pack  *pack_;                   // pack of index (NULL: separate files)
+
+    int   max_files_;               // max number of opened tree files
+    int   n_files_;                 // number of opened tree files of blocks
+    std::list<int> lru_;            // opened blocks (most recently used first)
+    std::vector<std::list<int>::iterator> lru_pos_; // position in lru_
+    bool  guarantee_;               // last query reached its stop conditions
 
     // -------------------------------------------------------------------------
-    void kd_tree_partition(         // kd-tree partition
-        int   leaf,                     // leaf size of kd-tree
+    void init_file_pool(            // init the pool of opened tree files
+        int   max_files);               // max number of opened tree files
+
+    // -------------------------------------------------------------------------
+    void open_block(                // open the b+ trees of a block for search
+        int   bid);                     // block id
+
+    // -------------------------------------------------------------------------
+    void partition(                 // partition data into blocks
+        int   part,                     // 0: kd-tree, 1: k-means, 2: rp-tree
+        int   leaf,                     // max number of points in a block
         const DType *data);             // data points
 
+    // -------------------------------------------------------------------------
+    KD_Rect<DType>* calc_block_rect(// calc bounding rectangle of a block
+        int   n,                        // number of data points in this block
+        const DType *data);             // data points in this block
+
+    // -------------------------------------------------------------------------
+    float calc_box_dist(            // calc l_p distance from query to a block
+        float p,                        // l_p distance, p \in (0,2]
+        const KD_Rect<DType> *rect,     // bounding rectangle of this block
+        const DType *query);            // query point
+
     // -------------------------------------------------------------------------
     void copy(                      // copy original data to destination data
         const DType *orig_data,         // original data
@@ -104,45 +198,70 @@ protected:
         DType *sample_data);            // sample data (return)
 
     // -------------------------------------------------------------------------
-    void calc_shift_data(           // calculate shift data points
+    void calc_shift_norm(           // calc l2-norm of shift data points
         int   n,                        // number of data points in this block
         const DType *data,              // data points in this block
-        int   &max_id,                  // locl id with max l2-norm (return)
-        float &max_norm,                // max l2-norm (return)
+        float *centroid,                // centroid of data points (return)
         float *norm,                    // l2-norm of shift data (return)
-        float *shift_data);             // shift data (return)
-
-    // -------------------------------------------------------------------------
-    void shift(                     // shift the original data by centroid
-        const DType *data,              // original data point
-        const float *centroid,          // centroid
-        float &norm,                    // l2-norm of shifted data (return)
-        float *shift_data);             // shifted data (return)
+        int   &max_id);                 // local id with max l2-norm (return)
 
     // -------------------------------------------------------------------------
     void select_proj(               // select project vector
         float norm,                     // max l2-norm
-        const float *shift_data,        // shift data with max l2-norm
-        float *proj);                   // projection vector
+        const DType *data,              // data point with max l2-norm
+        const float *centroid,          // centroid of data points
+        float *proj);                   // projection vector (return)
+
+    // -------------------------------------------------------------------------
+    float calc_offset(              // calc offset of shift data on proj
+        const float *proj,              // projection vector
+        const float *centroid,          // centroid of data points
+        const DType *data);             // data point
 
     // -------------------------------------------------------------------------
     float calc_distortion(          // calc distortion
         float offset,                   // offset
         const float *proj,              // projection vector
-        const float *shift_data);       // input shift data
+        const float *centroid,          // centroid of data points
+        const DType *data);             // data point
 
     // -------------------------------------------------------------------------
-    int write_params();             // write parameters
+    int route(                      // find the block of a new data point
+        const DType *point);            // data point
 
     // -------------------------------------------------------------------------
-    int read_params();              // read parameters
+    int stage_blocks(               // insert new data points into blocks
+        int   n,                        // number of new data points
+        const DType *data,              // new data points
+        const std::vector<std::vector<int> > &members); // ids of blocks
 
     // -------------------------------------------------------------------------
-    uint64_t get_block_order(       // get block order
-        int nb,                         // number of blocks for search
-        const DType *query,             // query point
+    void split_block(               // split a block and rebuild its qalsh
+        int   bid,                      // block id
+        int   L,                        // #projection for drusilla-select
+        int   M,                        // #candidates for drusilla-select
         const char *dfolder,            // data folder
-        std::vector<int> &block_order); // block order (return)
+        std::vector<std::vector<int> > &members, // ids of blocks (update)
+        std::vector<int> &samples);     // sample data index (update)
+
+    // -------------------------------------------------------------------------
+    void grow_shared_hash_func(     // grow shared hash functions for n points
+        int   n);                       // number of data points
+
+    // -------------------------------------------------------------------------
+    void init_shared_hash_func(     // init hash functions shared by blocks
+        float p,                        // l_p distance
+        float zeta,                     // a parameter of p-stable distr.
+        float c);                       // approximation ratio
+
+    // -------------------------------------------------------------------------
+    int write_params();             // write parameters
+
+    // -------------------------------------------------------------------------
+    int save_params();              // (re)write parameters atomically
+
+    // -------------------------------------------------------------------------
+    int read_params();              // read parameters
 };
 
 // -----------------------------------------------------------------------------
@@ -158,8 +277,13 @@ QALSH_PLUS<DType>::QALSH_PLUS(      // constructor (build index)
     float zeta,                         // a parameter of p-stable distr.
     float c,                            // approximation ratio
     const DType *data,                  // data points
-    const char *path)                   // index path
-    : n_pts_(n), dim_(d), n_samples_(L*M)
+    const char *path,                   // index path
+    int   share,                        // share hash functions among blocks
+    int   part,                         // 0: kd-tree, 1: k-means, 2: rp-tree
+    int   LB,                           // leaf node size (-1: page size)
+    int   interval)                     // one key for every interval ids
+    : n_pts_(n), dim_(d), n_samples_(L*M), m_(0), a_(NULL), q_val_(NULL),
+    pack_(NULL), guarantee_(true)
 {
     strcpy(path_, path);
     create_dir(path_);
@@ -168,8 +292,11 @@ QALSH_PLUS<DType>::QALSH_PLUS(      // constructor (build index)
     sample_index_to_block_ = new int[n_pts_];
     memset(sample_index_to_block_, -1, n_pts_);
 
-    // kd-tree partition (get index_, n_blocks_, and block_size_)
-    kd_tree_partition(leaf, data);
+    // partition data into blocks (get index_, n_blocks_, and block_size_)
+    partition(part, leaf, data);
+
+    // init one family of hash functions for all blocks (get m_ and a_)
+    if (share) init_shared_hash_func(p, zeta, c);
 
     // init sample_index_ and build qalsh for each block
     int n_sample_pts = n_blocks_*n_samples_;
@@ -188,6 +315,7 @@ QALSH_PLUS<DType>::QALSH_PLUS(      // constructor (build index)
         for (int j = 0; j < n_blk; ++j) {
             copy(&data[(uint64_t)index[j]*dim_], &blk_data[(uint64_t)j*dim_]);
         }
+        rects_.push_back(calc_block_rect(n_blk, (const DType*) blk_data));
 
         // get sample data index (representative data) by drusilla select
         assert(n_blk > n_samples_);
@@ -203,7 +331,9 @@ QALSH_PLUS<DType>::QALSH_PLUS(      // constructor (build index)
         create_dir(block_path);
 
         QALSH<DType> *lsh = new QALSH<DType>(n_blk, dim_, B, p, zeta, c, 
-            (const DType*) blk_data, block_path, index);
+            (const DType*) blk_data, block_path, index, (const float*) a_, 
+            LB, interval);
+        lsh->close_trees(); // re-opened on first use
         blocks_.push_back(lsh);
         delete[] blk_data;
 
@@ -218,25 +348,31 @@ QALSH_PLUS<DType>::QALSH_PLUS(      // constructor (build index)
     create_dir(sample_path);
 
     lsh_ = new QALSH<DType>(n_sample_pts, dim_, B, p, zeta, c,
-        (const DType*) sample_data, sample_path, (const int*) sample_index_);
+        (const DType*) sample_data, sample_path, (const int*) sample_index_,
+        (const float*) a_, LB, interval);
 
     // write parameters to disk
     if (write_params()) exit(1);
     delete[] sample_data;
+
+    box_dist_ = new float[n_blocks_];
+    init_file_pool(-1);
 }
 
 // -----------------------------------------------------------------------------
 template<class DType>
-void QALSH_PLUS<DType>::kd_tree_partition(// kd-tree partition
-    int   leaf,                         // leaf size of kd-tree
+void QALSH_PLUS<DType>::partition( // partition data into blocks
+    int   part,                         // 0: kd-tree, 1: k-means, 2: rp-tree
+    int   leaf,                         // max number of points in a block
     const DType *data)                  // data points
 {
-    // build a kd-tree for input data with specific leaf size
-    KD_Tree<DType>* tree = new KD_Tree<DType>(n_pts_, dim_, leaf, data);
+    // partition input data into blocks with specific leaf size
+    Partition<DType> *method = create_partition<DType>(part, n_pts_, dim_, 
+        leaf, data);
 
     // init index_
     std::vector<int> block_size;
-    tree->traversal(block_size, index_);
+    method->partition(block_size, index_);
     
     // init n_blocks_, and block_size_
     n_blocks_ = (int) block_size.size(); assert(n_blocks_ > 0);
@@ -245,10 +381,85 @@ void QALSH_PLUS<DType>::kd_tree_partition(// kd-tree partition
         block_size_[i] = block_size[i];
     }
     // release space
-    delete tree;
+    delete method;
     block_size.clear(); block_size.shrink_to_fit();
 }
 
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH_PLUS<DType>::init_shared_hash_func(// init shared hash functions
+    float p,                            // l_p distance
+    float zeta,                         // a parameter of p-stable distr.
+    float c)                            // approximation ratio
+{
+    // -------------------------------------------------------------------------
+    //  the number of hash tables grows with the number of data points, so the
+    //  largest index (a block or the sample data) decides the size of family.
+    //  every qalsh uses the first m hash functions it needs.
+    // -------------------------------------------------------------------------
+    int max_n = n_blocks_ * n_samples_;
+    for (int i = 0; i < n_blocks_; ++i) {
+        if (block_size_[i] > max_n) max_n = block_size_[i];
+    }
+    float w = -1.0f; int l = -1;
+    QALSH<DType>::calc_params(max_n, p, zeta, c, w, m_, l);
+
+    a_ = new float[m_*dim_];
+    QALSH<DType>::gen_hash_func(m_, dim_, p, zeta, a_);
+    q_val_ = new float[m_];
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+KD_Rect<DType>* QALSH_PLUS<DType>::calc_block_rect(// calc bounding rectangle
+    int   n,                            // number of data points in this block
+    const DType *data)                  // data points in this block
+{
+    // the smallest enclosing rectangle is no larger than the kd-tree cell
+    KD_Rect<DType> *rect = new KD_Rect<DType>(dim_, data, data);
+    for (int i = 1; i < n; ++i) {
+        const DType *point = &data[(uint64_t) i*dim_];
+        for (int j = 0; j < dim_; ++j) {
+            if (point[j] < rect->low_[j]) rect->low_[j] = point[j];
+            else if (point[j] > rect->high_[j]) rect->high_[j] = point[j];
+        }
+    }
+    return rect;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+float QALSH_PLUS<DType>::calc_box_dist(// calc l_p distance from query to block
+    float p,                            // l_p distance, p \in (0,2]
+    const KD_Rect<DType> *rect,         // bounding rectangle of this block
+    const DType *query)                 // query point
+{
+    // -------------------------------------------------------------------------
+    //  the l_p distance from query to the rectangle is a lower bound of the 
+    //  l_p distance from query to any data point in this block
+    // -------------------------------------------------------------------------
+    float dist = 0.0f;
+    for (int i = 0; i < dim_; ++i) {
+        float diff = 0.0f;
+        if (query[i] < rect->low_[i]) {
+            diff = (float) rect->low_[i] - (float) query[i];
+        }
+        else if (query[i] > rect->high_[i]) {
+            diff = (float) query[i] - (float) rect->high_[i];
+        }
+        else continue;
+
+        if (fabs(p - 2.0f) < FLOATZERO) dist += diff * diff;
+        else if (fabs(p - 1.0f) < FLOATZERO) dist += diff;
+        else if (fabs(p - 0.5f) < FLOATZERO) dist += sqrt(diff);
+        else dist += pow(diff, p);
+    }
+    if (fabs(p - 2.0f) < FLOATZERO) return sqrt(dist);
+    else if (fabs(p - 1.0f) < FLOATZERO) return dist;
+    else if (fabs(p - 0.5f) < FLOATZERO) return SQR(dist);
+    else return pow(dist, 1.0f / p);
+}
+
 // -----------------------------------------------------------------------------
 template<class DType>
 void QALSH_PLUS<DType>::copy(       // copy original data to destination data
@@ -271,39 +482,46 @@ void QALSH_PLUS<DType>::drusilla_select(// drusilla select
     int   *sample_index,                // sample data index (return)
     DType *sample_data)                 // sample data (return)
 {
-    // calc shift data
-    int   max_id      = -1;
-    float max_norm    = MINREAL;
-    float *norm       = new float[n];
-    float *shift_data = new float[(uint64_t)n*dim_];
-    
-    calc_shift_data(n, data, max_id, max_norm, norm, shift_data);
+    // -------------------------------------------------------------------------
+    //  the shift data x - centroid are not materialized, but computed on the
+    //  fly from x and centroid. the distortion is the sum of the squared 
+    //  residuals of x - centroid orthogonal to proj, rather than 
+    //  ||x - centroid||^2 - offset^2, which cancels for the far points. the 
+    //  angle test atan(sqrt(distortion)/|offset|) < ANGLE is replaced by 
+    //  distortion < offset^2 * tan^2(ANGLE).
+    // -------------------------------------------------------------------------
+    int   max_id    = -1;
+    float *centroid = new float[dim_];
+    float *norm     = new float[n];     // l2-norm of shift data (<0: selected)
+    calc_shift_norm(n, data, centroid, norm, max_id);
 
     // drusilla select
+    const float tan_sqr = SQR(tan(ANGLE));
     float  *proj        = new float[dim_];
     Result *score       = new Result[n];
     bool   *close_angle = new bool[n];
-    float  offset       = -1.0f;
-    float  distortion   = -1.0f;
 
     for (int i = 0; i < L; ++i) {
         // select the projection vector with largest norm and normalize it
-        select_proj(norm[max_id], &shift_data[(uint64_t)max_id*dim_], proj);
+        select_proj(norm[max_id], &data[(uint64_t)max_id*dim_], 
+            (const float*) centroid, proj);
 
         // calculate offsets and distortions
+#pragma omp parallel for schedule(static)
         for (int j = 0; j < n; ++j) {
             close_angle[j] = false;
             score[j].id_   = j;
 
             if (norm[j] > 0.0f) {
-                const float *tmp = &shift_data[(uint64_t)j*dim_];
-                offset = calc_inner_product<float>(dim_, (const float*)proj, tmp);
-                distortion = calc_distortion(offset, (const float*)proj, tmp);
-                score[j].key_ = offset*offset - distortion;
-
-                if (atan(sqrt(distortion) / fabs(offset)) < ANGLE) {
-                    close_angle[j] = true;
-                }
+                const DType *tmp = &data[(uint64_t)j*dim_];
+                float offset = calc_offset((const float*) proj, 
+                    (const float*) centroid, tmp);
+                float offset_sqr = offset * offset;
+                float distortion = calc_distortion(offset, (const float*) proj,
+                    (const float*) centroid, tmp);
+
+                score[j].key_  = offset_sqr - distortion;
+                close_angle[j] = distortion < offset_sqr * tan_sqr;
             }
             else if (fabs(norm[j]) < FLOATZERO) {
                 score[j].key_ = MINREAL + 1.0f;
@@ -312,8 +530,11 @@ void QALSH_PLUS<DType>::drusilla_select(// drusilla select
                 score[j].key_ = MINREAL;
             }
         }
-        // collect the points that are well-represented by this projection
-        qsort(score, n, sizeof(Result), ResultCompDesc);
+        // collect the top-M points that are well-represented by this proj
+        std::partial_sort(score, score + M, score + n, 
+            [](const Result &a, const Result &b) {
+                if (a.key_ != b.key_) return a.key_ > b.key_;
+                return a.id_ < b.id_; });
         for (int j = 0; j < M; ++j) {
             int id  = score[j].id_;
             int loc = i * M + j;
@@ -323,7 +544,7 @@ void QALSH_PLUS<DType>::drusilla_select(// drusilla select
             norm[id] = -1.0f;
         }
         //  find the next largest norm and the corresponding point
-        max_id = -1; max_norm = MINREAL;
+        float max_norm = MINREAL; max_id = -1;
         for (int j = 0; j < n; ++j) {
             if (norm[j] > 0.0f && close_angle[j]) { norm[j] = 0.0f; }
             if (norm[j] > max_norm) { max_norm = norm[j]; max_id = j; }
@@ -334,22 +555,20 @@ void QALSH_PLUS<DType>::drusilla_select(// drusilla select
     delete[] score;
     delete[] proj;
     delete[] norm;
-    delete[] shift_data;
+    delete[] centroid;
 }
 
 // -----------------------------------------------------------------------------
 template<class DType>
-void QALSH_PLUS<DType>::calc_shift_data(// calculate shift data points
+void QALSH_PLUS<DType>::calc_shift_norm(// calc l2-norm of shift data points
     int   n,                            // number of data points in this block
     const DType *data,                  // data points in this block
-    int   &max_id,                      // locl id with max l2-norm (return)
-    float &max_norm,                    // max l2-norm (return)
+    float *centroid,                    // centroid of data points (return)
     float *norm,                        // l2-norm of shift data (return)
-    float *shift_data)                  // shift data (return)
+    int   &max_id)                      // local id with max l2-norm (return)
 {
     // calculate the centroid of data points
-    float *centroid = new float[dim_]; 
-    memset(centroid, 0.0f, dim_*sizeof(float));
+    memset(centroid, 0, dim_*sizeof(float));
     for (int i = 0; i < n; ++i) {
         const DType *tmp = &data[(uint64_t) i*dim_];
         for (int j = 0; j < dim_; ++j) {
@@ -358,42 +577,60 @@ void QALSH_PLUS<DType>::calc_shift_data(// calculate shift data points
     }
     for (int i = 0; i < dim_; ++i) centroid[i] /= n;
 
-    // make a copy of data points which move to the centroid of data points
-    max_id = -1; max_norm = MINREAL;
+    // calc the l2-norm of data points which move to the centroid
+#pragma omp parallel for schedule(static)
     for (int i = 0; i < n; ++i) {
-        uint64_t loc = (uint64_t) i * dim_;
-        shift(&data[loc], centroid, norm[i], &shift_data[loc]);
-        if (norm[i] > max_norm) { max_norm = norm[i]; max_id = i; }
+        const DType *tmp = &data[(uint64_t) i*dim_];
+        float sum = 0.0f;
+        for (int j = 0; j < dim_; ++j) {
+            float diff = (float) tmp[j] - centroid[j];
+            sum += diff * diff;
+        }
+        norm[i] = sqrt(sum);
+    }
+    max_id = 0;
+    for (int i = 1; i < n; ++i) {
+        if (norm[i] > norm[max_id]) max_id = i;
     }
-    delete[] centroid;
 }
 
 // -----------------------------------------------------------------------------
 template<class DType>
-void QALSH_PLUS<DType>::shift(      // shift the original data by centroid
-    const DType *data,                  // original data point
-    const float *centroid,              // centroid
-    float &norm,                        // l2-norm of shifted data (return)
-    float *shift_data)                  // shifted data (return)
+void QALSH_PLUS<DType>::select_proj(// select project vector
+    float norm,                         // max l2-norm
+    const DType *data,                  // data point with max l2-norm
+    const float *centroid,              // centroid of data points
+    float *proj)                        // projection vector (return)
 {
-    norm = 0.0f;
     for (int j = 0; j < dim_; ++j) {
-        float tmp = (float) data[j] - centroid[j];
-        shift_data[j] = tmp; norm += tmp*tmp;
+        proj[j] = ((float) data[j] - centroid[j]) / norm;
     }
-    norm = sqrt(norm);
 }
 
 // -----------------------------------------------------------------------------
 template<class DType>
-void QALSH_PLUS<DType>::select_proj(// select project vector
-    float norm,                         // max l2-norm
-    const float *shift_data,            // shift data with max l2-norm
-    float *proj)                        // projection vector
+float QALSH_PLUS<DType>::calc_offset(// calc offset of shift data on proj
+    const float *proj,                  // projection vector
+    const float *centroid,              // centroid of data points
+    const DType *data)                  // data point
 {
-    for (int j = 0; j < dim_; ++j) {
-        proj[j] = shift_data[j] / norm;
+    // use 8 independent accumulators so that the loop can be vectorized
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    float s4 = 0.0f, s5 = 0.0f, s6 = 0.0f, s7 = 0.0f;
+    int j = 0;
+    for (; j + 8 <= dim_; j += 8) {
+        s0 += proj[j]   * ((float) data[j]   - centroid[j]);
+        s1 += proj[j+1] * ((float) data[j+1] - centroid[j+1]);
+        s2 += proj[j+2] * ((float) data[j+2] - centroid[j+2]);
+        s3 += proj[j+3] * ((float) data[j+3] - centroid[j+3]);
+        s4 += proj[j+4] * ((float) data[j+4] - centroid[j+4]);
+        s5 += proj[j+5] * ((float) data[j+5] - centroid[j+5]);
+        s6 += proj[j+6] * ((float) data[j+6] - centroid[j+6]);
+        s7 += proj[j+7] * ((float) data[j+7] - centroid[j+7]);
     }
+    for (; j < dim_; ++j) s0 += proj[j] * ((float) data[j] - centroid[j]);
+
+    return ((s0 + s1) + (s2 + s3)) + ((s4 + s5) + (s6 + s7));
 }
 
 // -----------------------------------------------------------------------------
@@ -401,11 +638,12 @@ template<class DType>
 float QALSH_PLUS<DType>::calc_distortion(// calc distortion
     float offset,                       // offset
     const float *proj,                  // projection vector
-    const float *shift_data)            // input shift data
+    const float *centroid,              // centroid of data points
+    const DType *data)                  // data point
 {
     float distortion = 0.0f;
     for (int j = 0; j < dim_; ++j) {
-        float tmp = shift_data[j] - offset*proj[j];
+        float tmp = (float) data[j] - centroid[j] - offset*proj[j];
         distortion += tmp * tmp;
     }
     return distortion;
@@ -419,14 +657,30 @@ int QALSH_PLUS<DType>::write_params()// write parameters
     FILE *fp = fopen(fname, "rb");
     if (fp)    { printf("Hash Tables Already Exist\n"); exit(1); }
 
-    fp = fopen(fname, "wb");
+    return save_params();
+}
+
+// -----------------------------------------------------------------------------
+//  the file para starts with PARA_MAGIC and PARA_VERSION, and version 1 adds
+//  rects_, m_, and a_. a file without them is a legacy one, whose blocks are
+//  never pruned and have their own hash functions.
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH_PLUS<DType>::save_params()// (re)write parameters atomically
+{
+    char fname[200]; sprintf(fname, "%spara", path_);
+    char tname[200]; sprintf(tname, "%spara.tmp", path_);
+    FILE *fp = fopen(tname, "wb");
     if (!fp) {
-        printf("Could not create %s\n", fname);
+        printf("Could not create %s\n", tname);
         printf("Perhaps no such folder %s?\n", path_);
         return 1;
     }
 
     // write general parameters
+    int magic = PARA_MAGIC, version = PARA_VERSION;
+    fwrite(&magic,      sizeof(int), 1, fp);
+    fwrite(&version,    sizeof(int), 1, fp);
     fwrite(&n_pts_,     sizeof(int), 1, fp);
     fwrite(&dim_,       sizeof(int), 1, fp);
     fwrite(&n_samples_, sizeof(int), 1, fp);
@@ -438,14 +692,34 @@ int QALSH_PLUS<DType>::write_params()// write parameters
     // write second level parameters
     fwrite(block_size_, sizeof(int), n_blocks_, fp);
     fwrite(index_,      sizeof(int), n_pts_,    fp);
-    fclose(fp);
+
+    // write bounding rectangles of blocks
+    for (int i = 0; i < n_blocks_; ++i) {
+        fwrite(rects_[i]->low_,  sizeof(DType), dim_, fp);
+        fwrite(rects_[i]->high_, sizeof(DType), dim_, fp);
+    }
+
+    // write shared hash functions
+    fwrite(&m_, sizeof(int), 1, fp);
+    if (m_ > 0) fwrite(a_, sizeof(float), m_*dim_, fp);
+    bool failed = ferror(fp) != 0;
+    if (fclose(fp) != 0 || failed) {
+        printf("Could not write %s\n", tname); std::remove(tname); return 1;
+    }
+    if (rename(tname, fname)) {
+        printf("Could not rename %s\n", tname); return 1;
+    }
     return 0;
 }
 
 // -----------------------------------------------------------------------------
 template<class DType>
 QALSH_PLUS<DType>::QALSH_PLUS(      // load index
-    const char *path)                   // index path
+    const char *path,                   // index path
+    int   max_files,                    // max number of opened tree files
+    bool  use_mmap,                     // map b+ trees into memory
+    Pack  *pack)                        // read index from a pack
+    : m_(0), a_(NULL), q_val_(NULL), pack_(pack), guarantee_(true)
 {
     strcpy(path_, path);
 
@@ -454,18 +728,84 @@ QALSH_PLUS<DType>::QALSH_PLUS(      // load index
 
     // load first level lsh index (lsh_)
     char sample_path[200]; sprintf(sample_path, "%ssample/", path_);
-    lsh_ = new QALSH<DType>(sample_path, sample_index_);
+    lsh_ = new QALSH<DType>(sample_path, sample_index_, (const float*) a_,
+        false, use_mmap, pack_);
 
-    // load second level lsh index (blocks_)
+    // -------------------------------------------------------------------------
+    //  load second level lsh index (blocks_). only the parameters are loaded, 
+    //  and the b+ trees of a block are opened on its first use.
+    // -------------------------------------------------------------------------
     int start = 0;
     for (int i = 0; i < n_blocks_; ++i) {
         char block_path[200]; sprintf(block_path, "%s%d/", path_, i);
         QALSH<DType> *lsh = new QALSH<DType>(block_path, 
-            (const int*) &index_[start]);
+            (const int*) &index_[start], (const float*) a_, true, use_mmap, 
+            pack_);
         
         blocks_.push_back(lsh);
         start += block_size_[i];
     }
+    box_dist_ = new float[n_blocks_];
+    init_file_pool(max_files);
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH_PLUS<DType>::init_file_pool(// init the pool of opened tree files
+    int   max_files)                    // max number of opened tree files
+{
+    // -------------------------------------------------------------------------
+    //  by default, use the limit of file descriptors of this process, and
+    //  reserve some of them for the data files and the output files. the 
+    //  trees in a pack hold no file descriptor, so they are not limited.
+    // -------------------------------------------------------------------------
+    if (max_files <= 0 && pack_ != NULL) {
+        max_files = MAXINT;
+    }
+    else if (max_files <= 0) {
+        struct rlimit rl;
+        max_files = 1024;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+            max_files = (int) rl.rlim_cur;
+        }
+        max_files -= 64;
+    }
+    // the trees of sample data are always opened, and at least one block is 
+    // opened for search even if the budget is exceeded
+    max_files_ = max_files - lsh_->m_;
+    if (max_files_ < 1) {
+        printf("Warning: %d files are too few for %d trees of sample data\n",
+            max_files, lsh_->m_);
+        max_files_ = 1;
+    }
+    n_files_   = 0;
+
+    lru_.clear();
+    lru_pos_.assign(n_blocks_, lru_.end());
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH_PLUS<DType>::open_block( // open the b+ trees of a block for search
+    int   bid)                          // block id
+{
+    QALSH<DType> *lsh = blocks_[bid];
+    if (lsh->trees_opened()) {
+        // move to the front of lru_
+        lru_.splice(lru_.begin(), lru_, lru_pos_[bid]);
+        return;
+    }
+    // close the least recently used blocks until the new block fits
+    while (!lru_.empty() && n_files_ + lsh->m_ > max_files_) {
+        int old = lru_.back(); lru_.pop_back();
+        blocks_[old]->close_trees();
+        lru_pos_[old] = lru_.end();
+        n_files_ -= blocks_[old]->m_;
+    }
+    lsh->open_trees();
+    lru_.push_front(bid);
+    lru_pos_[bid] = lru_.begin();
+    n_files_ += lsh->m_;
 }
 
 // -----------------------------------------------------------------------------
@@ -473,19 +813,34 @@ template<class DType>
 int QALSH_PLUS<DType>::read_params()// read parameters
 {
     char fname[200]; sprintf(fname, "%spara", path_);
-    FILE* fp = fopen(fname, "rb");
+    FILE* fp = pack_ ? pack_->open_entry(fname) : fopen(fname, "rb");
     if (!fp) { printf("Could not open %s\n", fname); return 1; }
 
-    // read general parameters
-    fread(&n_pts_,     sizeof(int), 1, fp);
-    fread(&dim_,       sizeof(int), 1, fp);
-    fread(&n_samples_, sizeof(int), 1, fp);
-    fread(&n_blocks_,  sizeof(int), 1, fp);
+    // read general parameters (a legacy para starts with n_pts_)
+    int  magic = 0, version = 0;
+    bool ok = fread(&magic, sizeof(int), 1, fp) == 1;
+    if (ok && magic == PARA_MAGIC) {
+        ok = fread(&version, sizeof(int), 1, fp) == 1 &&
+            fread(&n_pts_, sizeof(int), 1, fp) == 1;
+        if (ok && version > PARA_VERSION) {
+            printf("Unsupported para version %d\n", version); 
+            fclose(fp); return 1;
+        }
+    }
+    else n_pts_ = magic;
+
+    ok = ok && fread(&dim_,       sizeof(int), 1, fp) == 1;
+    ok = ok && fread(&n_samples_, sizeof(int), 1, fp) == 1;
+    ok = ok && fread(&n_blocks_,  sizeof(int), 1, fp) == 1;
+    ok = ok && n_pts_ > 0 && dim_ > 0 && n_samples_ > 0 && n_blocks_ > 0;
+    if (!ok) { printf("Could not read %s\n", fname); fclose(fp); return 1; }
 
     // load first level parameters, sample_index_ and sample_index_to_block_
     int n_sample_pts = n_blocks_*n_samples_;
     sample_index_ = new int[n_sample_pts];
-    fread(sample_index_, sizeof(int), n_sample_pts, fp);
+    ok = fread(sample_index_, sizeof(int), n_sample_pts, fp) == 
+        (size_t) n_sample_pts;
+    if (!ok) { printf("Could not read %s\n", fname); fclose(fp); return 1; }
     
     sample_index_to_block_ = new int[n_pts_];
     memset(sample_index_to_block_, -1, n_pts_);
@@ -502,9 +857,35 @@ int QALSH_PLUS<DType>::read_params()// read parameters
     block_size_ = new int[n_blocks_];
     index_ = new int[n_pts_];
 
-    fread(block_size_, sizeof(int), n_blocks_, fp);
-    fread(index_,      sizeof(int), n_pts_,    fp);
+    ok = fread(block_size_, sizeof(int), n_blocks_, fp) == (size_t) n_blocks_;
+    ok = ok && fread(index_, sizeof(int), n_pts_, fp) == (size_t) n_pts_;
+
+    // -------------------------------------------------------------------------
+    //  load bounding rectangles of blocks (rects_). a legacy index has none, 
+    //  so its rectangles cover the whole space, which prunes no block.
+    // -------------------------------------------------------------------------
+    for (int i = 0; i < n_blocks_; ++i) {
+        KD_Rect<DType> *rect = new KD_Rect<DType>(dim_,
+            std::numeric_limits<DType>::lowest(), 
+            std::numeric_limits<DType>::max());
+        if (ok && version >= 1) {
+            ok = fread(rect->low_,  sizeof(DType), dim_, fp) == (size_t) dim_
+              && fread(rect->high_, sizeof(DType), dim_, fp) == (size_t) dim_;
+        }
+        rects_.push_back(rect);
+    }
+
+    // load shared hash functions (m_ and a_), none in a legacy index
+    m_ = 0;
+    if (ok && version >= 1) ok = fread(&m_, sizeof(int), 1, fp) == 1;
+    if (ok && m_ > 0) {
+        a_ = new float[m_*dim_];
+        q_val_ = new float[m_];
+        size_t size = (size_t) m_*dim_;
+        ok = fread(a_, sizeof(float), size, fp) == size;
+    }
     fclose(fp);
+    if (!ok) { printf("Could not read %s\n", fname); return 1; }
     return 0;
 }
 
@@ -514,10 +895,15 @@ QALSH_PLUS<DType>::~QALSH_PLUS()    // destructor
 {
     for (int i = 0; i < n_blocks_; ++i) {
         delete blocks_[i]; blocks_[i] = NULL;
+        delete rects_[i];  rects_[i]  = NULL;
     }
     blocks_.clear(); blocks_.shrink_to_fit();
+    rects_.clear();  rects_.shrink_to_fit();
     delete lsh_;
 
+    delete[] box_dist_;
+    if (a_     != NULL) { delete[] a_;     a_     = NULL; }
+    if (q_val_ != NULL) { delete[] q_val_; q_val_ = NULL; }
     delete[] block_size_;
     delete[] sample_index_to_block_;
     delete[] sample_index_;
@@ -533,10 +919,317 @@ void QALSH_PLUS<DType>::display()   // display parameters
     printf("d         = %d\n", dim_);
     printf("n_samples = %d\n", n_samples_);
     printf("n_blocks  = %d\n", n_blocks_);
+    printf("m_shared  = %d\n", m_);
+    printf("max_files = %d\n", max_files_);
     printf("path      = %s\n", path_);
     printf("\n");
 }
 
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH_PLUS<DType>::insert(      // insert new data points
+    int   n,                            // number of new data points
+    int   leaf,                         // max number of points in a block
+    int   L,                            // number of projection (drusilla)
+    int   M,                            // number of candidates (drusilla)
+    const DType *data,                  // new data points
+    const char *dfolder)                // data folder
+{
+    if (pack_ != NULL) { printf("Could not insert into a pack\n"); return 1; }
+
+    // both halves of a split block of leaf+1 points need > n_samples_ points
+    if (L*M != n_samples_ || leaf < 2*n_samples_ + 2) {
+        printf("Invalid L (%d), M (%d), or leaf (%d) for %d samples\n", L, M,
+            leaf, n_samples_);
+        return 1;
+    }
+    // the b+ trees are re-opened for writing, so all blocks are closed here
+    int max_files = max_files_ + lsh_->m_;
+    for (QALSH<DType> *lsh : blocks_) {
+        if (lsh->check_insert()) return 1;
+    }
+    int B = blocks_[0]->B_;
+    if (append_data_new_form<DType>(n_pts_, n, dim_, B, data, dfolder)) {
+        return 1;
+    }
+
+    // -------------------------------------------------------------------------
+    //  route the new points to blocks. the rectangles grow on copies, so the
+    //  old ones are kept until all blocks take their new points.
+    // -------------------------------------------------------------------------
+    std::vector<KD_Rect<DType>*> old_rects = rects_;
+    for (int i = 0; i < n_blocks_; ++i) {
+        rects_[i] = new KD_Rect<DType>(dim_, *old_rects[i]);
+    }
+    std::vector<std::vector<int> > members(n_blocks_);
+    int start = 0;
+    for (int i = 0; i < n_blocks_; ++i) {
+        members[i].assign(&index_[start], &index_[start + block_size_[i]]);
+        start += block_size_[i];
+    }
+    for (int i = 0; i < n; ++i) {
+        const DType *point = &data[(uint64_t) i*dim_];
+        int bid = route(point);
+        members[bid].push_back(n_pts_ + i);
+
+        KD_Rect<DType> *rect = rects_[bid];
+        for (int j = 0; j < dim_; ++j) {
+            if (point[j] < rect->low_[j]) rect->low_[j] = point[j];
+            else if (point[j] > rect->high_[j]) rect->high_[j] = point[j];
+        }
+    }
+    if (stage_blocks(n, data, members)) {
+        for (int i = 0; i < n_blocks_; ++i) {
+            delete rects_[i]; rects_[i] = old_rects[i];
+        }
+        return 1;
+    }
+    for (KD_Rect<DType> *rect : old_rects) delete rect;
+    n_pts_ += n;
+
+    // split the blocks with more than leaf points (new blocks are appended)
+    std::vector<int> samples(sample_index_, 
+        sample_index_ + n_blocks_*n_samples_);
+    int old_blocks = n_blocks_;
+    for (int i = 0; i < n_blocks_; ++i) {
+        while ((int) members[i].size() > leaf) {
+            split_block(i, L, M, dfolder, members, samples);
+        }
+    }
+
+    // -------------------------------------------------------------------------
+    //  update index_, block_size_, and the sample data. the first level lsh 
+    //  index is rebuilt if any block is split, as its samples are changed.
+    // -------------------------------------------------------------------------
+    delete[] index_;      index_      = new int[n_pts_];
+    delete[] block_size_; block_size_ = new int[n_blocks_];
+    start = 0;
+    for (int i = 0; i < n_blocks_; ++i) {
+        block_size_[i] = (int) members[i].size();
+        std::copy(members[i].begin(), members[i].end(), &index_[start]);
+        blocks_[i]->index_ = (const int*) &index_[start];
+        start += block_size_[i];
+    }
+    int n_sample_pts = n_blocks_*n_samples_;
+    delete[] sample_index_; sample_index_ = new int[n_sample_pts];
+    std::copy(samples.begin(), samples.end(), sample_index_);
+
+    delete[] sample_index_to_block_; sample_index_to_block_ = new int[n_pts_];
+    for (int i = 0; i < n_sample_pts; ++i) {
+        sample_index_to_block_[sample_index_[i]] = i / n_samples_;
+    }
+    if (n_blocks_ > old_blocks) {
+        DType *sample_data = new DType[(uint64_t) n_sample_pts*dim_];
+        for (int i = 0; i < n_sample_pts; ++i) {
+            read_data_new_format<DType>(sample_index_[i], dim_, B, dfolder, 
+                &sample_data[(uint64_t) i*dim_]);
+        }
+        grow_shared_hash_func(n_sample_pts);
+
+        int LB = -1, interval = -1;
+        lsh_->get_leaf_params(LB, interval);
+        float p = lsh_->p_, zeta = lsh_->zeta_, c = lsh_->c_;
+        lsh_->remove_files(); delete lsh_;
+
+        char sample_path[200]; sprintf(sample_path, "%ssample/", path_);
+        lsh_ = new QALSH<DType>(n_sample_pts, dim_, B, p, zeta, c,
+            (const DType*) sample_data, sample_path, (const int*) sample_index_,
+            (const float*) a_, LB, interval);
+        delete[] sample_data;
+
+        delete[] box_dist_; box_dist_ = new float[n_blocks_];
+    }
+    lsh_->index_ = (const int*) sample_index_;
+    init_file_pool(max_files);
+
+    // write parameters to disk
+    return save_params();
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH_PLUS<DType>::route(       // find the block of a new data point
+    const DType *point)                 // data point
+{
+    // the closest bounding rectangle, and the smallest block for ties
+    int   bid  = -1;
+    float dist = MAXREAL;
+    for (int i = 0; i < n_blocks_; ++i) {
+        float d = calc_box_dist(lsh_->p_, rects_[i], point);
+        if (bid == -1 || d < dist || 
+            (d == dist && block_size_[i] < block_size_[bid])) {
+            bid = i; dist = d;
+        }
+    }
+    return bid;
+}
+
+// -----------------------------------------------------------------------------
+//  the new points of a block follow its old points, so the local ids in its 
+//  qalsh are still the positions in its part of index_. they are inserted 
+//  into a copy of the block in folder "<i>.new/", and the copies replace the 
+//  blocks only after all of them take their new points. on failure, the
+//  copies are removed, and the blocks are not changed.
+// -----------------------------------------------------------------------------
+template<class DType>
+int QALSH_PLUS<DType>::stage_blocks(// insert new data points into blocks
+    int   n,                            // number of new data points
+    const DType *data,                  // new data points
+    const std::vector<std::vector<int> > &members) // ids of blocks
+{
+    std::vector<int> bids;
+    std::vector<QALSH<DType>*> staged;
+    int ret = 0;
+    for (int i = 0; i < n_blocks_ && !ret; ++i) {
+        int cnt = (int) members[i].size() - block_size_[i];
+        if (cnt == 0) continue;
+
+        char stage_path[200]; sprintf(stage_path, "%s%d.new/", path_, i);
+        if (blocks_[i]->copy_files(stage_path)) { ret = 1; break; }
+        QALSH<DType> *lsh = new QALSH<DType>(stage_path, blocks_[i]->index_,
+            (const float*) a_, true, blocks_[i]->mmap_);
+        bids.push_back(i); staged.push_back(lsh);
+
+        DType *blk_data = new DType[(uint64_t) cnt*dim_];
+        for (int j = 0; j < cnt; ++j) {
+            int id = members[i][block_size_[i] + j] - n_pts_;
+            assert(id >= 0 && id < n);
+            copy(&data[(uint64_t) id*dim_], &blk_data[(uint64_t) j*dim_]);
+        }
+        ret = lsh->insert(cnt, (const DType*) blk_data);
+        delete[] blk_data;
+        if (ret) printf("Could not insert new points into block %d\n", i);
+    }
+    if (ret) {
+        for (QALSH<DType> *lsh : staged) { lsh->remove_files(); delete lsh; }
+        return 1;
+    }
+
+    // commit: each copy moves into the folder of its block
+    for (size_t k = 0; k < bids.size(); ++k) {
+        int i = bids[k];
+        char block_path[200]; sprintf(block_path, "%s%d/", path_, i);
+        blocks_[i]->close_trees();
+        if (staged[k]->move_files(block_path)) return 1;
+
+        delete blocks_[i]; blocks_[i] = staged[k];
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+//  the block is split by the median split of k-means partition, so the new 
+//  blocks have balanced sizes. the first one keeps the block id and folder of
+//  the old block, and the others are appended.
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH_PLUS<DType>::split_block(// split a block and rebuild its qalsh
+    int   bid,                          // block id
+    int   L,                            // #projection for drusilla-select
+    int   M,                            // #candidates for drusilla-select
+    const char *dfolder,                // data folder
+    std::vector<std::vector<int> > &members, // ids of blocks (update)
+    std::vector<int> &samples)          // sample data index (update)
+{
+    QALSH<DType> *old = blocks_[bid];
+    int   B = old->B_;
+    float p = old->p_, zeta = old->zeta_, c = old->c_;
+    int   LB = -1, interval = -1;
+    old->get_leaf_params(LB, interval);
+
+    // read the data points of this block and partition them
+    std::vector<int> ids = members[bid];
+    int n_blk = (int) ids.size();
+    DType *data = new DType[(uint64_t) n_blk*dim_];
+    for (int j = 0; j < n_blk; ++j) {
+        read_data_new_format<DType>(ids[j], dim_, B, dfolder, 
+            &data[(uint64_t) j*dim_]);
+    }
+    Partition<DType> *method = create_partition<DType>(1, n_blk, dim_, 
+        (n_blk + 1) / 2, (const DType*) data);
+    std::vector<int> part_size;
+    int *order = new int[n_blk];
+    method->partition(part_size, order);
+    delete method;
+
+    grow_shared_hash_func(n_blk);
+    old->remove_files(); delete old;
+    delete rects_[bid];
+
+    // rebuild rectangle, samples, and qalsh of each new block
+    int *sample_index  = new int[n_samples_];
+    DType *sample_data = new DType[(uint64_t) n_samples_*dim_];
+    int start = 0;
+    for (size_t k = 0; k < part_size.size(); ++k) {
+        int nid = k == 0 ? bid : n_blocks_;
+        int cnt = part_size[k];
+
+        std::vector<int> index(cnt);
+        DType *blk_data = new DType[(uint64_t) cnt*dim_];
+        for (int j = 0; j < cnt; ++j) {
+            int id = order[start + j];
+            index[j] = ids[id];
+            copy(&data[(uint64_t) id*dim_], &blk_data[(uint64_t) j*dim_]);
+        }
+        KD_Rect<DType> *rect = calc_block_rect(cnt, (const DType*) blk_data);
+
+        assert(cnt > n_samples_);
+        drusilla_select(cnt, L, M, index.data(), (const DType*) blk_data, 
+            sample_index, sample_data);
+
+        char block_path[200]; sprintf(block_path, "%s%d/", path_, nid);
+        QALSH<DType> *lsh = new QALSH<DType>(cnt, dim_, B, p, zeta, c, 
+            (const DType*) blk_data, block_path, NULL, (const float*) a_, 
+            LB, interval);
+        lsh->close_trees(); // re-opened on first use
+        delete[] blk_data;
+
+        if (k == 0) {
+            blocks_[bid] = lsh; rects_[bid] = rect; members[bid] = index;
+            std::copy(sample_index, sample_index + n_samples_, 
+                samples.begin() + (size_t) bid*n_samples_);
+        } else {
+            blocks_.push_back(lsh); rects_.push_back(rect); 
+            members.push_back(index);
+            samples.insert(samples.end(), sample_index, 
+                sample_index + n_samples_);
+            ++n_blocks_;
+        }
+        start += cnt;
+    }
+    delete[] sample_data;
+    delete[] sample_index;
+    delete[] order;
+    delete[] data;
+}
+
+// -----------------------------------------------------------------------------
+template<class DType>
+void QALSH_PLUS<DType>::grow_shared_hash_func(// grow shared hash functions
+    int   n)                            // number of data points
+{
+    // -------------------------------------------------------------------------
+    //  the new hash functions are appended to the family, so the indexes 
+    //  which use the first hash functions are not changed
+    // -------------------------------------------------------------------------
+    if (m_ == 0) return;
+
+    const QALSH<DType> *lsh = lsh_;
+    float w = -1.0f; int m = -1, l = -1;
+    QALSH<DType>::calc_params(n, lsh->p_, lsh->zeta_, lsh->c_, w, m, l);
+    if (m <= m_) return;
+
+    float *a = new float[m*dim_];
+    memcpy(a, a_, sizeof(float)*m_*dim_);
+    QALSH<DType>::gen_hash_func(m - m_, dim_, lsh->p_, lsh->zeta_, 
+        &a[m_*dim_]);
+    delete[] a_;    a_ = a; m_ = m;
+    delete[] q_val_; q_val_ = new float[m_];
+
+    lsh_->a_ = a_;
+    for (QALSH<DType> *blk : blocks_) blk->a_ = a_;
+}
+
 // -----------------------------------------------------------------------------
 template<class DType>
 uint64_t QALSH_PLUS<DType>::knn(    // k-NN search
@@ -544,10 +1237,18 @@ uint64_t QALSH_PLUS<DType>::knn(    // k-NN search
     int   nb,                           // number of blocks for search
     const DType *query,                 // input query
     const char *dfolder,                // data folder
-    MinK_List *list)                    // top-k results (return)
+    MinK_List *list,                    // top-k results (return)
+    const QueryParams *params)          // parameters of query (NULL: default)
 {
     assert(nb > 0 && nb <= n_blocks_);
     list->reset();
+    guarantee_ = true;
+
+    // the deadlines are for the whole query, so each block takes the rest
+    bool deadline = has_deadlines(params);
+    auto start = std::chrono::steady_clock::now();
+    uint64_t cand = 0;
+    QueryParams rest;
 
     // use sample data to determine the order of blocks for c-k-ANNS
     uint64_t page_io = 0;
@@ -556,13 +1257,52 @@ uint64_t QALSH_PLUS<DType>::knn(    // k-NN search
 
     // use <nb> blocks for c-k-ANNS
     for (int bid : block_order) {
-        page_io += blocks_[bid]->knn2(top_k, query, dfolder, list);
+        const QueryParams *blk_params = params;
+        if (deadline) {
+            float ms = std::chrono::duration<float, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+            if (!rest_deadlines(*params, ms, page_io, cand, rest)) {
+                guarantee_ = false; break;
+            }
+            blk_params = &rest;
+        }
+        QALSH<DType> *blk = blocks_[bid];
+        blk->guarantee_ = true; blk->dist_io_ = 0; // for a skipped block
+        page_io += knn_block(top_k, bid, query, dfolder, list, blk_params);
+        cand += blk->dist_io_;
+        if (!blk->guarantee_) { guarantee_ = false; break; }
     }
     block_order.clear(); block_order.shrink_to_fit();
 
     return page_io;
 }
 
+// -----------------------------------------------------------------------------
+template<class DType>
+uint64_t QALSH_PLUS<DType>::knn_block(// k-NN search in one block
+    int   top_k,                        // top-k value
+    int   bid,                          // block id
+    const DType *query,                 // query point
+    const char *dfolder,                // data folder
+    MinK_List *list,                    // top-k results (update)
+    const QueryParams *params)          // parameters of query (NULL: default)
+{
+    // -------------------------------------------------------------------------
+    //  NOTE: box_dist_ and q_val_ are computed by get_block_order(), so it must 
+    //  be called for the same query before
+    // -------------------------------------------------------------------------
+    // skip the block which cannot contribute
+    if (box_dist_[bid] >= list->max_key()) return 0;
+
+    open_block(bid);
+    if (m_ > 0) {
+        return blocks_[bid]->knn2(top_k, query, (const float*) q_val_, dfolder,
+            list, params);
+    } else {
+        return blocks_[bid]->knn2(top_k, query, dfolder, list, params);
+    }
+}
+
 // -----------------------------------------------------------------------------
 template<class DType>
 uint64_t QALSH_PLUS<DType>::get_block_order(// get block order
@@ -571,21 +1311,40 @@ uint64_t QALSH_PLUS<DType>::get_block_order(// get block order
     const char *dfolder,                // data folder
     std::vector<int> &block_order)      // block order (return)
 {
+    // project query once if the hash functions are shared by all blocks
     MinK_List *list = new MinK_List(MAXK);
-    uint64_t page_io = lsh_->knn2(MAXK, query, dfolder, list);
+    uint64_t page_io = 0;
+    if (m_ > 0) {
+        for (int i = 0; i < m_; ++i) {
+            q_val_[i] = calc_inner_product<DType>(dim_, &a_[i*dim_], query);
+        }
+        page_io = lsh_->knn2(MAXK, query, (const float*) q_val_, dfolder, list);
+    } else {
+        page_io = lsh_->knn2(MAXK, query, dfolder, list);
+    }
 
-    // init the counter of each block
+    // init the counter and the lower bound distance of each block
     Result *pair = new Result[n_blocks_];
     for (int i = 0; i < n_blocks_; ++i) {
         pair[i].id_  = i;
         pair[i].key_ = 0.0f;
+        box_dist_[i] = calc_box_dist(lsh_->p_, rects_[i], query);
     }
-    // select the first <nb> blocks with largest counters
+    // select the first <nb> blocks with largest counters, and break the ties 
+    // by the smallest lower bound distance
     for (int i = 0; i < list->size(); ++i) {
         int bid = sample_index_to_block_[list->ith_id(i)];
         pair[bid].key_ += 1.0f;
     }
-    qsort(pair, n_blocks_, sizeof(Result), ResultCompDesc);
+    const float *box_dist = box_dist_;
+    std::sort(pair, pair + n_blocks_, [box_dist](const Result &a, 
+        const Result &b) {
+        if (a.key_ != b.key_) return a.key_ > b.key_;
+        if (box_dist[a.id_] != box_dist[b.id_]) {
+            return box_dist[a.id_] < box_dist[b.id_];
+        }
+        return a.id_ < b.id_;
+    });
     
     for (int i = 0; i < nb; ++i) {
         // if (fabs(pair[i].key_) < FLOATZERO) break;
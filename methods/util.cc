@@ -31,6 +31,29 @@ void create_dir(                    // create directory
     }
 }
 
+// -----------------------------------------------------------------------------
+int copy_file(                      // copy a file
+    const char *src,                    // source file name
+    const char *dest)                   // destination file name
+{
+    FILE *in = fopen(src, "rb");
+    if (!in) { printf("Could not open %s\n", src); return 1; }
+    FILE *out = fopen(dest, "wb");
+    if (!out) { printf("Could not create %s\n", dest); fclose(in); return 1; }
+
+    char buf[65536];
+    size_t size = 0;
+    bool   fail = false;
+    while (!fail && (size = fread(buf, 1, sizeof(buf), in)) > 0) {
+        fail = fwrite(buf, 1, size, out) != size;
+    }
+    fail = fail || ferror(in);
+    fclose(in);
+    if (fclose(out) != 0) fail = true;
+    if (fail) { printf("Could not copy %s\n", src); return 1; }
+    return 0;
+}
+
 // -----------------------------------------------------------------------------
 int write_buffer_to_page(           // write buffer to one page
     int   B,                            // page size
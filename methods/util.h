@@ -32,6 +32,11 @@ extern uint64_t g_page_io;          // global param: page i/o
 void create_dir(                    // create directory
     char *path);                        // input path
 
+// -----------------------------------------------------------------------------
+int copy_file(                      // copy a file
+    const char *src,                    // source file name
+    const char *dest);                  // destination file name
+
 // -----------------------------------------------------------------------------
 int write_buffer_to_page(           // write buffer to one page
     int   B,                            // page size
@@ -150,6 +155,45 @@ int write_data_new_form(            // write dataset with new format
     return 0;
 }
 
+// -----------------------------------------------------------------------------
+template<class DType>
+int append_data_new_form(           // append data points with new format
+    int   n0,                           // number of existing data points
+    int   n,                            // number of new data points
+    int   d,                            // data dimension
+    int   B,                            // page size
+    const DType *data,                  // new data points
+    const char *dfolder)                // data folder
+{
+    char dpath[200]; sprintf(dpath, "%sdata/", dfolder);
+    create_dir(dpath);
+
+    // the last page of existing data points is read and filled up first
+    int num = (int) floor((float) B / (d*sizeof(DType)));
+    char *buffer = new char[B];
+
+    int start = 0;
+    while (start < n) {
+        int id  = n0 + start;
+        int pos = id % num;
+        int cnt = MIN(num - pos, n - start);
+
+        char fname[200]; sprintf(fname, "%s%d.data", dpath, id / num);
+        memset(buffer, 0, B*sizeof(char));
+        if (pos > 0 && read_buffer_from_page(B, fname, buffer)) {
+            delete[] buffer; return 1;
+        }
+        write_data_to_buffer<DType>(cnt, d, &data[(uint64_t)start*d], 
+            &buffer[(uint64_t) pos*d*sizeof(DType)]);
+        if (write_buffer_to_page(B, fname, (const char*) buffer)) {
+            delete[] buffer; return 1;
+        }
+        start += cnt;
+    }
+    delete[] buffer;
+    return 0;
+}
+
 // -----------------------------------------------------------------------------
 template<class DType>
 inline void read_data_from_buffer(  // read data from buffer
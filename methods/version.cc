@@ -0,0 +1,244 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "version.h"
+#include "util.h"
+#include "pack.h"
+
+namespace nns {
+
+// -----------------------------------------------------------------------------
+static void list_versions(          // list the versions in the output folder
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    std::vector<int> &versions)         // versions (return)
+{
+    DIR *dp = opendir(ofolder);
+    if (!dp) return;
+
+    int len = (int) strlen(name);
+    struct dirent *ent = NULL;
+    while ((ent = readdir(dp)) != NULL) {
+        // match the folders <name>.<v>
+        const char *s = ent->d_name;
+        if (strncmp(s, name, len) != 0 || s[len] != '.') continue;
+
+        const char *v = s + len + 1;
+        if (*v == '\0' || strspn(v, "0123456789") != strlen(v)) continue;
+        versions.push_back(atoi(v));
+    }
+    closedir(dp);
+}
+
+// -----------------------------------------------------------------------------
+static void remove_folder(          // remove a folder recursively
+    const char *path)                   // folder (ends with '/')
+{
+    DIR *dp = opendir(path);
+    if (!dp) return;
+
+    struct dirent *ent = NULL;
+    while ((ent = readdir(dp)) != NULL) {
+        if (ent->d_name[0] == '.') continue; // skip "." and ".."
+
+        char full[600]; sprintf(full, "%s%s", path, ent->d_name);
+        struct stat st;
+        if (stat(full, &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) { strcat(full, "/"); remove_folder(full); }
+        else remove(full);
+    }
+    closedir(dp);
+    rmdir(path);
+}
+
+// -----------------------------------------------------------------------------
+static int copy_folder(             // copy a folder recursively
+    const char *src,                    // source folder (ends with '/')
+    const char *dest)                   // destination folder (ends with '/')
+{
+    DIR *dp = opendir(src);
+    if (!dp) return 1;
+    if (mkdir(dest, 0755) != 0) { closedir(dp); return 1; }
+
+    int ret = 0;
+    struct dirent *ent = NULL;
+    while (ret == 0 && (ent = readdir(dp)) != NULL) {
+        if (ent->d_name[0] == '.') continue; // skip "." and ".."
+
+        char from[600]; sprintf(from, "%s%s", src,  ent->d_name);
+        char to[600];   sprintf(to,   "%s%s", dest, ent->d_name);
+        struct stat st;
+        if (stat(from, &st) != 0) { ret = 1; break; }
+
+        if (S_ISDIR(st.st_mode)) {
+            strcat(from, "/"); strcat(to, "/"); ret = copy_folder(from, to);
+        }
+        else ret = copy_file(from, to);
+    }
+    closedir(dp);
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+static void get_lock_name(          // get the lock file of a version
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   version,                      // version
+    char  *fname)                       // lock file (return)
+{
+    sprintf(fname, "%s%s.%d.lock", ofolder, name, version);
+}
+
+// -----------------------------------------------------------------------------
+int read_version(                   // read the current version (-1: none)
+    const char *ofolder,                // output folder
+    const char *name)                   // name of index
+{
+    char fname[200]; sprintf(fname, "%s%s.cur", ofolder, name);
+    FILE *fp = fopen(fname, "r");
+    if (!fp) return -1;
+
+    int version = -1;
+    if (fscanf(fp, "%d", &version) != 1) version = -1;
+    fclose(fp);
+    return version;
+}
+
+// -----------------------------------------------------------------------------
+//  the current version is never removed, and a version older than it is only
+//  removed under an exclusive lock. thus, if the version is still the current
+//  one once the shared lock is taken, it is kept until the lock is released.
+//  the folder <name>/ is never removed, so it needs no lock.
+// -----------------------------------------------------------------------------
+int read_locked_version(            // read and lock the current version
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   &lock)                        // lock of version (return)
+{
+    lock = -1;
+    while (true) {
+        int version = read_version(ofolder, name);
+        if (version < 0) return version;
+
+        char fname[200]; get_lock_name(ofolder, name, version, fname);
+        int fd = open(fname, O_RDONLY | O_CREAT, 0644);
+        if (fd < 0) { printf("Could not lock %s\n", fname); return version; }
+        if (flock(fd, LOCK_SH) != 0) {
+            printf("Could not lock %s\n", fname); close(fd); return version;
+        }
+        if (read_version(ofolder, name) == version) {
+            lock = fd; return version;
+        }
+        close(fd); // a new version is published meanwhile
+    }
+}
+
+// -----------------------------------------------------------------------------
+void unlock_version(                // release the lock of a version
+    int   lock)                         // lock of version (-1: none)
+{
+    if (lock >= 0) close(lock);
+}
+
+// -----------------------------------------------------------------------------
+void get_version_path(              // get the folder of a version of index
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   version,                      // version (-1: folder <name>/)
+    char  *path)                        // folder of version (return)
+{
+    if (version < 0) sprintf(path, "%s%s/", ofolder, name);
+    else sprintf(path, "%s%s.%d/", ofolder, name, version);
+}
+
+// -----------------------------------------------------------------------------
+int new_version(                    // get a new version for a staged build
+    const char *ofolder,                // output folder
+    const char *name)                   // name of index
+{
+    // skip the folders left by the staged builds which were not published
+    std::vector<int> versions;
+    list_versions(ofolder, name, versions);
+
+    int version = read_version(ofolder, name);
+    for (int v : versions) version = std::max(version, v);
+    return version + 1;
+}
+
+// -----------------------------------------------------------------------------
+int copy_version(                   // copy a version to a new version
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   from,                         // version to copy (-1: <name>/)
+    int   to)                           // new version
+{
+    char src[200];  get_version_path(ofolder, name, from, src);
+    char dest[200]; get_version_path(ofolder, name, to,   dest);
+    if (copy_folder(src, dest)) {
+        printf("Could not copy %s to %s\n", src, dest);
+        remove_folder(dest); return 1;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+int publish_version(                // publish a version as the current one
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   version)                      // version to publish
+{
+    char tname[200]; sprintf(tname, "%s%s.cur.tmp", ofolder, name);
+    char fname[200]; sprintf(fname, "%s%s.cur", ofolder, name);
+
+    FILE *fp = fopen(tname, "w");
+    if (!fp) { printf("Could not create %s\n", tname); return 1; }
+    fprintf(fp, "%d\n", version);
+    fflush(fp); fsync(fileno(fp));
+    fclose(fp);
+
+    // rename() replaces <name>.cur atomically
+    if (rename(tname, fname) != 0) {
+        printf("Could not rename %s to %s\n", tname, fname); return 1;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+int remove_version(                 // remove a version (if not held)
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   version)                      // version
+{
+    // the readers hold shared locks, so the exclusive lock fails if any
+    char lname[200]; get_lock_name(ofolder, name, version, lname);
+    int fd = open(lname, O_RDONLY | O_CREAT, 0644);
+    if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) != 0) { close(fd); return 1; }
+
+    char path[200]; get_version_path(ofolder, name, version, path);
+    remove_folder(path);
+
+    char fname[200]; Pack::get_pack_name(path, fname);
+    remove(fname);
+    remove(lname);
+    if (fd >= 0) close(fd);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+void remove_versions(               // remove the versions older than a version
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   version)                      // the oldest version to keep
+{
+    std::vector<int> versions;
+    list_versions(ofolder, name, versions);
+    for (int v : versions) {
+        if (v < version) remove_version(ofolder, name, v);
+    }
+}
+
+} // end namespace nns
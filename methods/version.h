@@ -0,0 +1,226 @@
+#pragma once
+
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include "def.h"
+
+namespace nns {
+
+// -----------------------------------------------------------------------------
+//  Versions of an index: a staged build writes a new folder <name>.<v>/ in the
+//  output folder, which is not seen by the readers until the build publishes
+//  it by renaming a new file <name>.cur (which stores <v>) over the old one.
+//  Thus, the switch from one version to the next one is atomic. Without the
+//  file <name>.cur, the index is in the folder <name>/ (i.e., version -1).
+//
+//  A reader holds a shared lock (flock) on the file <name>.<v>.lock while it
+//  uses the version <v>, so that an old version is only removed once no 
+//  reader (in any process) holds it.
+// -----------------------------------------------------------------------------
+int read_version(                   // read the current version (-1: none)
+    const char *ofolder,                // output folder
+    const char *name);                  // name of index
+
+// -----------------------------------------------------------------------------
+//  read the current version and hold a shared lock on it. the lock is taken 
+//  before the version is checked again, so the version cannot be removed in
+//  between. lock is the file descriptor (-1: no lock) for unlock_version().
+// -----------------------------------------------------------------------------
+int read_locked_version(            // read and lock the current version
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   &lock);                       // lock of version (return)
+
+// -----------------------------------------------------------------------------
+void unlock_version(                // release the lock of a version
+    int   lock);                        // lock of version (-1: none)
+
+// -----------------------------------------------------------------------------
+void get_version_path(              // get the folder of a version of index
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   version,                      // version (-1: folder <name>/)
+    char  *path);                       // folder of version (return)
+
+// -----------------------------------------------------------------------------
+int new_version(                    // get a new version for a staged build
+    const char *ofolder,                // output folder
+    const char *name);                  // name of index
+
+// -----------------------------------------------------------------------------
+int copy_version(                   // copy a version to a new version
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   from,                         // version to copy (-1: <name>/)
+    int   to);                          // new version
+
+// -----------------------------------------------------------------------------
+int publish_version(                // publish a version as the current one
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   version);                     // version to publish
+
+// -----------------------------------------------------------------------------
+//  the versions which are locked by readers are kept, and they are removed
+//  by a later call once they are released.
+// -----------------------------------------------------------------------------
+int remove_version(                 // remove a version (1: held by readers)
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   version);                     // version
+
+// -----------------------------------------------------------------------------
+void remove_versions(               // remove the versions older than a version
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    int   version);                     // the oldest version to keep
+
+// -----------------------------------------------------------------------------
+//  Index_Handle: the handle of the current version of an index in the search
+//  process.
+//
+//  A query acquires the index from the handle and holds it until it is done.
+//  The handle loads a newly published version aside (optionally by a watcher
+//  thread), and then swaps it in under a lock, so that the queries after the
+//  swap search the new version, while the in-flight queries finish on the old
+//  one, which is released by the last of them. The lock of a version is kept
+//  until then as well.
+// -----------------------------------------------------------------------------
+template<class Index>
+class Index_Handle {
+public:
+    typedef std::function<std::shared_ptr<Index>(const char*)> Loader;
+
+    // -------------------------------------------------------------------------
+    Index_Handle(                   // constructor (load the current version)
+        const char *ofolder,            // output folder
+        const char *name,               // name of index
+        Loader loader);                 // load an index from a folder
+
+    // -------------------------------------------------------------------------
+    ~Index_Handle();                // destructor
+
+    // -------------------------------------------------------------------------
+    std::shared_ptr<Index> acquire();// acquire the current index
+
+    // -------------------------------------------------------------------------
+    int refresh();                  // switch to the current version if changed
+
+    // -------------------------------------------------------------------------
+    void watch(                     // refresh by a watcher thread
+        int   interval);                // interval of checks (ms)
+
+    // -------------------------------------------------------------------------
+    int get_version() { return version_; }
+
+protected:
+    // -------------------------------------------------------------------------
+    std::shared_ptr<Index> load(    // load and lock the current version
+        int   &version);                // current version (return)
+
+    char   ofolder_[200];           // output folder
+    char   name_[200];              // name of index
+    Loader loader_;                 // load an index from a folder
+
+    std::mutex mutex_;              // lock of the current index
+    std::shared_ptr<Index> index_;  // current index
+    std::atomic<int>  version_;     // current version
+    std::atomic<bool> stop_;        // stop the watcher thread
+    std::thread watcher_;           // watcher thread
+};
+
+// -----------------------------------------------------------------------------
+template<class Index>
+Index_Handle<Index>::Index_Handle(  // constructor (load the current version)
+    const char *ofolder,                // output folder
+    const char *name,                   // name of index
+    Loader loader)                      // load an index from a folder
+    : loader_(loader), version_(-1), stop_(false)
+{
+    strcpy(ofolder_, ofolder);
+    strcpy(name_, name);
+
+    int version = -1;
+    index_ = load(version);
+    if (!index_) exit(1);
+    version_ = version;
+}
+
+// -----------------------------------------------------------------------------
+template<class Index>
+std::shared_ptr<Index> Index_Handle<Index>::load(// load and lock the current
+    int   &version)                     // current version (return)
+{
+    int  lock = -1;
+    version = read_locked_version(ofolder_, name_, lock);
+    char path[200]; get_version_path(ofolder_, name_, version, path);
+    std::shared_ptr<Index> index = loader_(path);
+    if (!index) {
+        printf("Could not load %s\n", path); unlock_version(lock); 
+        return NULL;
+    }
+    // the lock is released with the last reference of the index
+    return std::shared_ptr<Index>(index.get(), [index, lock](Index*) mutable {
+        index.reset(); unlock_version(lock); });
+}
+
+// -----------------------------------------------------------------------------
+template<class Index>
+Index_Handle<Index>::~Index_Handle()// destructor
+{
+    stop_ = true;
+    if (watcher_.joinable()) watcher_.join();
+}
+
+// -----------------------------------------------------------------------------
+template<class Index>
+std::shared_ptr<Index> Index_Handle<Index>::acquire()// acquire current index
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_;
+}
+
+// -----------------------------------------------------------------------------
+template<class Index>
+int Index_Handle<Index>::refresh()  // switch to the current version if changed
+{
+    int version = read_version(ofolder_, name_);
+    if (version == version_) return 0;
+
+    // load the new version without the lock, so the queries are not blocked
+    std::shared_ptr<Index> index = load(version);
+    if (!index) return -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        index_.swap(index);
+        version_ = version;
+    }
+    // the old version is released here unless it is held by the queries
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+template<class Index>
+void Index_Handle<Index>::watch(    // refresh by a watcher thread
+    int   interval)                     // interval of checks (ms)
+{
+    if (watcher_.joinable()) return;
+    watcher_ = std::thread([this, interval]() {
+        while (!stop_) {
+            if (refresh() == 1) {
+                printf("Switch %s to version %d\n", name_, (int) version_);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+        }
+    });
+}
+
+} // end namespace nns